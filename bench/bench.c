@@ -0,0 +1,816 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Copyright 2018 John Maloney, Bernat Romagosa, and Jens Mönig
+
+// bench.c - Interpreter benchmarks for the Linux host build
+// Runs handwritten bytecode programs with runTasksUntilDone() and reports the time,
+// instructions per second, and garbage collection pause times for each. Then runs tests
+// of the interpreter, garbage collector, and event wakeups that need the host build.
+//
+// Build and run from the linux+pi folder with: make bench && ./ublocks-bench [-nofuse] [-stw]
+// The -stw option disables the incremental garbage collector.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+#include "interp.h"
+#include "persist.h"
+
+// Opcodes
+
+enum {
+	halt = 0,
+	pushImmediate = 2,
+	pushLargeInteger = 3,
+	pushHugeInteger = 4,
+	pushLiteral = 5,
+	pushGlobal = 6,
+	storeGlobal = 7,
+	initLocals = 9,
+	pushLocal = 10,
+	storeLocal = 11,
+	pushArg = 13,
+	pop = 19,
+	jmp = 22,
+	jmpFalse = 25,
+	waitUntil = 30,
+	callFunction = 34,
+	returnResult = 35,
+	commandPrimitive = 36,
+	reporterPrimitive = 37,
+	add = 50,
+	subtract = 51,
+	multiply = 52,
+	modulo = 54,
+	lessThan = 61,
+	newList = 80,
+	at = 81,
+	digitalRead = 88,
+	digitalWrite = 89,
+	buttonA = 92,
+	codeEnd = 127,
+};
+
+// Bytecode Assembler
+
+#define MAX_CODE 1000
+#define MAX_LABELS 16
+#define MAX_FIXUPS 32
+#define MAX_LITERALS 16
+
+typedef struct {
+	int16 code[MAX_CODE];
+	int count;
+	int labels[MAX_LABELS];
+	struct { int at; int label; } fixups[MAX_FIXUPS];
+	int fixupCount;
+	struct { int at; const char *s; } literals[MAX_LITERALS];
+	int literalCount;
+} Assembler;
+
+static Assembler a;
+
+static void begin() {
+	memset(&a, 0, sizeof(a));
+}
+
+static void emit(int op, int arg) {
+	if (a.count >= MAX_CODE) { printf("Program too large\n"); exit(1); }
+	a.code[a.count++] = OP(op, arg);
+}
+
+static void emitWord(int word) {
+	if (a.count >= MAX_CODE) { printf("Program too large\n"); exit(1); }
+	a.code[a.count++] = word;
+}
+
+static void emitInt(int n) {
+	// Push the integer n using the smallest instruction.
+
+	int obj = (int) int2obj(n);
+	if ((-128 <= obj) && (obj <= 127)) {
+		emit(pushImmediate, obj);
+	} else if ((-8388608 <= obj) && (obj <= 8388607)) {
+		emit(pushLargeInteger, obj & 0xFF);
+		emitWord(obj >> 8);
+	} else {
+		emit(pushHugeInteger, 0);
+		emitWord(obj & 0xFFFF);
+		emitWord((obj >> 16) & 0xFFFF);
+	}
+}
+
+static void label(int labelID) {
+	a.labels[labelID] = a.count;
+}
+
+static void emitJump(int op, int labelID) {
+	// Emit a jump to the given label. The offset is filled in by end().
+
+	a.fixups[a.fixupCount].at = a.count;
+	a.fixups[a.fixupCount].label = labelID;
+	a.fixupCount++;
+	emit(op, 1); // placeholder offset
+}
+
+static void emitLiteral(int op, int arg, const char *s) {
+	// Emit a pushLiteral or named primitive call. The literal offset is filled in by end().
+
+	emit(op, arg);
+	a.literals[a.literalCount].at = a.count;
+	a.literals[a.literalCount].s = s;
+	a.literalCount++;
+	emitWord(0); // placeholder; second word holds literal offset (and primitive set index)
+}
+
+static void emitPrimitive(int op, PrimitiveSetIndex setIndex, const char *primName, int argCount) {
+	emitLiteral(op, argCount, primName);
+	a.code[a.count - 1] = setIndex << 10;
+}
+
+static int end() {
+	// Resolve jumps, append the literals, and return the code size in 32-bit words.
+
+	emit(codeEnd, 0);
+	if (a.count & 1) emit(codeEnd, 0); // pad to a word boundary
+
+	for (int i = 0; i < a.fixupCount; i++) {
+		int at = a.fixups[i].at;
+		int offset = a.labels[a.fixups[i].label] - (at + 1);
+		if ((offset < -128) || (offset > 127) || (offset == 0)) {
+			printf("Jump offset out of range\n");
+			exit(1);
+		}
+		a.code[at] = OP(CMD(a.code[at]), offset);
+	}
+
+	for (int i = 0; i < a.literalCount; i++) {
+		int at = a.literals[i].at;
+		const char *s = a.literals[i].s;
+		int wordCount = (strlen(s) + 4) / 4;
+		if ((a.count + 2 + (2 * wordCount)) > MAX_CODE) { printf("Program too large\n"); exit(1); }
+		a.code[at] |= (a.count - at) & 0x3FF;
+		uint32 header = HEADER(StringType, wordCount);
+		a.code[a.count++] = header & 0xFFFF;
+		a.code[a.count++] = header >> 16;
+		memset(&a.code[a.count], 0, 4 * wordCount);
+		memcpy(&a.code[a.count], s, strlen(s));
+		a.count += 2 * wordCount;
+	}
+	return a.count / 2;
+}
+
+// Benchmark Programs
+
+// Label IDs
+#define L0 0
+#define L1 1
+#define L2 2
+#define L3 3
+
+#define FIB_CHUNK 1
+
+static void loops() {
+	// Nested loops: for i < 200000 { for j < 50 { j += 1 } i += 1 }
+
+	emit(initLocals, 2);
+	label(L0);
+	emit(pushLocal, 0); emitInt(200000); emit(lessThan, 2); emitJump(jmpFalse, L3);
+	emitInt(0); emit(storeLocal, 1);
+	label(L1);
+	emit(pushLocal, 1); emitInt(50); emit(lessThan, 2); emitJump(jmpFalse, L2);
+	emit(pushLocal, 1); emitInt(1); emit(add, 2); emit(storeLocal, 1);
+	emitJump(jmp, L1);
+	label(L2);
+	emit(pushLocal, 0); emitInt(1); emit(add, 2); emit(storeLocal, 0);
+	emitJump(jmp, L0);
+	label(L3);
+	emit(halt, 0);
+}
+
+static void listBuild() {
+	// Repeat 200 times: build a list of 2000 integers with [data:addLast].
+
+	emit(initLocals, 3);
+	label(L0);
+	emit(pushLocal, 0); emitInt(200); emit(lessThan, 2); emitJump(jmpFalse, L3);
+	emit(newList, 0); emit(storeLocal, 2);
+	emitInt(0); emit(storeLocal, 1);
+	label(L1);
+	emit(pushLocal, 1); emitInt(2000); emit(lessThan, 2); emitJump(jmpFalse, L2);
+	emit(pushLocal, 1); emit(pushLocal, 2);
+	emitPrimitive(commandPrimitive, DataPrims, "addLast", 2);
+	emit(pushLocal, 1); emitInt(1); emit(add, 2); emit(storeLocal, 1);
+	emitJump(jmp, L1);
+	label(L2);
+	emit(pushLocal, 0); emitInt(1); emit(add, 2); emit(storeLocal, 0);
+	emitJump(jmp, L0);
+	label(L3);
+	emit(halt, 0);
+}
+
+static void stringJoin() {
+	// Repeat 500 times: build a 400 character string by joining "ab" 200 times.
+
+	emit(initLocals, 3);
+	label(L0);
+	emit(pushLocal, 0); emitInt(500); emit(lessThan, 2); emitJump(jmpFalse, L3);
+	emitLiteral(pushLiteral, 0, ""); emit(storeLocal, 2);
+	emitInt(0); emit(storeLocal, 1);
+	label(L1);
+	emit(pushLocal, 1); emitInt(200); emit(lessThan, 2); emitJump(jmpFalse, L2);
+	emit(pushLocal, 2); emitLiteral(pushLiteral, 0, "ab");
+	emitPrimitive(reporterPrimitive, DataPrims, "join", 2);
+	emit(storeLocal, 2);
+	emit(pushLocal, 1); emitInt(1); emit(add, 2); emit(storeLocal, 1);
+	emitJump(jmp, L1);
+	label(L2);
+	emit(pushLocal, 0); emitInt(1); emit(add, 2); emit(storeLocal, 0);
+	emitJump(jmp, L0);
+	label(L3);
+	emit(halt, 0);
+}
+
+static void csvLine() {
+	// Repeat 5 times: build a CSV line of about 10 KB with "set s to (join s i ',')".
+
+	emit(initLocals, 3);
+	label(L0);
+	emit(pushLocal, 0); emitInt(5); emit(lessThan, 2); emitJump(jmpFalse, L3);
+	emitLiteral(pushLiteral, 0, ""); emit(storeLocal, 2);
+	emitInt(0); emit(storeLocal, 1);
+	label(L1);
+	emit(pushLocal, 1); emitInt(2000); emit(lessThan, 2); emitJump(jmpFalse, L2);
+	emit(pushLocal, 2); emit(pushLocal, 1); emitLiteral(pushLiteral, 0, ",");
+	emitPrimitive(reporterPrimitive, DataPrims, "join", 3);
+	emit(storeLocal, 2);
+	emit(pushLocal, 1); emitInt(1); emit(add, 2); emit(storeLocal, 1);
+	emitJump(jmp, L1);
+	label(L2);
+	emit(pushLocal, 0); emitInt(1); emit(add, 2); emit(storeLocal, 0);
+	emitJump(jmp, L0);
+	label(L3);
+	emit(halt, 0);
+}
+
+static void shortStrings() {
+	// Join 200000 short strings, cycling through eight values: "led0" through "led7".
+
+	emit(initLocals, 2);
+	label(L0);
+	emit(pushLocal, 0); emitInt(200000); emit(lessThan, 2); emitJump(jmpFalse, L1);
+	emitLiteral(pushLiteral, 0, "led"); emit(pushLocal, 0); emitInt(8); emit(modulo, 2);
+	emitPrimitive(reporterPrimitive, DataPrims, "join", 2);
+	emit(storeLocal, 1);
+	emit(pushLocal, 0); emitInt(1); emit(add, 2); emit(storeLocal, 0);
+	emitJump(jmp, L0);
+	label(L1);
+	emit(halt, 0);
+}
+
+static void frameParse() {
+	// Parse 50000 frames of 256 bytes: take the header (bytes 1-4) and the payload (bytes
+	// 5-252) of each frame with [data:copyFromTo] and read the checksum (byte 256).
+
+	emit(initLocals, 4);
+	label(L0);
+	emit(pushLocal, 0); emitInt(50000); emit(lessThan, 2); emitJump(jmpFalse, L1);
+	emitInt(256); emitPrimitive(reporterPrimitive, DataPrims, "newByteArray", 1); emit(storeLocal, 1);
+	emit(pushLocal, 1); emitInt(1); emitInt(4);
+	emitPrimitive(reporterPrimitive, DataPrims, "copyFromTo", 3); emit(storeLocal, 2);
+	emit(pushLocal, 1); emitInt(5); emitInt(252);
+	emitPrimitive(reporterPrimitive, DataPrims, "copyFromTo", 3); emit(storeLocal, 2);
+	emitInt(256); emit(pushLocal, 1); emit(at, 2); emit(storeLocal, 3);
+	emit(pushLocal, 0); emitInt(1); emit(add, 2); emit(storeLocal, 0);
+	emitJump(jmp, L0);
+	label(L1);
+	emit(halt, 0);
+}
+
+static int useDictionary = false;
+
+static void keyLookup() {
+	// Store 200 values under the keys "k0" through "k199", then look up 20000 keys. The
+	// values are stored in a dictionary if useDictionary is true, otherwise in a list
+	// parallel to a list of the keys that is searched with [data:find].
+
+	emit(initLocals, 4);
+	if (useDictionary) {
+		emitPrimitive(reporterPrimitive, DataPrims, "newDictionary", 0); emit(storeLocal, 1);
+	} else {
+		emit(newList, 0); emit(storeLocal, 1);
+		emit(newList, 0); emit(storeLocal, 2);
+	}
+	label(L0);
+	emit(pushLocal, 0); emitInt(200); emit(lessThan, 2); emitJump(jmpFalse, L1);
+	if (useDictionary) {
+		emit(pushLocal, 1); emitLiteral(pushLiteral, 0, "k"); emit(pushLocal, 0);
+		emitPrimitive(reporterPrimitive, DataPrims, "join", 2);
+		emit(pushLocal, 0);
+		emitPrimitive(commandPrimitive, DataPrims, "dictionaryAtPut", 3);
+	} else {
+		emitLiteral(pushLiteral, 0, "k"); emit(pushLocal, 0);
+		emitPrimitive(reporterPrimitive, DataPrims, "join", 2);
+		emit(pushLocal, 1); emitPrimitive(commandPrimitive, DataPrims, "addLast", 2);
+		emit(pushLocal, 0); emit(pushLocal, 2); emitPrimitive(commandPrimitive, DataPrims, "addLast", 2);
+	}
+	emit(pushLocal, 0); emitInt(1); emit(add, 2); emit(storeLocal, 0);
+	emitJump(jmp, L0);
+	label(L1);
+	emitInt(0); emit(storeLocal, 0);
+	label(L2);
+	emit(pushLocal, 0); emitInt(20000); emit(lessThan, 2); emitJump(jmpFalse, L3);
+	emitLiteral(pushLiteral, 0, "k"); emit(pushLocal, 0); emitInt(200); emit(modulo, 2);
+	emitPrimitive(reporterPrimitive, DataPrims, "join", 2); emit(storeLocal, 3);
+	if (useDictionary) {
+		emit(pushLocal, 1); emit(pushLocal, 3);
+		emitPrimitive(reporterPrimitive, DataPrims, "dictionaryAt", 2);
+	} else {
+		emit(pushLocal, 3); emit(pushLocal, 1); emitPrimitive(reporterPrimitive, DataPrims, "find", 2);
+		emit(pushLocal, 2); emit(at, 2);
+	}
+	emit(pop, 1);
+	emit(pushLocal, 0); emitInt(1); emit(add, 2); emit(storeLocal, 0);
+	emitJump(jmp, L2);
+	label(L3);
+	emit(halt, 0);
+}
+
+static void sortSamples() {
+	// Repeat 200 times: fill a list with 300 pseudo-random samples, sort it with [data:sort],
+	// and find the median sample with [data:binarySearch].
+
+	emit(initLocals, 3);
+	label(L0);
+	emit(pushLocal, 0); emitInt(200); emit(lessThan, 2); emitJump(jmpFalse, L3);
+	emit(newList, 0); emit(storeLocal, 2);
+	emitInt(0); emit(storeLocal, 1);
+	label(L1);
+	emit(pushLocal, 1); emitInt(300); emit(lessThan, 2); emitJump(jmpFalse, L2);
+	emit(pushLocal, 1); emitInt(7919); emit(multiply, 2); emit(pushLocal, 0); emit(add, 2);
+	emitInt(1000); emit(modulo, 2);
+	emit(pushLocal, 2); emitPrimitive(commandPrimitive, DataPrims, "addLast", 2);
+	emit(pushLocal, 1); emitInt(1); emit(add, 2); emit(storeLocal, 1);
+	emitJump(jmp, L1);
+	label(L2);
+	emit(pushLocal, 2); emitPrimitive(commandPrimitive, DataPrims, "sort", 1);
+	emitInt(150); emit(pushLocal, 2); emit(at, 2); emit(pushLocal, 2);
+	emitPrimitive(reporterPrimitive, DataPrims, "binarySearch", 2); emit(pop, 1);
+	emit(pushLocal, 0); emitInt(1); emit(add, 2); emit(storeLocal, 0);
+	emitJump(jmp, L0);
+	label(L3);
+	emit(halt, 0);
+}
+
+static void fibFunction() {
+	// fib(n): if (n < 2) return n; return fib(n - 1) + fib(n - 2)
+
+	emit(pushArg, 0); emitInt(2); emit(lessThan, 2); emitJump(jmpFalse, L0);
+	emit(pushArg, 0); emit(returnResult, 0);
+	label(L0);
+	emit(pushArg, 0); emitInt(1); emit(subtract, 2);
+	emit(callFunction, 0); emitWord((FIB_CHUNK << 8) | 1);
+	emit(pushArg, 0); emitInt(2); emit(subtract, 2);
+	emit(callFunction, 0); emitWord((FIB_CHUNK << 8) | 1);
+	emit(add, 2);
+	emit(returnResult, 0);
+}
+
+static void calls() {
+	// Call fib(27) (about 300,000 function calls).
+
+	emitInt(27);
+	emit(callFunction, 0); emitWord((FIB_CHUNK << 8) | 1);
+	emit(pop, 1);
+	emit(halt, 0);
+}
+
+static int appendCount = 10000;
+
+static void listAppend() {
+	// Repeat 20 times: append appendCount integers to a new list with [data:addLast].
+	// A short-lived list is allocated before each append so other allocations are
+	// interleaved with the list growth. The time should scale linearly with appendCount.
+
+	emit(initLocals, 3);
+	label(L0);
+	emit(pushLocal, 0); emitInt(20); emit(lessThan, 2); emitJump(jmpFalse, L3);
+	emit(newList, 0); emit(storeLocal, 2);
+	emitInt(0); emit(storeLocal, 1);
+	label(L1);
+	emit(pushLocal, 1); emitInt(appendCount); emit(lessThan, 2); emitJump(jmpFalse, L2);
+	emitInt(1); emit(newList, 1); emit(pop, 1);
+	emit(pushLocal, 1); emit(pushLocal, 2);
+	emitPrimitive(commandPrimitive, DataPrims, "addLast", 2);
+	emit(pushLocal, 1); emitInt(1); emit(add, 2); emit(storeLocal, 1);
+	emitJump(jmp, L1);
+	label(L2);
+	emit(pushLocal, 0); emitInt(1); emit(add, 2); emit(storeLocal, 0);
+	emitJump(jmp, L0);
+	label(L3);
+	emit(halt, 0);
+}
+
+static void gcChurn() {
+	// Allocate 1000000 short-lived lists of 20 items.
+
+	emit(initLocals, 2);
+	label(L0);
+	emit(pushLocal, 0); emitInt(1000000); emit(lessThan, 2); emitJump(jmpFalse, L1);
+	emitInt(20); emit(newList, 1); emit(storeLocal, 1);
+	emit(pushLocal, 0); emitInt(1); emit(add, 2); emit(storeLocal, 0);
+	emitJump(jmp, L0);
+	label(L1);
+	emit(halt, 0);
+}
+
+// Benchmark Runner
+
+#define BENCH_CHUNK 0
+
+static int chunkRecords[5][PERSISTENT_HEADER_WORDS + (MAX_CODE / 2)];
+static int useFusion = true;
+
+static void installChunk(int chunkIndex, int chunkType, void (*generator)()) {
+	// Assemble a program and install it as a code chunk.
+
+	begin();
+	generator();
+	int wordCount = end();
+	int *record = chunkRecords[chunkIndex];
+	growChunkTable(chunkIndex);
+	record[0] = ('R' << 24) | (chunkCode << 16) | (chunkIndex << 8) | chunkType;
+	record[1] = wordCount;
+	memcpy(&record[PERSISTENT_HEADER_WORDS], a.code, 4 * wordCount);
+	chunks[chunkIndex].code = record;
+	chunks[chunkIndex].chunkType = chunkType;
+	clearPrimitiveCache(); // record buffers are reused, so cached call sites may be stale
+	cachePrimitivesInChunk(record);
+	if (useFusion) fuseChunk(chunkIndex);
+}
+
+static void runBenchmark(const char *name, void (*generator)()) {
+	installChunk(BENCH_CHUNK, command, generator);
+	memClear();
+
+	opCount = 0;
+	clearGCStats();
+	uint32 startT = microsecs();
+	startTaskForChunk(BENCH_CHUNK);
+	runTasksUntilDone();
+	uint32 usecs = microsecs() - startT;
+	if (usecs == 0) usecs = 1;
+
+	int pauseCount = 0;
+	for (int i = 0; i < GC_PAUSE_BUCKETS; i++) pauseCount += gcPauseHistogram[i];
+
+	printf("%-12s %6d msecs %10u ops %7d Kops/sec %4d GCs %5d minor %4d cycles %5d max %5d avg usecs\n",
+		name, usecs / 1000, opCount, (int) (((uint64) opCount * 1000) / usecs),
+		gcCount, gcMinorCount, gcCycleCount, gcMaxUSecs, pauseCount ? (gcTotalUSecs / pauseCount) : 0);
+	releaseFusedChunk(BENCH_CHUNK);
+}
+
+// GC Tests
+
+static void churn(int count) {
+	// Allocate garbage, running gcStep() as the interpreter would between task runs.
+
+	for (int i = 0; i < count; i++) {
+		newObj(ListType, 10, zeroObj);
+		if ((i % 10) == 0) gcStep();
+	}
+}
+
+#define SPLIT_ITEMS 2000
+
+static void splitGCTest() {
+	// Check that the items of a list built by a primitive survive when a full GC happens
+	// partway through building it. The result list is too big for the nursery and the old
+	// space is nearly filled with garbage, so the items fill the nursery and then force a
+	// gc(). Allocating more garbage afterwards runs nursery collections that would free any
+	// items stored into the list without a write barrier.
+
+	memClear();
+	char *s = (char *) malloc(9 * SPLIT_ITEMS);
+	for (int i = 0; i < SPLIT_ITEMS; i++) sprintf(&s[9 * i], "item%04d,", i);
+	s[(9 * SPLIT_ITEMS) - 1] = 0; // remove the final comma
+	vars[1] = newStringFromBytes(s, strlen(s));
+	vars[2] = newStringFromBytes(",", 1);
+	newObj(ByteArrayType, wordsFree() - (SPLIT_ITEMS + 50), zeroObj); // garbage
+
+	int startCount = gcCount;
+	vars[0] = doPrimitiveCall(DataPrims, "split", 2, &vars[1]);
+	int failures = (gcCount == startCount) ? 1 : 0;
+	if (failures) printf("splitGCTest: split did not force a GC\n");
+
+	churn(200000);
+	for (int i = 0; i < SPLIT_ITEMS; i++) {
+		OBJ item = FIELD(vars[0], i + 1);
+		if (!IS_TYPE(item, StringType) || (0 != strncmp(obj2str(item), &s[9 * i], 8))) {
+			printf("splitGCTest: item %d is wrong\n", i + 1);
+			failures++;
+			break;
+		}
+	}
+	printf("%s\n", failures ? "splitGCTest failed" : "splitGCTest passed");
+	free(s);
+	memClear();
+}
+
+static void resizeGCTest() {
+	// Check that growing an old list that only an old container refers to does not leave the
+	// container pointing at a young copy that a nursery collection then frees.
+
+	memClear();
+	int failures = 0;
+	vars[2] = newObj(ListType, 4, zeroObj); // inner list; the outer list follows it
+	FIELD(vars[2], 0) = int2obj(0);
+	vars[1] = newObj(ListType, 2, zeroObj); // outer list
+	FIELD(vars[1], 0) = int2obj(1);
+	FIELD(vars[1], 1) = vars[2];
+	vars[2] = zeroObj; // only the outer list refers to the inner one
+	gc(); // make both lists old
+	gcStep(); // set up the nursery again
+
+	for (int i = 1; i <= 10; i++) {
+		vars[2] = int2obj(i);
+		vars[3] = FIELD(vars[1], 1);
+		doPrimitiveCall(DataPrims, "addLast", 2, &vars[2]);
+	}
+	vars[3] = zeroObj;
+	churn(200000);
+	OBJ inner = FIELD(vars[1], 1);
+	if (!IS_TYPE(inner, ListType) || (int2obj(10) != FIELD(inner, 0)) || (int2obj(10) != FIELD(inner, 10))) {
+		printf("resizeGCTest: the grown list was lost\n");
+		failures++;
+	}
+
+	// an old list grown in place keeps its header flags (e.g. the remembered set flag)
+	gc(); // leaves the nursery empty, so the next list is old and followed by the free chunk
+	vars[2] = newObj(ListType, 2, zeroObj);
+	FIELD(vars[2], 0) = int2obj(0);
+	uint32 flags = *vars[2] & 0xF0000000;
+	vars[3] = vars[2];
+	for (int i = 1; i <= 3; i++) {
+		vars[2] = int2obj(i);
+		doPrimitiveCall(DataPrims, "addLast", 2, &vars[2]);
+	}
+	if (!flags || (WORDS(vars[3]) <= 2) || ((*vars[3] & 0xF0000000) != flags)) {
+		printf("resizeGCTest: growing in place lost the header flags\n");
+		failures++;
+	}
+	printf("%s\n", failures ? "resizeGCTest failed" : "resizeGCTest passed");
+	memClear();
+}
+
+static void appendMoveTest() {
+	// Check that appending 10000 items to a list, with short-lived allocations interleaved,
+	// moves the list (and so scans the object store to forward references to it) only
+	// O(log N) times. Each move is one step of geometric growth that could not be done
+	// in place; all other appends neither grow nor move the list.
+
+	memClear();
+	vars[1] = newObj(ListType, 2, zeroObj);
+	FIELD(vars[1], 0) = int2obj(0);
+	int moves = 0;
+	for (int i = 1; i <= 10000; i++) {
+		vars[4] = newObj(ListType, 3, zeroObj); // short-lived
+		OBJ oldList = vars[1];
+		vars[2] = int2obj(i);
+		vars[3] = vars[1];
+		doPrimitiveCall(DataPrims, "addLast", 2, &vars[2]);
+		if (vars[1] != oldList) moves++;
+	}
+	vars[4] = zeroObj;
+	int failures = 0;
+	if ((int2obj(10000) != FIELD(vars[1], 0)) || (int2obj(10000) != FIELD(vars[1], 10000))) {
+		printf("appendMoveTest: items were lost\n");
+		failures++;
+	}
+	if (moves > 25) { // growing by half from 3 to 10000 items takes about 20 steps
+		printf("appendMoveTest: the list moved %d times\n", moves);
+		failures++;
+	}
+	printf("%s\n", failures ? "appendMoveTest failed" : "appendMoveTest passed");
+	memClear();
+}
+
+static int sliceBytesAre(OBJ slice, int first) {
+	for (int i = 0; i < SLICE_COUNT(slice); i++) {
+		if (SLICE_BYTES(slice)[i] != ((first + i) & 255)) return false;
+	}
+	return true;
+}
+
+static void sliceTest() {
+	// Check that a primitive that modifies a shared byte array leaves the bytes of its slices
+	// unchanged, that slices survive nursery and incremental collections, and that the
+	// garbage collector clears SHARED_FLAG once the slices of a byte array die.
+
+	memClear();
+	int failures = 0;
+	vars[0] = newObj(ByteArrayType, 16, zeroObj);
+	for (int i = 0; i < 64; i++) ((uint8 *) &FIELD(vars[0], 0))[i] = i;
+
+	vars[1] = vars[0];
+	vars[2] = int2obj(9);
+	vars[3] = int2obj(40);
+	vars[4] = doPrimitiveCall(DataPrims, "copyFromTo", 3, &vars[1]);
+	if (!IS_TYPE(vars[4], SliceType) || !(*vars[0] & SHARED_FLAG)) {
+		printf("sliceTest: copyFromTo did not return a slice\n");
+		failures++;
+	}
+	vars[1] = vars[0];
+	doPrimitiveCall(DataPrims, "reverse", 1, &vars[1]);
+	if ((63 != ((uint8 *) &FIELD(vars[0], 0))[0]) || !sliceBytesAre(vars[4], 8)) {
+		printf("sliceTest: reverse did not unshare the byte array\n");
+		failures++;
+	}
+
+	churn(200000);
+	if ((1 != sliceCount) || !(*SLICE_PARENT(vars[4]) & SHARED_FLAG) || !sliceBytesAre(vars[4], 8)) {
+		printf("sliceTest: a live slice was lost\n");
+		failures++;
+	}
+
+	vars[1] = vars[0];
+	vars[4] = doPrimitiveCall(DataPrims, "copyFromTo", 3, &vars[1]); // young slice
+	vars[4] = zeroObj; // the first slice is garbage now, too, but it is old
+	churn(200000);
+	if (*vars[0] & SHARED_FLAG) {
+		printf("sliceTest: SHARED_FLAG not cleared after a young slice died\n");
+		failures++;
+	}
+
+	vars[1] = vars[0];
+	vars[4] = doPrimitiveCall(DataPrims, "copyFromTo", 3, &vars[1]);
+	gc();
+	vars[4] = zeroObj;
+	gc();
+	if (sliceCount || (*vars[0] & SHARED_FLAG)) {
+		printf("sliceTest: SHARED_FLAG not cleared after an old slice died\n");
+		failures++;
+	}
+	printf("%s\n", failures ? "sliceTest failed" : "sliceTest passed");
+	memClear();
+}
+
+// Event Wakeup Tests
+
+// linux.c leaves the digital pin and button primitives out of the benchmark build so that
+// they can be simulated here. A simulated pin reads back the level last written to it.
+
+#define SIM_PINS 8
+
+static int simPinLevels[SIM_PINS];
+
+OBJ primDigitalRead(int argCount, OBJ *args) {
+	int pinNum = obj2int(args[0]) & (SIM_PINS - 1);
+	watchPin(pinNum, simPinLevels[pinNum]);
+	return simPinLevels[pinNum] ? trueObj : falseObj;
+}
+
+void primDigitalWrite(OBJ *args) {
+	simPinLevels[obj2int(args[0]) & (SIM_PINS - 1)] = (trueObj == args[1]);
+}
+
+int readWatchedPin(int pinNum) {
+	return simPinLevels[pinNum & (SIM_PINS - 1)];
+}
+
+static int simButtonA = false;
+
+OBJ primButtonA(OBJ *args) { return simButtonA ? trueObj : falseObj; }
+OBJ primButtonB(OBJ *args) { return falseObj; }
+
+#define PIN_WAITER_CHUNK 2
+#define PIN_READER_CHUNK 3
+
+#define BUTTON_WAITER_CHUNK 4
+
+static void buttonWaiter() {
+	// wait until (buttonA); global 1 = 1
+
+	label(L0);
+	emit(buttonA, 0); emitJump(waitUntil, L0);
+	emitInt(1); emit(storeGlobal, 1);
+	emit(halt, 0);
+}
+
+static void pinWaiter() {
+	// wait until (digitalRead 1); global 1 = 1
+
+	label(L0);
+	emitInt(1); emit(digitalRead, 1); emitJump(waitUntil, L0);
+	emitInt(1); emit(storeGlobal, 1);
+	emit(halt, 0);
+}
+
+static void pinReader() {
+	// digitalWrite 1 true; digitalRead 1 (result ignored)
+
+	emitInt(1); emit(pushImmediate, (int) trueObj); emit(digitalWrite, 2);
+	emitInt(1); emit(digitalRead, 1); emit(pop, 1);
+	emit(halt, 0);
+}
+
+static void pinWakeTest() {
+	// Check that a task parked on a pin wakes when the pin changes, even when another task
+	// reads the pin's new level before the scheduler checks the watched pins.
+
+	memClear();
+	simPinLevels[1] = 0;
+	installChunk(PIN_WAITER_CHUNK, command, pinWaiter);
+	installChunk(PIN_READER_CHUNK, command, pinReader);
+	startTaskForChunk(PIN_WAITER_CHUNK);
+	runTasksUntilDone(); // returns when the waiter is parked
+	startTaskForChunk(PIN_READER_CHUNK);
+	runTasksUntilDone();
+	printf("%s\n", (int2obj(1) == vars[1]) ? "pinWakeTest passed" : "pinWakeTest failed");
+	stopAllTasksButThis(NULL);
+	memClear();
+}
+
+static void checkButtonsLater() {
+	// Call checkButtons() once its check interval has passed.
+
+	uint32 start = microsecs();
+	while ((microsecs() - start) < 20000) /* wait */;
+	checkButtons();
+}
+
+static void buttonWakeTest() {
+	// Check that a task parked on a button stays parked while the button does not change and
+	// wakes when it is pressed.
+
+	memClear();
+	int failures = 0;
+	simButtonA = false;
+	installChunk(BUTTON_WAITER_CHUNK, command, buttonWaiter);
+	startTaskForChunk(BUTTON_WAITER_CHUNK);
+	runTasksUntilDone(); // returns when the waiter is parked
+	checkButtonsLater();
+	for (int t = 0; t < taskCount; t++) {
+		if (running == tasks[t]->status) {
+			printf("buttonWakeTest: an unchanged button woke the waiter\n");
+			failures++;
+		}
+	}
+	simButtonA = true;
+	checkButtonsLater();
+	runTasksUntilDone();
+	if (int2obj(1) != vars[1]) {
+		printf("buttonWakeTest: pressing the button did not wake the waiter\n");
+		failures++;
+	}
+	printf("%s\n", failures ? "buttonWakeTest failed" : "buttonWakeTest passed");
+	stopAllTasksButThis(NULL);
+	simButtonA = false;
+	memClear();
+}
+
+// Main
+
+int main(int argc, char *argv[]) {
+	for (int i = 1; i < argc; i++) {
+		if (0 == strcmp(argv[i], "-nofuse")) useFusion = false;
+		if (0 == strcmp(argv[i], "-stw")) gcMaxPauseUSecs = 0;
+	}
+
+	memInit();
+	primsInit();
+	installChunk(FIB_CHUNK, functionHat, fibFunction);
+
+	printf("MicroBlocks interpreter benchmarks (%s, max GC pause %d usecs)\n",
+		useFusion ? "fusion on" : "fusion off", gcMaxPauseUSecs);
+	runBenchmark("loops", loops);
+	runBenchmark("listBuild", listBuild);
+	runBenchmark("stringJoin", stringJoin);
+	runBenchmark("shortStrings", shortStrings);
+	runBenchmark("csvLine", csvLine);
+	runBenchmark("frameParse", frameParse);
+	runBenchmark("listLookup", keyLookup);
+	useDictionary = true;
+	runBenchmark("dictLookup", keyLookup);
+	runBenchmark("sortSamples", sortSamples);
+	runBenchmark("calls", calls);
+	runBenchmark("gcChurn", gcChurn);
+	for (appendCount = 5000; appendCount <= 20000; appendCount *= 2) {
+		char name[20];
+		sprintf(name, "append%dk", appendCount / 1000);
+		runBenchmark(name, listAppend);
+	}
+	primCallBenchmark();
+	fusionTest();
+	splitGCTest();
+	resizeGCTest();
+	appendMoveTest();
+	sliceTest();
+	pinWakeTest();
+	buttonWakeTest();
+	return 0;
+}
@@ -0,0 +1,230 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Copyright 2018 John Maloney, Bernat Romagosa, and Jens Mönig
+
+// linux.c - Linux host platform
+// Runs the VM as a Linux process. The IDE connects through a pseudoterminal.
+// Hardware I/O is stubbed out and code is kept in a RAM code store saved to a file.
+
+#define _DEFAULT_SOURCE // enable usleep() and symlink() declarations
+#define _XOPEN_SOURCE 600 // enable posix_openpt() and friends
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mem.h"
+#include "interp.h"
+#include "persist.h"
+#include "linux.h"
+
+// Timing Functions
+
+static uint64 startUSecs = 0;
+
+static uint64 clockUSecs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+uint64 totalMicrosecs() {
+	if (!startUSecs) startUSecs = clockUSecs();
+	return clockUSecs() - startUSecs;
+}
+
+uint32 microsecs() { return (uint32) totalMicrosecs(); }
+uint32 millisecs() { return (uint32) (totalMicrosecs() / 1000); }
+uint32 seconds() { return (uint32) (totalMicrosecs() / 1000000); }
+void handleMicosecondClockWrap() { } // not needed; clock is 64 bits
+
+void delay(unsigned long msecs) { usleep(1000 * msecs); }
+
+// Communication with the IDE via a Pseudoterminal
+
+#define PTY_LINK "/tmp/ublocksptyclient"
+
+static int pty = -1; // pseudoterminal file descriptor; -1 if not open
+
+void openPseudoTerminal() {
+	pty = posix_openpt(O_RDWR | O_NOCTTY);
+	if ((pty < 0) || (grantpt(pty) < 0) || (unlockpt(pty) < 0)) {
+		perror("Could not open pseudoterminal");
+		exit(1);
+	}
+
+	struct termios settings;
+	tcgetattr(pty, &settings);
+	cfmakeraw(&settings);
+	tcsetattr(pty, TCSANOW, &settings);
+	fcntl(pty, F_SETFL, fcntl(pty, F_GETFL) | O_NONBLOCK);
+
+	unlink(PTY_LINK);
+	if (symlink(ptsname(pty), PTY_LINK) < 0) {
+		perror("Could not create pseudoterminal link");
+	}
+	printf("Connect the IDE to %s (%s)\n", PTY_LINK, ptsname(pty));
+}
+
+void closePseudoTerminal() {
+	if (pty < 0) return;
+	close(pty);
+	unlink(PTY_LINK);
+	pty = -1;
+}
+
+int recvBytes(uint8 *buf, int count) {
+	if (pty < 0) return 0;
+	int bytesRead = read(pty, buf, count);
+	return (bytesRead > 0) ? bytesRead : 0;
+}
+
+int sendBytes(uint8 *buf, int start, int end) {
+	// Send bytes buf[start] through buf[end - 1] and return the number of bytes sent.
+	// Output is discarded if there is no pseudoterminal (e.g. when benchmarking).
+
+	if (pty < 0) return end - start;
+	int bytesWritten = write(pty, &buf[start], end - start);
+	return (bytesWritten > 0) ? bytesWritten : 0;
+}
+
+int ideConnected() {
+	if ((pty < 0) || (0 == lastRcvTime)) return false;
+	return (microsecs() - lastRcvTime) < 3 * 1000000;
+}
+
+void restartSerial() { }
+
+#ifdef DUAL_CORE
+	void updateIDEConnection() { } // the pseudoterminal has no connection state
+#endif
+
+// Code File
+
+static const char *codeFileName = "ublockscode";
+static FILE *codeFile = NULL;
+
+void setCodeFileName(const char *fileName) {
+	codeFileName = fileName;
+}
+
+static void closeAndOpenCodeFile() {
+	if (codeFile) fclose(codeFile);
+	codeFile = fopen(codeFileName, "a+");
+}
+
+int initCodeFile(uint8 *flash, int flashByteCount) {
+	// Read the code file into the RAM code store and return the number of bytes read.
+
+	codeFile = fopen(codeFileName, "r");
+	if (!codeFile) clearCodeFile(0);
+	int bytesRead = fread(flash, 1, flashByteCount, codeFile);
+	closeAndOpenCodeFile();
+	return bytesRead;
+}
+
+void writeCodeFile(uint8 *code, int byteCount) {
+	if (codeFile) fwrite(code, 1, byteCount, codeFile);
+	closeAndOpenCodeFile();
+}
+
+void writeCodeFileWord(int word) {
+	if (codeFile) fwrite(&word, 4, 1, codeFile);
+}
+
+void clearCodeFile(int cycleCount) {
+	if (codeFile) fclose(codeFile);
+	codeFile = fopen(codeFileName, "w"); // truncate file to zero length
+	int headerWord = ('S' << 24) | cycleCount; // Header record, version 1
+	writeCodeFileWord(headerWord);
+	closeAndOpenCodeFile();
+}
+
+void initFileSystem() { }
+void processFileMessage(int msgType, int dataSize, char *data) { }
+
+// Hardware Stubs
+
+int useTFT = false;
+char BLE_ThreeLetterID[4] = "LNX";
+
+const char *boardType() { return "Linux"; }
+void hardwareInit() { }
+
+void turnOffPins() { }
+void updateMicrobitDisplay() { }
+void resetRadio() { }
+void stopPWM() { }
+void stopServos() { }
+void stopTone() { }
+void turnOffInternalNeoPixels() { }
+void BLE_setEnabled(int enableFlag) { }
+int BLE_isEnabled() { return false; }
+
+OBJ primAnalogPins(OBJ *args) { return zeroObj; }
+OBJ primDigitalPins(OBJ *args) { return zeroObj; }
+OBJ primAnalogRead(int argCount, OBJ *args) { return zeroObj; }
+void primAnalogWrite(OBJ *args) { }
+#ifndef BENCHMARK // bench.c simulates digital pins and buttons
+OBJ primDigitalRead(int argCount, OBJ *args) { return falseObj; }
+void primDigitalWrite(OBJ *args) { }
+int readWatchedPin(int pinNum) { return 0; }
+OBJ primButtonA(OBJ *args) { return falseObj; }
+OBJ primButtonB(OBJ *args) { return falseObj; }
+#endif
+void primDigitalSet(int pinNum, int flag) { }
+void primSetUserLED(OBJ *args) { }
+OBJ primI2cGet(OBJ *args) { return zeroObj; }
+OBJ primI2cSet(OBJ *args) { return falseObj; }
+OBJ primSPISend(OBJ *args) { return falseObj; }
+OBJ primSPIRecv(OBJ *args) { return zeroObj; }
+OBJ primMBDisplayOff(int argCount, OBJ *args) { return falseObj; }
+int serialInputArrived() { return false; }
+
+// Primitive Sets
+
+// Hardware primitive sets are empty on Linux. They are registered so that
+// primitive lookups by set name work.
+
+void addIOPrims() { addPrimitiveSet(IOPrims, "io", 0, NULL); }
+void addSensorPrims() { addPrimitiveSet(SensorPrims, "sensors", 0, NULL); }
+void addSerialPrims() { addPrimitiveSet(SerialPrims, "serial", 0, NULL); }
+void addDisplayPrims() { addPrimitiveSet(DisplayPrims, "display", 0, NULL); }
+void addFilePrims() { addPrimitiveSet(FilePrims, "file", 0, NULL); }
+void addNetPrims() { addPrimitiveSet(NetPrims, "net", 0, NULL); }
+void addBLEPrims() { addPrimitiveSet(BLEPrims, "ble", 0, NULL); }
+void addRadioPrims() { addPrimitiveSet(RadioPrims, "radio", 0, NULL); }
+void addTFTPrims() { addPrimitiveSet(TFTPrims, "tft", 0, NULL); }
+void addHIDPrims() { addPrimitiveSet(HIDPrims, "hid", 0, NULL); }
+void addCameraPrims() { addPrimitiveSet(CameraPrims, "camera", 0, NULL); }
+void addOneWirePrims() { addPrimitiveSet(OneWirePrims, "1wire", 0, NULL); }
+void addEncoderPrims() { addPrimitiveSet(EncoderPrims, "encoder", 0, NULL); }
+
+// Main
+
+#ifndef BENCHMARK
+
+int main(int argc, char *argv[]) {
+	if (argc > 1) setCodeFileName(argv[1]);
+	openPseudoTerminal();
+
+	memInit();
+	primsInit();
+	hardwareInit();
+	#ifdef DUAL_CORE
+		startIOCore();
+	#endif
+	outputString("Welcome to MicroBlocks!");
+	restoreScripts();
+	startAll();
+	while (true) vmLoop();
+	return 0;
+}
+
+#endif
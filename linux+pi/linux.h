@@ -0,0 +1,22 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Copyright 2018 John Maloney, Bernat Romagosa, and Jens Mönig
+
+// linux.h - Linux host platform
+// Builds with -DGNUBLOCKS -m32 (the VM requires 32-bit pointers).
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Host Platform Operations
+
+void openPseudoTerminal(void);
+void closePseudoTerminal(void);
+void setCodeFileName(const char *fileName);
+
+#ifdef __cplusplus
+}
+#endif
@@ -19,6 +19,7 @@
 
 static int stringSize(OBJ obj) {
 	int wordCount = objWords(obj);
+	while (wordCount && !FIELD(obj, wordCount - 1)) wordCount--; // skip spare capacity
 	if (!wordCount) return 0; // empty string
 	char *s = (char *) &FIELD(obj, 0);
 	int byteCount = 4 * (wordCount - 1);
@@ -30,6 +31,26 @@ static int stringSize(OBJ obj) {
 	return byteCount;
 }
 
+static inline char * stringChars(OBJ s) {
+	// Return the characters of a string. An empty string may have no words.
+
+	return objWords(s) ? (char *) &FIELD(s, 0) : (char *) "";
+}
+
+static uint8 * bytesOf(OBJ obj, int *byteCount) {
+	// Return the address of the bytes of a byte array or slice and set *byteCount.
+	// Return NULL if obj is neither.
+
+	if (IS_TYPE(obj, ByteArrayType)) {
+		*byteCount = BYTES(obj);
+		return (uint8 *) &FIELD(obj, 0);
+	} else if (IS_TYPE(obj, SliceType)) {
+		*byteCount = SLICE_COUNT(obj);
+		return SLICE_BYTES(obj);
+	}
+	return NULL;
+}
+
 static void printIntegerOrBooleanInto(OBJ obj, char *buf) {
 	// Helper for primJoin. Write a representation of obj into the given string.
 	// Assume buf has space for at least 20 characters.
@@ -141,11 +162,16 @@ OBJ primFillList(int argCount, OBJ *args) {
 	if (IS_TYPE(obj, ListType)) {
 		int count = obj2int(FIELD(obj, 0));
 		if (count >= WORDS(obj))count = WORDS(obj) - 1;
-		for (int i = 0; i < count; i++) FIELD(obj, i + 1) = value;
+		GC_STORE_BARRIER(obj, value);
+		for (int i = 0; i < count; i++) {
+			GC_WRITE_BARRIER(FIELD(obj, i + 1));
+			FIELD(obj, i + 1) = value;
+		}
 	} else if (IS_TYPE(obj, ByteArrayType)) {
 		if (!isInt(value)) return fail(byteArrayStoreError);
 		int byteValue = obj2int(value);
 		if ((byteValue < 0) || (byteValue > 255)) return fail(byteArrayStoreError);
+		if (!UNSHARE_BYTES(obj)) return falseObj; // allocation failed
 		uint8 *dst = (uint8 *) &FIELD(obj, 0);
 		uint8 *end = dst + (4 * WORDS(obj));
 		while (dst < end) *dst++ = byteValue;
@@ -166,6 +192,8 @@ OBJ primAt(int argCount, OBJ *args) {
 		count = stringSize(obj);
 	} else if (IS_TYPE(obj, ByteArrayType)) {
 		count = BYTES(obj);
+	} else if (IS_TYPE(obj, SliceType)) {
+		count = SLICE_COUNT(obj);
 	}
 
 	OBJ arg0 = args[0];
@@ -193,20 +221,27 @@ OBJ primAt(int argCount, OBJ *args) {
 			if (!*start) return fail(indexOutOfRangeError); // end of string
 			start = nextUTF8(start);
 		}
-		int byteCount = nextUTF8(start) - start;
-		OBJ result = newString(byteCount);
-		if (result) {
-			memcpy(obj2str(result), start, byteCount);
-		}
-		return result;
+		return internString(start, nextUTF8(start) - start);
 	} else if (IS_TYPE(obj, ByteArrayType)) {
 		uint8 *bytes = (uint8 *) &FIELD(obj, 0);
 		return int2obj(bytes[i - 1]);
+	} else if (IS_TYPE(obj, SliceType)) {
+		return int2obj(SLICE_BYTES(obj)[i - 1]);
 	}
 	return fail(needsListError);
 }
 
 OBJ primAtPut(int argCount, OBJ *args) {
+	#ifdef BYTE_SLICES
+		if (IS_TYPE(args[1], SliceType)) { // modify the slice's own copy of its bytes
+			OBJ bytes = sliceOwnBytes(args[1]);
+			if (!bytes) return bytes; // allocation failed
+			args[1] = bytes;
+		} else if (IS_TYPE(args[1], ByteArrayType)) {
+			if (!unshareBytes(&args[1])) return falseObj; // allocation failed
+		}
+	#endif
+
 	OBJ obj = args[1];
 	OBJ value = args[2];
 	int count, i;
@@ -226,7 +261,9 @@ OBJ primAtPut(int argCount, OBJ *args) {
 
 	if (matches("all", args[0])) {
 		if (IS_TYPE(obj, ListType)) {
+			GC_STORE_BARRIER(obj, value);
 			for (i = 1; i <= count; i++) {
+				GC_WRITE_BARRIER(FIELD(obj, i));
 				FIELD(obj, i) = value;
 			}
 		} else if (IS_TYPE(obj, ByteArrayType)) {
@@ -252,6 +289,8 @@ OBJ primAtPut(int argCount, OBJ *args) {
 	}
 
 	if (IS_TYPE(obj, ListType)) {
+		GC_WRITE_BARRIER(FIELD(obj, i));
+		GC_STORE_BARRIER(obj, value);
 		FIELD(obj, i) = value;
 	} else if (IS_TYPE(obj, ByteArrayType)) {
 		((uint8 *) &FIELD(obj, 0))[i - 1] = byteValue;
@@ -266,6 +305,8 @@ OBJ primLength(int argCount, OBJ *args) {
 		return FIELD(obj, 0); // actual count stored in first field
 	} else if (IS_TYPE(obj, ByteArrayType)) {
 		return int2obj(BYTES(obj));
+	} else if (IS_TYPE(obj, SliceType)) {
+		return int2obj(SLICE_COUNT(obj));
 	} else if (IS_TYPE(obj, StringType)) {
 		return int2obj(countUTF8(obj2str(obj)));
 	}
@@ -318,14 +359,17 @@ OBJ primListAddLast(int argCount, OBJ *args) {
 
 	int count = obj2int(FIELD(list, 0));
 	if (count >= (WORDS(list) - 1)) { // no more capacity; try to grow
-		int growBy = count / 3;
-		if (growBy < 4) growBy = 3;
-		if (growBy > 100) growBy = 100;
+		// Grow by half so that a list of N items is moved only O(log N) times,
+		// but do not take more than half of the remaining free memory.
+		int growBy = count / 2;
+		if (growBy > (wordsFree() / 2)) growBy = wordsFree() / 2;
+		if (growBy < 3) growBy = 3;
 
 		list = resizeObj(list, WORDS(list) + growBy);
 	}
 	if (count < (WORDS(list) - 1)) { // append item if there's room
 		count++;
+		GC_STORE_BARRIER(list, args[0]);
 		FIELD(list, count) = args[0];
 		FIELD(list, 0) = int2obj(count);
 	}
@@ -346,10 +390,14 @@ OBJ primListDelete(int argCount, OBJ *args) {
 		i = obj2int(args[0]);
 		if ((i < 1) || (i > count)) return fail(indexOutOfRangeError);
 	} else if (matches("all", args[0])) {
-		for (int i = 0; i <= count; i++) FIELD(list, i) = zeroObj;
+		for (int i = 0; i <= count; i++) {
+			GC_WRITE_BARRIER(FIELD(list, i));
+			FIELD(list, i) = zeroObj;
+		}
 		return falseObj;
 	} else if (matches("last", args[0])) {
 		if (count) {
+			GC_WRITE_BARRIER(FIELD(list, count));
 			FIELD(list, count) = zeroObj;
 			FIELD(list, 0) = int2obj(count - 1);
 		}
@@ -362,6 +410,7 @@ OBJ primListDelete(int argCount, OBJ *args) {
 		return fail(needsIntegerIndexError);
 	}
 
+	GC_WRITE_BARRIER(FIELD(list, i)); // the deleted item
 	while (i < count) {
 		FIELD(list, i) = FIELD(list, i + 1);
 		i++;
@@ -415,17 +464,26 @@ OBJ primCopyFromTo(int argCount, OBJ *args) {
 			memcpy(obj2str(result), obj2str(args[0]) + startOffset, byteCount);
 		}
 		return result;
-	} else if (IS_TYPE(src, ByteArrayType)) {
-		int srcLen = BYTES(src);
+	} else if (IS_TYPE(src, ByteArrayType) || IS_TYPE(src, SliceType)) {
+		int srcLen;
+		bytesOf(src, &srcLen);
 		int endIndex = (argCount > 2) ? obj2int(args[2]) : srcLen;
 		if (endIndex > srcLen) endIndex = srcLen;
 		if (startIndex > endIndex) return newObj(ByteArrayType, 0, falseObj);
 
-		char *base = (char *) (&FIELD(src, 0));
 		int byteCount = (endIndex - startIndex) + 1;
+		#ifdef BYTE_SLICES
+			if (byteCount >= SLICE_MIN_BYTES) { // return a slice that shares the bytes of src
+				if (IS_TYPE(src, SliceType)) {
+					return newSlice(SLICE_PARENT(src), SLICE_START(src) + startIndex - 1, byteCount);
+				}
+				return newSlice(src, startIndex - 1, byteCount);
+			}
+		#endif
 		int wordCount = (byteCount + 3) / 4;
 		OBJ result = newObj(ByteArrayType, wordCount, falseObj);
 		if (result) {
+			uint8 *base = bytesOf(args[0], &srcLen); // update after possible GC
 			setByteCountAdjust(result, byteCount);
 			memcpy(&FIELD(result, 0), base + startIndex - 1, byteCount);
 		}
@@ -434,6 +492,30 @@ OBJ primCopyFromTo(int argCount, OBJ *args) {
 	return fail(needsIndexable);
 }
 
+static void joinStringsInto(char *dst, int argCount, OBJ *args) {
+	// Write the concatenation of the given strings, integers, booleans, and byte arrays
+	// into dst, followed by a null terminator.
+
+	char buf[50];
+	for (int i = 0; i < argCount; i++) {
+		OBJ arg = args[i];
+		int count = 0;
+		if (IS_TYPE(arg, StringType)) {
+			count = stringSize(arg);
+			memcpy(dst, obj2str(arg), count);
+		} else if (isInt(arg) || isBoolean(arg)) {
+			printIntegerOrBooleanInto(arg, buf);
+			count = strlen(buf);
+			memcpy(dst, buf, count);
+		} else {
+			uint8 *bytes = bytesOf(arg, &count);
+			if (bytes) memcpy(dst, bytes, count);
+		}
+		dst += count;
+	}
+	*dst = 0; // null terminator
+}
+
 OBJ primJoin(int argCount, OBJ *args) {
 	if (argCount < 2) return fail(notEnoughArguments);
 	char buf[50];
@@ -457,11 +539,11 @@ OBJ primJoin(int argCount, OBJ *args) {
 			if (count >= WORDS(arg)) count = WORDS(arg) - 1;
 			for (int j = 0; j < count; j++) *dst++ = FIELD(arg, j + 1);
 		}
-	} else if (IS_TYPE(arg1, ByteArrayType)) {
+	} else if (IS_TYPE(arg1, ByteArrayType) || IS_TYPE(arg1, SliceType)) {
 		for (int i = 0; i < argCount; i++) {
 			arg = args[i];
-			if (IS_TYPE(arg, ByteArrayType)) {
-				resultCount += BYTES(arg);
+			if (bytesOf(arg, &count)) {
+				resultCount += count;
 			} else if (IS_TYPE(arg, StringType)) {
 				resultCount += stringSize(arg);
 			} else {
@@ -476,49 +558,77 @@ OBJ primJoin(int argCount, OBJ *args) {
 		char *dst = (char *) &FIELD(result, 0);
 		for (int i = 0; i < argCount; i++) {
 			arg = args[i];
-			int byteCount = IS_TYPE(arg, ByteArrayType) ? BYTES(arg) : stringSize(arg);
-			char *src = (char *) &FIELD(arg, 0);
+			int byteCount;
+			char *src = (char *) bytesOf(arg, &byteCount);
+			if (!src) {
+				byteCount = stringSize(arg);
+				src = obj2str(arg);
+			}
 			for (int j = 0; j < byteCount; j++) *dst++ = src[j];
 		}
 	} else {
+		OBJ onlyString = NULL; // the only non-empty argument, if it is a string
+		int nonEmptyCount = 0;
 		for (int i = 0; i < argCount; i++) {
 			arg = args[i];
 			if (IS_TYPE(arg, StringType)) {
-				resultCount += stringSize(arg);
+				count = stringSize(arg);
+				if (count) onlyString = arg;
 			} else if (isInt(arg) || isBoolean(arg)) {
 				printIntegerOrBooleanInto(arg, buf);
-				resultCount += strlen(buf);
-			} else if (IS_TYPE(arg, ByteArrayType)) {
-				resultCount += BYTES(arg);
-			} else {
+				count = strlen(buf);
+			} else if (!bytesOf(arg, &count)) {
 				return fail(joinArgsNotSameType);
 			}
+			if (count) nonEmptyCount++;
+			resultCount += count;
+		}
+		if ((1 == nonEmptyCount) && onlyString) return onlyString; // strings are immutable
+		if (resultCount <= INTERN_MAX_BYTES) { // join into a buffer and intern the result
+			char joined[INTERN_MAX_BYTES + 1];
+			joinStringsInto(joined, argCount, args);
+			return internString(joined, resultCount);
 		}
 		result = newString(resultCount);
 		if (!result) return result; // allocation failed
-		char *dst = (char *) &FIELD(result, 0);
-		for (int i = 0; i < argCount; i++) {
-			arg = args[i];
-			if (IS_TYPE(arg, StringType)) {
-				count = stringSize(arg);
-				memcpy(dst, obj2str(arg), count);
-				dst += count;
-			} else if (isInt(arg) || isBoolean(arg)) {
-				printIntegerOrBooleanInto(arg, buf);
-				count = strlen(buf);
-				memcpy(dst, buf, count);
-				dst += count;
-			} else if (IS_TYPE(arg, ByteArrayType)) {
-				count = BYTES(arg);
-				memcpy(dst, (char *) &FIELD(arg, 0), count);
-				dst += count;
-			}
+		joinStringsInto((char *) &FIELD(result, 0), argCount, args);
+	}
+	return result;
+}
+
+#ifdef STRING_BUILDERS
+
+OBJ appendToStringBuilder(int argCount, OBJ *args) {
+	// Append the remaining arguments to the string args[0] and return the resulting string
+	// builder. Used by the fused "set s to (join s ...)" instruction (see fuseChunk()).
+	// If this is not a join of strings, integers, booleans, and byte arrays, call primJoin().
+
+	if ((argCount < 2) || !IS_TYPE(args[0], StringType)) return primJoin(argCount, args);
+	char buf[50];
+	int count;
+	int oldCount = stringSize(args[0]);
+	int resultCount = oldCount;
+	for (int i = 1; i < argCount; i++) {
+		OBJ arg = args[i];
+		if (IS_TYPE(arg, StringType)) {
+			resultCount += stringSize(arg);
+		} else if (isInt(arg) || isBoolean(arg)) {
+			printIntegerOrBooleanInto(arg, buf);
+			resultCount += strlen(buf);
+		} else if (bytesOf(arg, &count)) {
+			resultCount += count;
+		} else {
+			return primJoin(argCount, args);
 		}
-		*dst = 0; // null terminator
 	}
+	OBJ result = stringBuilderFor(args[0], resultCount);
+	if (!result) return result; // allocation failed
+	joinStringsInto((char *) &FIELD(result, 0) + oldCount, argCount - 1, &args[1]);
 	return result;
 }
 
+#endif
+
 OBJ primSplit(int argCount, OBJ *args) {
 	if (argCount < 2) return fail(notEnoughArguments);
 	if (!IS_TYPE(args[0], StringType)) return fail(needsStringError);
@@ -554,7 +664,7 @@ OBJ primSplit(int argCount, OBJ *args) {
 		for (int i = 0; i < resultCount; i++) {
 			// allocate string and save in list
 			int byteCount = next - last;
-			OBJ item = newStringFromBytes(last, byteCount);
+			OBJ item = internString(last, byteCount);
 			if (!item) return falseObj; // allocation failed
 			FIELD(tempGCRoot, i + 1) = item;
 			last = next;
@@ -570,14 +680,14 @@ OBJ primSplit(int argCount, OBJ *args) {
 		char *next = strstr(last, delim);
 		while (next && (i <= resultCount)) {
 			int byteCount = next - last;
-			OBJ item = newStringFromBytes(last, byteCount);
+			OBJ item = internString(last, byteCount);
 			if (!item) return falseObj; // allocation failed
 			FIELD(tempGCRoot, i++) = item;
 			last = next + delimLen;
 			next = strstr(last, delim);
 		}
 		if (i <= resultCount) { //
-			OBJ item = newStringFromBytes(last, strlen(last));
+			OBJ item = internString(last, strlen(last));
 			if (!item) return falseObj; // allocation failed
 			FIELD(tempGCRoot, i++) = item;
 		}
@@ -686,15 +796,14 @@ OBJ primFind(int argCount, OBJ *args) {
 			}
 		}
 		return int2obj(-1);
-	} else if (IS_TYPE(arg1, ByteArrayType)) { // search in a ByteArray
-		uint8 *target = (uint8 *) &FIELD(arg1, 0);
-		int targetSize = BYTES(arg1);
+	} else if (IS_TYPE(arg1, ByteArrayType) || IS_TYPE(arg1, SliceType)) { // search in a ByteArray
+		int targetSize;
+		uint8 *target = bytesOf(arg1, &targetSize);
 		if (startOffset > targetSize) return int2obj(-1); // not found
 		uint8 *sought;
 		int soughtSize = 0;
-		if (IS_TYPE(arg0, ByteArrayType)) {
-			sought = (uint8 *) &FIELD(arg0, 0);
-			soughtSize = BYTES(arg0);
+		if (IS_TYPE(arg0, ByteArrayType) || IS_TYPE(arg0, SliceType)) {
+			sought = bytesOf(arg0, &soughtSize);
 		} else if (IS_TYPE(arg0, StringType)) {
 			sought = (uint8 *) obj2str(arg0);
 			soughtSize = stringSize(arg0);
@@ -754,7 +863,7 @@ OBJ primUnicodeString(int argCount, OBJ *args) {
 		uint8 buf[8]; // buffer for one UTF-8 character
 		uint8 *s = appendUTF8(buf, evalInt(arg));
 		int byteCount = s - buf;
-		return newStringFromBytes((char *) buf, byteCount);
+		return internString((char *) buf, byteCount);
 	} else if (IS_TYPE(arg, ListType)) { // convert list of integers to a Unicode string
 		int listCount = obj2int(FIELD(arg, 0));
 		int utfByteCount = 0;
@@ -845,6 +954,508 @@ OBJ primFreeMemory(int argCount, OBJ *args) {
 	return int2obj(wordsFree());
 }
 
+OBJ primSetGCMaxPause(int argCount, OBJ *args) {
+	// Set the maximum pause of the incremental garbage collector in usecs.
+	// Zero disables incremental collection.
+
+	if ((argCount < 1) || !isInt(args[0])) return fail(needsIntegerError);
+	#ifdef INCREMENTAL_GC
+		int usecs = obj2int(args[0]);
+		gcMaxPauseUSecs = (usecs < 0) ? 0 : usecs;
+	#endif
+	return falseObj;
+}
+
+OBJ primGCPauseHistogram(int argCount, OBJ *args) {
+	// Return a list of garbage collection pause counts. Item i counts pauses under
+	// 2^(i + 5) usecs; the last item counts all longer pauses.
+
+	OBJ result = newObj(ListType, GC_PAUSE_BUCKETS + 1, zeroObj);
+	if (!result) return result;
+	FIELD(result, 0) = int2obj(GC_PAUSE_BUCKETS);
+	for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+		FIELD(result, i + 1) = int2obj(gcPauseHistogram[i]);
+	}
+	return result;
+}
+
+OBJ primClearGCStats(int argCount, OBJ *args) {
+	clearGCStats();
+	return falseObj;
+}
+
+OBJ primHeapCensus(int argCount, OBJ *args) {
+	// Return a list with a [count words] list for each object type. Item i is for type i - 1;
+	// the first item is for free chunks. Words include the header and forwarding words.
+
+	HeapCensus census;
+	heapCensus(&census);
+
+	// allocate result list (stored in tempGCRoot so it will be processed by garbage collector
+	// if a GC happens during a later allocation)
+	tempGCRoot = newObj(ListType, CENSUS_TYPES + 1, zeroObj);
+	if (!tempGCRoot) return tempGCRoot; // allocation failed
+	FIELD(tempGCRoot, 0) = int2obj(CENSUS_TYPES);
+	for (int i = 0; i < CENSUS_TYPES; i++) {
+		OBJ pair = newObj(ListType, 3, zeroObj);
+		if (!pair) return falseObj; // allocation failed
+		FIELD(pair, 0) = int2obj(2);
+		FIELD(pair, 1) = int2obj(census.count[i]);
+		FIELD(pair, 2) = int2obj(census.words[i]);
+		FIELD(tempGCRoot, i + 1) = pair;
+	}
+	return tempGCRoot;
+}
+
+OBJ primSetObjectStoreSize(int argCount, OBJ *args) {
+	// Set the object store size in kilobytes and whether to allocate it in PSRAM.
+	// Takes effect when the board is restarted. Zero restores the default size.
+
+	if ((argCount < 1) || !isInt(args[0])) return fail(needsIntegerError);
+	int usePSRAM = (argCount > 1) && (trueObj == args[1]);
+	if (!setObjectStoreConfig(obj2int(args[0]), usePSRAM)) return fail(primitiveNotImplemented);
+	return falseObj;
+}
+
+OBJ primObjectStoreInfo(int argCount, OBJ *args) {
+	// Return a list with the object store size in bytes and whether it is in PSRAM.
+
+	OBJ result = newObj(ListType, 3, zeroObj);
+	if (!result) return result;
+	FIELD(result, 0) = int2obj(2);
+	FIELD(result, 1) = int2obj(objectStoreBytes());
+	FIELD(result, 2) = objectStoreInPSRAM() ? trueObj : falseObj;
+	return result;
+}
+
+// Sorting and Searching
+// Lists of integers are sorted with introsort (quicksort that switches to heapsort if it
+// recurses too deeply), lists of strings with a stable merge sort, and byte arrays with a
+// counting sort. Integer objects compare in the same order as their values, so integer items
+// are compared without decoding them.
+
+#define SMALL_SORT 16 // ranges up to this size are insertion sorted
+
+static int compareStrings(OBJ s1, OBJ s2) {
+	return strcmp(stringChars(s1), stringChars(s2));
+}
+
+static void insertionSortInts(OBJ *items, int n) {
+	for (int i = 1; i < n; i++) {
+		OBJ item = items[i];
+		int j = i - 1;
+		while ((j >= 0) && ((int) items[j] > (int) item)) { items[j + 1] = items[j]; j--; }
+		items[j + 1] = item;
+	}
+}
+
+static void siftDown(OBJ *items, int i, int n) {
+	OBJ item = items[i];
+	while (true) {
+		int child = (2 * i) + 1;
+		if (child >= n) break;
+		if (((child + 1) < n) && ((int) items[child + 1] > (int) items[child])) child++;
+		if ((int) items[child] <= (int) item) break;
+		items[i] = items[child];
+		i = child;
+	}
+	items[i] = item;
+}
+
+static void heapSortInts(OBJ *items, int n) {
+	for (int i = (n / 2) - 1; i >= 0; i--) siftDown(items, i, n);
+	for (int i = n - 1; i > 0; i--) {
+		OBJ tmp = items[0]; items[0] = items[i]; items[i] = tmp;
+		siftDown(items, 0, i);
+	}
+}
+
+static void introSortInts(OBJ *items, int n, int depthLimit) {
+	while (n > SMALL_SORT) {
+		if (depthLimit-- <= 0) {
+			heapSortInts(items, n);
+			return;
+		}
+		// move the median of the first, middle, and last items to items[0]
+		OBJ tmp;
+		int a = (int) items[0], b = (int) items[n / 2], c = (int) items[n - 1];
+		int mid = (a < b) ? ((b < c) ? n / 2 : ((a < c) ? n - 1 : 0)) : ((a < c) ? 0 : ((b < c) ? n - 1 : n / 2));
+		tmp = items[0]; items[0] = items[mid]; items[mid] = tmp;
+
+		// Hoare partition around items[0]; afterwards items[0..j] <= pivot <= items[j+1..n-1]
+		int pivot = (int) items[0];
+		int i = -1, j = n;
+		while (true) {
+			do { i++; } while ((int) items[i] < pivot);
+			do { j--; } while ((int) items[j] > pivot);
+			if (i >= j) break;
+			tmp = items[i]; items[i] = items[j]; items[j] = tmp;
+		}
+		// recurse on the smaller part and loop on the larger one to limit stack depth
+		int leftCount = j + 1;
+		if (leftCount < (n - leftCount)) {
+			introSortInts(items, leftCount, depthLimit);
+			items += leftCount;
+			n -= leftCount;
+		} else {
+			introSortInts(items + leftCount, n - leftCount, depthLimit);
+			n = leftCount;
+		}
+	}
+	insertionSortInts(items, n);
+}
+
+static void mergeSortStrings(OBJ *items, OBJ *tmp, int n) {
+	// Stable sort. tmp must have room for (n + 1) / 2 items.
+
+	if (n <= SMALL_SORT) {
+		for (int i = 1; i < n; i++) {
+			OBJ item = items[i];
+			int j = i - 1;
+			while ((j >= 0) && (compareStrings(items[j], item) > 0)) { items[j + 1] = items[j]; j--; }
+			items[j + 1] = item;
+		}
+		return;
+	}
+	int half = (n + 1) / 2;
+	mergeSortStrings(items, tmp, half);
+	mergeSortStrings(items + half, tmp, n - half);
+	if (compareStrings(items[half - 1], items[half]) <= 0) return; // already in order
+
+	memcpy(tmp, items, half * sizeof(OBJ));
+	OBJ *left = tmp, *leftEnd = tmp + half;
+	OBJ *right = items + half, *rightEnd = items + n;
+	OBJ *dst = items;
+	while ((left < leftEnd) && (right < rightEnd)) {
+		*dst++ = (compareStrings(*right, *left) < 0) ? *right++ : *left++;
+	}
+	while (left < leftEnd) *dst++ = *left++; // the rest of right is already in place
+}
+
+OBJ primSort(int argCount, OBJ *args) {
+	// Sort a list of integers, a list of strings, or a byte array in place in ascending order.
+
+	if (argCount < 1) return fail(notEnoughArguments);
+	OBJ obj = args[0];
+	if (IS_TYPE(obj, ByteArrayType)) {
+		if (!UNSHARE_BYTES(obj)) return falseObj; // allocation failed
+		int counts[256];
+		memset(counts, 0, sizeof(counts));
+		uint8 *bytes = (uint8 *) &FIELD(obj, 0);
+		int byteCount = BYTES(obj);
+		for (int i = 0; i < byteCount; i++) counts[bytes[i]]++;
+		uint8 *dst = bytes;
+		for (int b = 0; b < 256; b++) {
+			for (int n = counts[b]; n > 0; n--) *dst++ = b;
+		}
+		return falseObj;
+	}
+	if (!IS_TYPE(obj, ListType)) return fail(needsListError);
+
+	int count = obj2int(FIELD(obj, 0));
+	if (count < 2) return falseObj;
+	int allInts = true, allStrings = true;
+	for (int i = 1; i <= count; i++) {
+		OBJ item = FIELD(obj, i);
+		if (!isInt(item)) allInts = false;
+		if (!IS_TYPE(item, StringType)) allStrings = false;
+	}
+	if (!allInts && !allStrings) return fail(nonComparableError);
+
+	if (allInts) {
+		int depthLimit = 0;
+		for (int n = count; n > 1; n >>= 1) depthLimit += 2; // 2 * log2(count)
+		introSortInts(&FIELD(obj, 1), count, depthLimit);
+		return falseObj;
+	}
+
+	// Sorting moves items between fields, so shade them all in case the incremental
+	// garbage collector has already scanned some of this list's fields but not others.
+	for (int i = 1; i <= count; i++) GC_WRITE_BARRIER(FIELD(obj, i));
+
+	int tmpCount = (count + 1) / 2;
+	OBJ buf[64];
+	OBJ *tmp = buf;
+	if (tmpCount > 64) {
+		OBJ tmpObj = newObj(ArrayType, tmpCount, zeroObj);
+		if (!tmpObj) return fail(insufficientMemoryError);
+		obj = args[0]; // may have moved
+		tmp = &FIELD(tmpObj, 0);
+	}
+	mergeSortStrings(&FIELD(obj, 1), tmp, count);
+	return falseObj;
+}
+
+OBJ primBinarySearch(int argCount, OBJ *args) {
+	// Return the index of the given integer or string in a sorted list or of the given byte
+	// value in a sorted byte array, or -1 if it is not found. If the item occurs more than
+	// once, the index of any one of those occurrences may be returned.
+
+	if (argCount < 2) return fail(notEnoughArguments);
+	OBJ sought = args[0];
+	OBJ target = args[1];
+	int lo = 0, hi = -1;
+
+	int byteCount;
+	uint8 *bytes = bytesOf(target, &byteCount);
+	if (bytes) {
+		if (!isInt(sought)) return int2obj(-1);
+		int value = obj2int(sought);
+		hi = byteCount - 1;
+		while (lo <= hi) {
+			int mid = (lo + hi) / 2;
+			if (bytes[mid] < value) lo = mid + 1;
+			else if (bytes[mid] > value) hi = mid - 1;
+			else return int2obj(mid + 1);
+		}
+		return int2obj(-1);
+	}
+	if (!IS_TYPE(target, ListType)) return fail(needsListError);
+	if (!isInt(sought) && !IS_TYPE(sought, StringType)) return fail(nonComparableError);
+
+	OBJ *items = &FIELD(target, 1);
+	hi = obj2int(FIELD(target, 0)) - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		OBJ item = items[mid];
+		int order;
+		if (isInt(sought)) {
+			if (!isInt(item)) return fail(nonComparableError);
+			order = ((int) item < (int) sought) ? -1 : (((int) item > (int) sought) ? 1 : 0);
+		} else {
+			if (!IS_TYPE(item, StringType)) return fail(nonComparableError);
+			order = compareStrings(item, sought);
+		}
+		if (order < 0) lo = mid + 1;
+		else if (order > 0) hi = mid - 1;
+		else return int2obj(mid + 1);
+	}
+	return int2obj(-1);
+}
+
+OBJ primReverse(int argCount, OBJ *args) {
+	// Reverse the items of a list or the bytes of a byte array in place.
+
+	if (argCount < 1) return fail(notEnoughArguments);
+	OBJ obj = args[0];
+	if (IS_TYPE(obj, ByteArrayType)) {
+		if (!UNSHARE_BYTES(obj)) return falseObj; // allocation failed
+		uint8 *bytes = (uint8 *) &FIELD(obj, 0);
+		for (int i = 0, j = BYTES(obj) - 1; i < j; i++, j--) {
+			uint8 tmp = bytes[i]; bytes[i] = bytes[j]; bytes[j] = tmp;
+		}
+	} else if (IS_TYPE(obj, ListType)) {
+		int count = obj2int(FIELD(obj, 0));
+		for (int i = 1; i <= count; i++) GC_WRITE_BARRIER(FIELD(obj, i)); // see primSort()
+		for (int i = 1, j = count; i < j; i++, j--) {
+			OBJ tmp = FIELD(obj, i); FIELD(obj, i) = FIELD(obj, j); FIELD(obj, j) = tmp;
+		}
+	} else {
+		return fail(needsListError);
+	}
+	return falseObj;
+}
+
+// Dictionaries
+// A dictionary has three fields: its entry count, the number of used slots (entries plus
+// deleted entries), and a table of key/value slot pairs. The table is open addressed with
+// linear probing; its slot count is a power of two and at most three quarters of the slots
+// are used, so a probe always ends at an empty slot. Keys are hashed by value (integers) or
+// contents (strings), not by address, so objects moved by the garbage collector need no rehash.
+
+#define DICT_MIN_SLOTS 8
+#define DICT_COUNT(dict) FIELD(dict, 0)
+#define DICT_USED(dict) FIELD(dict, 1)
+#define DICT_TABLE(dict) FIELD(dict, 2)
+#define EMPTY_KEY falseObj
+#define DELETED_KEY trueObj
+
+static inline int isDictKey(OBJ key) {
+	return isInt(key) || IS_TYPE(key, StringType);
+}
+
+static uint32 dictHash(OBJ key) {
+	if (isInt(key)) {
+		// Knuth's multiplicative hash puts the well-mixed bits at the top, but slots are
+		// chosen by masking the low bits, so fold the high half into the low half
+		uint32 hash = (uint32) key * 2654435761U;
+		return hash ^ (hash >> 16);
+	}
+	uint32 hash = 2166136261U; // FNV-1a
+	for (uint8 *s = (uint8 *) stringChars(key); *s; s++) hash = (hash ^ *s) * 16777619U;
+	return hash;
+}
+
+static int dictSlotOf(OBJ table, OBJ key) {
+	// Return the slot index of the given key or, if it is absent, the negative of one plus
+	// the index of the slot where it would be added.
+
+	int mask = (WORDS(table) / 2) - 1;
+	int isString = !isInt(key);
+	int addIndex = -1;
+	for (int i = dictHash(key) & mask; ; i = (i + 1) & mask) {
+		OBJ k = FIELD(table, 2 * i);
+		if (EMPTY_KEY == k) return -1 - ((addIndex >= 0) ? addIndex : i);
+		if (DELETED_KEY == k) {
+			if (addIndex < 0) addIndex = i;
+		} else if ((k == key) ||
+			(isString && IS_TYPE(k, StringType) && (0 == strcmp(stringChars(k), stringChars(key))))) {
+				return i;
+		}
+	}
+}
+
+static int dictSlotsFor(int count) {
+	// Return the number of slots for a dictionary of count entries.
+
+	int slots = DICT_MIN_SLOTS;
+	while ((4 * count) >= (3 * slots)) slots *= 2;
+	return slots;
+}
+
+static int dictRehash(OBJ *dictPtr, int slotCount) {
+	// Move the entries of the dictionary at *dictPtr (a GC root) to a new table with the
+	// given number of slots, dropping deleted entries. Return false if memory is full.
+
+	OBJ newTable = newObj(ArrayType, 2 * slotCount, EMPTY_KEY);
+	if (!newTable) return false;
+
+	OBJ dict = *dictPtr; // may have moved
+	OBJ oldTable = DICT_TABLE(dict);
+	int oldSlots = WORDS(oldTable) / 2;
+	for (int i = 0; i < oldSlots; i++) {
+		OBJ key = FIELD(oldTable, 2 * i);
+		if ((EMPTY_KEY == key) || (DELETED_KEY == key)) continue;
+		OBJ value = FIELD(oldTable, (2 * i) + 1);
+		int j = -1 - dictSlotOf(newTable, key);
+		GC_STORE_BARRIER(newTable, key);
+		GC_STORE_BARRIER(newTable, value);
+		FIELD(newTable, 2 * j) = key;
+		FIELD(newTable, (2 * j) + 1) = value;
+	}
+	GC_WRITE_BARRIER(oldTable);
+	GC_STORE_BARRIER(dict, newTable);
+	DICT_TABLE(dict) = newTable;
+	DICT_USED(dict) = DICT_COUNT(dict);
+	return true;
+}
+
+OBJ primNewDictionary(int argCount, OBJ *args) {
+	// Return a new, empty dictionary. Optional argument is the expected number of entries.
+
+	int count = ((argCount > 0) && isInt(args[0])) ? obj2int(args[0]) : 0;
+	if ((count < 0) || (count > 0x100000)) count = 0;
+	OBJ table = newObj(ArrayType, 2 * dictSlotsFor(count), EMPTY_KEY);
+	if (!table) return fail(insufficientMemoryError);
+	tempGCRoot = table;
+	OBJ dict = newObj(DictionaryType, 3, zeroObj);
+	table = tempGCRoot;
+	tempGCRoot = NULL;
+	if (!dict) return fail(insufficientMemoryError);
+	GC_STORE_BARRIER(dict, table);
+	DICT_TABLE(dict) = table;
+	return dict;
+}
+
+OBJ primDictionaryAt(int argCount, OBJ *args) {
+	// Return the value for the given key or, if the key is absent, the optional default
+	// value (false if not supplied).
+
+	if (argCount < 2) return fail(notEnoughArguments);
+	OBJ dict = args[0];
+	OBJ key = args[1];
+	if (!IS_TYPE(dict, DictionaryType)) return fail(needsDictionary);
+	if (!isDictKey(key)) return fail(badDictionaryKey);
+
+	OBJ table = DICT_TABLE(dict);
+	int i = dictSlotOf(table, key);
+	if (i >= 0) return FIELD(table, (2 * i) + 1);
+	return (argCount > 2) ? args[2] : falseObj;
+}
+
+OBJ primDictionaryAtPut(int argCount, OBJ *args) {
+	// Set the value for the given key, adding an entry if the key is absent.
+
+	if (argCount < 3) return fail(notEnoughArguments);
+	if (!IS_TYPE(args[0], DictionaryType)) return fail(needsDictionary);
+	if (!isDictKey(args[1])) return fail(badDictionaryKey);
+
+	OBJ dict = args[0];
+	int i = dictSlotOf(DICT_TABLE(dict), args[1]);
+	if (i < 0) { // new key
+		int count = obj2int(DICT_COUNT(dict));
+		int slots = WORDS(DICT_TABLE(dict)) / 2;
+		if ((4 * (obj2int(DICT_USED(dict)) + 1)) > (3 * slots)) { // table is full
+			if (!dictRehash(&args[0], dictSlotsFor(count + 1))) return fail(insufficientMemoryError);
+			dict = args[0];
+			i = dictSlotOf(DICT_TABLE(dict), args[1]);
+		}
+		i = -1 - i;
+		OBJ table = DICT_TABLE(dict);
+		if (EMPTY_KEY == FIELD(table, 2 * i)) DICT_USED(dict) = int2obj(obj2int(DICT_USED(dict)) + 1);
+		DICT_COUNT(dict) = int2obj(count + 1);
+		GC_STORE_BARRIER(table, args[1]);
+		FIELD(table, 2 * i) = args[1];
+	}
+	OBJ table = DICT_TABLE(dict);
+	GC_WRITE_BARRIER(FIELD(table, (2 * i) + 1));
+	GC_STORE_BARRIER(table, args[2]);
+	FIELD(table, (2 * i) + 1) = args[2];
+	return falseObj;
+}
+
+OBJ primDictionaryRemove(int argCount, OBJ *args) {
+	// Remove the given key and its value. Return true if the key was present.
+
+	if (argCount < 2) return fail(notEnoughArguments);
+	OBJ dict = args[0];
+	if (!IS_TYPE(dict, DictionaryType)) return fail(needsDictionary);
+	if (!isDictKey(args[1])) return fail(badDictionaryKey);
+
+	OBJ table = DICT_TABLE(dict);
+	int i = dictSlotOf(table, args[1]);
+	if (i < 0) return falseObj;
+	GC_WRITE_BARRIER(FIELD(table, 2 * i));
+	GC_WRITE_BARRIER(FIELD(table, (2 * i) + 1));
+	FIELD(table, 2 * i) = DELETED_KEY;
+	FIELD(table, (2 * i) + 1) = falseObj;
+	DICT_COUNT(dict) = int2obj(obj2int(DICT_COUNT(dict)) - 1);
+	return trueObj;
+}
+
+OBJ primDictionaryHasKey(int argCount, OBJ *args) {
+	if (argCount < 2) return fail(notEnoughArguments);
+	if (!IS_TYPE(args[0], DictionaryType)) return fail(needsDictionary);
+	if (!isDictKey(args[1])) return falseObj;
+	return (dictSlotOf(DICT_TABLE(args[0]), args[1]) >= 0) ? trueObj : falseObj;
+}
+
+OBJ primDictionarySize(int argCount, OBJ *args) {
+	if ((argCount < 1) || !IS_TYPE(args[0], DictionaryType)) return fail(needsDictionary);
+	return DICT_COUNT(args[0]);
+}
+
+OBJ primDictionaryKeys(int argCount, OBJ *args) {
+	// Return a list of the keys of the given dictionary (in no particular order).
+
+	if ((argCount < 1) || !IS_TYPE(args[0], DictionaryType)) return fail(needsDictionary);
+	int count = obj2int(DICT_COUNT(args[0]));
+	OBJ result = newObj(ListType, count + 1, zeroObj);
+	if (!result) return fail(insufficientMemoryError);
+	FIELD(result, 0) = int2obj(count);
+
+	OBJ table = DICT_TABLE(args[0]); // may have moved
+	int slots = WORDS(table) / 2;
+	int n = 1;
+	for (int i = 0; i < slots; i++) {
+		OBJ key = FIELD(table, 2 * i);
+		if ((EMPTY_KEY == key) || (DELETED_KEY == key)) continue;
+		GC_STORE_BARRIER(result, key);
+		FIELD(result, n++) = key;
+	}
+	return result;
+}
+
 // Helper functions for convert primitive
 
 static OBJ stringToList(OBJ strObj) {
@@ -1032,7 +1643,7 @@ OBJ primConvertType(int argCount, OBJ *args) {
 			result = int2obj((srcObj == trueObj) ? 1 : 0);
 			break;
 		case StringType:
-			result = newStringFromBytes(((srcObj == trueObj) ? "1" : "0"), 1);
+			result = internString(((srcObj == trueObj) ? "1" : "0"), 1);
 			break;
 		case ListType:
 			return singletonList(srcObj);
@@ -1050,7 +1661,7 @@ OBJ primConvertType(int argCount, OBJ *args) {
 			break;
 		case StringType:
 			sprintf(s, "%d", obj2int(srcObj));
-			result = newStringFromBytes(s, strlen(s));
+			result = internString(s, strlen(s));
 			break;
 		case ListType:
 			return singletonList(srcObj);
@@ -1132,10 +1743,10 @@ OBJ primToString(int argCount, OBJ *args) {
 
 	switch (objType(srcObj)) {
 	case BooleanType:
-		return newStringFromBytes(((srcObj == trueObj) ? "1" : "0"), 1);
+		return internString(((srcObj == trueObj) ? "1" : "0"), 1);
 	case IntegerType:
 		sprintf(s, "%d", obj2int(srcObj));
-		return newStringFromBytes(s, strlen(s));
+		return internString(s, strlen(s));
 	case StringType:
 		return srcObj;
 	case ListType:
@@ -1146,6 +1757,33 @@ OBJ primToString(int argCount, OBJ *args) {
 	return newString(0);
 }
 
+// Slice Support
+
+#ifdef BYTE_SLICES
+
+void prepareSliceArgs(PrimitiveFunction primFunc, int argCount, OBJ *args) {
+	// Called before a primitive call while slices exist. Primitives that accept slices are
+	// passed their arguments unchanged. For other primitives, replace each slice argument
+	// with a byte array of its own. Byte array arguments are left shared; primitives that
+	// modify them call UNSHARE_BYTES() first.
+
+	if ((primFunc == primAt) || (primFunc == primAtPut) || (primFunc == primLength) ||
+		(primFunc == primCopyFromTo) || (primFunc == primFind) || (primFunc == primJoin) ||
+		(primFunc == primDictionaryAt) || (primFunc == primDictionaryAtPut) ||
+		(primFunc == primBinarySearch)) {
+			return;
+	}
+	for (int i = 0; i < argCount; i++) {
+		OBJ arg = args[i];
+		if (IS_TYPE(arg, SliceType)) {
+			args[i] = sliceOwnBytes(arg);
+			if (failure()) return; // allocation failed
+		}
+	}
+}
+
+#endif
+
 // Primitives
 
 static PrimEntry entries[] = {
@@ -1163,6 +1801,22 @@ static PrimEntry entries[] = {
 	{"newByteArray", primNewByteArray},
 	{"asByteArray", primAsByteArray},
 	{"freeMemory", primFreeMemory},
+	{"setGCMaxPause", primSetGCMaxPause},
+	{"gcPauseHistogram", primGCPauseHistogram},
+	{"clearGCStats", primClearGCStats},
+	{"setObjectStoreSize", primSetObjectStoreSize},
+	{"objectStoreInfo", primObjectStoreInfo},
+	{"heapCensus", primHeapCensus},
+	{"sort", primSort},
+	{"binarySearch", primBinarySearch},
+	{"reverse", primReverse},
+	{"newDictionary", primNewDictionary},
+	{"dictionaryAt", primDictionaryAt},
+	{"dictionaryAtPut", primDictionaryAtPut},
+	{"dictionaryRemove", primDictionaryRemove},
+	{"dictionaryHasKey", primDictionaryHasKey},
+	{"dictionarySize", primDictionarySize},
+	{"dictionaryKeys", primDictionaryKeys},
 	{"convertType", primConvertType},
 	{"toString", primToString},
 };
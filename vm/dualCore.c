@@ -0,0 +1,195 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Copyright 2018 John Maloney, Bernat Romagosa, and Jens Mönig
+
+// dualCore.c - Run IDE communications on a second core
+//
+// When DUAL_CORE is defined, an I/O task on the other core moves bytes between the
+// serial port (or BLE) and a pair of single-producer, single-consumer rings. The VM
+// core reads and writes the rings instead of calling recvBytes() and sendBytes(), so
+// slow serial writes and receive polling no longer take time from running tasks.
+//
+// Only byte transport is offloaded. The I/O task calls the platform recvBytes() and
+// sendBytes() functions and touches nothing but the rings. Everything else stays on the
+// VM core: decoding and processing messages (which modify the object store and code
+// chunks), NeoPixel, TFT and WiFi primitives, and the serial and BLE connection state.
+// The VM core checks the connection state every CONNECTION_CHECK_MSECS and pauses the
+// I/O task with pauseIOCore() while it changes that state, since recvBytes() and
+// sendBytes() depend on it.
+
+#if defined(DUAL_CORE) && defined(ARDUINO_ARCH_ESP32)
+	#include "freertos/FreeRTOS.h"
+	#include "freertos/task.h"
+#elif defined(DUAL_CORE) && defined(GNUBLOCKS)
+	#define _DEFAULT_SOURCE // enable usleep() declaration from unistd.h
+	#include <pthread.h>
+	#include <unistd.h>
+#endif
+
+#include "mem.h"
+#include "interp.h"
+
+#ifdef DUAL_CORE
+
+// Byte Rings
+
+// Each ring has a single producer that writes only head and a single consumer that
+// writes only tail. The release stores publish the data bytes before the index update.
+
+#define RING_SIZE 2048 // must be a power of 2!
+#define RING_MASK (RING_SIZE - 1)
+
+typedef struct {
+	uint32 head; // next byte to write; updated only by the producer
+	uint32 tail; // next byte to read; updated only by the consumer
+	uint8 buf[RING_SIZE];
+} ByteRing;
+
+static ByteRing rxRing; // I/O core -> VM core
+static ByteRing txRing; // VM core -> I/O core
+
+#define LOAD_ACQUIRE(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static int ringWrite(ByteRing *ring, uint8 *bytes, int count) {
+	// Producer: append up to count bytes and return the number written.
+
+	uint32 head = ring->head;
+	int space = RING_SIZE - (head - LOAD_ACQUIRE(&ring->tail));
+	if (count > space) count = space;
+	for (int i = 0; i < count; i++) ring->buf[(head + i) & RING_MASK] = bytes[i];
+	STORE_RELEASE(&ring->head, head + count);
+	return count;
+}
+
+static int ringRead(ByteRing *ring, uint8 *bytes, int count) {
+	// Consumer: remove up to count bytes and return the number read.
+
+	uint32 tail = ring->tail;
+	int available = LOAD_ACQUIRE(&ring->head) - tail;
+	if (count > available) count = available;
+	for (int i = 0; i < count; i++) bytes[i] = ring->buf[(tail + i) & RING_MASK];
+	STORE_RELEASE(&ring->tail, tail + count);
+	return count;
+}
+
+// Pausing the I/O Core
+
+static int ioCoreStarted = false;
+static int pauseRequested = false; // written only by the VM core
+static int ioCorePaused = false; // written only by the I/O core
+
+void pauseIOCore() {
+	// Wait until the I/O task is idle and keep it idle until resumeIOCore().
+
+	if (!ioCoreStarted) return;
+	STORE_RELEASE(&pauseRequested, true);
+	while (!LOAD_ACQUIRE(&ioCorePaused)) { } // the I/O task pauses within a millisecond
+}
+
+void resumeIOCore() {
+	if (!ioCoreStarted) return;
+	STORE_RELEASE(&pauseRequested, false);
+	while (LOAD_ACQUIRE(&ioCorePaused)) { } // wait so that a new pause is not missed
+}
+
+static int ioCorePauseCheck() {
+	// Called by the I/O task. If a pause was requested, acknowledge it and return true.
+
+	int paused = LOAD_ACQUIRE(&pauseRequested);
+	if (paused != ioCorePaused) STORE_RELEASE(&ioCorePaused, paused);
+	return paused;
+}
+
+// VM Core
+
+#define CONNECTION_CHECK_MSECS 100
+
+static uint32 lastConnectionCheck = 0;
+
+int dualCoreRecvBytes(uint8 *buf, int count) {
+	uint32 now = millisecs();
+	if ((now - lastConnectionCheck) >= CONNECTION_CHECK_MSECS) {
+		lastConnectionCheck = now;
+		pauseIOCore();
+		updateIDEConnection();
+		resumeIOCore();
+	}
+	return ringRead(&rxRing, buf, count);
+}
+
+int dualCoreSendBytes(uint8 *buf, int start, int end) {
+	// Queue bytes buf[start] through buf[end - 1] and return the number of bytes queued.
+
+	return ringWrite(&txRing, &buf[start], end - start);
+}
+
+// I/O Core
+
+static int ioCoreStep() {
+	// Receive and send bytes without copying, using the contiguous free space of rxRing
+	// and the contiguous data of txRing. Return true if any bytes were moved.
+
+	int moved = false;
+
+	uint32 head = rxRing.head;
+	int space = RING_SIZE - (head - LOAD_ACQUIRE(&rxRing.tail));
+	int contiguous = RING_SIZE - (head & RING_MASK);
+	if (space > contiguous) space = contiguous;
+	if (space > 0) {
+		int byteCount = recvBytes(&rxRing.buf[head & RING_MASK], space);
+		if (byteCount > 0) {
+			STORE_RELEASE(&rxRing.head, head + byteCount);
+			moved = true;
+		}
+	}
+
+	uint32 tail = txRing.tail;
+	int available = LOAD_ACQUIRE(&txRing.head) - tail;
+	if (available > 0) {
+		int start = tail & RING_MASK;
+		int end = ((start + available) > RING_SIZE) ? RING_SIZE : (start + available);
+		int byteCount = sendBytes(txRing.buf, start, end);
+		if (byteCount > 0) {
+			STORE_RELEASE(&txRing.tail, tail + byteCount);
+			moved = true;
+		}
+	}
+	return moved;
+}
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+static void ioCoreTask(void *param) {
+	while (true) {
+		if (ioCorePauseCheck() || !ioCoreStep()) vTaskDelay(1); // idle; yield to WiFi and BLE tasks
+	}
+}
+
+void startIOCore() {
+	// The Arduino loop() runs on core 1; run the I/O task on core 0.
+
+	ioCoreStarted = true;
+	xTaskCreatePinnedToCore(ioCoreTask, "mbIO", 4096, NULL, 1, NULL, 0);
+}
+
+#elif defined(GNUBLOCKS)
+
+static void * ioCoreThread(void *param) {
+	while (true) {
+		if (ioCorePauseCheck() || !ioCoreStep()) usleep(200); // idle
+	}
+	return NULL;
+}
+
+void startIOCore() {
+	ioCoreStarted = true;
+	pthread_t thread;
+	pthread_create(&thread, NULL, ioCoreThread, NULL);
+}
+
+#endif
+
+#endif // DUAL_CORE
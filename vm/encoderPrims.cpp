@@ -26,6 +26,13 @@
 
 #define NUM_ENCODERS 4
 
+// Count changes wake tasks waiting on an encoder count (see interp.h).
+#ifdef EVENT_WAKEUPS
+	#define SIGNAL_COUNT_CHANGED() { SIGNAL_PENDING_EVENT(EVENT_ENCODER); }
+#else
+	#define SIGNAL_COUNT_CHANGED()
+#endif
+
 typedef void (*interruptHandler)(void);
 static interruptHandler encoderInterruptHandlerFor(int encoderIndex); // forward reference
 static interruptHandler pulseInterruptHandlerFor(int encoderIndex);  // forward reference
@@ -140,6 +147,7 @@ public:
 		} else {
 			count += (stateA == stateB) ? -1 : 1;
 		}
+		SIGNAL_COUNT_CHANGED();
 	}
 };
 
@@ -162,10 +170,10 @@ static interruptHandler encoderInterruptHandlerFor(int encoderIndex) {
 }
 
 // Each pulse counter has an interrupt handler function that increments the count.
-static void pulseInterruptHandler_0() { encoders[0].count++; }
-static void pulseInterruptHandler_1() { encoders[1].count++; }
-static void pulseInterruptHandler_2() { encoders[2].count++; }
-static void pulseInterruptHandler_3() { encoders[3].count++; }
+static void pulseInterruptHandler_0() { encoders[0].count++; SIGNAL_COUNT_CHANGED(); }
+static void pulseInterruptHandler_1() { encoders[1].count++; SIGNAL_COUNT_CHANGED(); }
+static void pulseInterruptHandler_2() { encoders[2].count++; SIGNAL_COUNT_CHANGED(); }
+static void pulseInterruptHandler_3() { encoders[3].count++; SIGNAL_COUNT_CHANGED(); }
 
 static interruptHandler pulseInterruptHandlerFor(int encoderIndex) {
 	switch(encoderIndex) {
@@ -226,6 +234,7 @@ static OBJ primEncoderCount(int argCount, OBJ *args) {
 	if (encoderIndex >= 1 || encoderIndex <= NUM_ENCODERS) {
 		result = encoders[encoderIndex].count;
 	}
+	noteEventSource(EVENT_ENCODER);
 	return int2obj(result);
 }
 
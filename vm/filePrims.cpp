@@ -201,8 +201,9 @@ static OBJ primReadBytes(int argCount, OBJ *args) {
 static OBJ primReadInto(int argCount, OBJ *args) {
 	if (argCount < 2) return fail(notEnoughArguments);
 	OBJ buf = args[0];
-	char *fileName = extractFilename(args[1]);
 	if (ByteArrayType != objType(buf)) return fail(needsByteArray);
+	if (!UNSHARE_BYTES(buf)) return zeroObj; // allocation failed
+	char *fileName = extractFilename(args[1]);
 
 	int i = entryFor(fileName);
 	if (i < 0) return zeroObj; // file not found
@@ -240,6 +240,7 @@ void BLE_UART_Send(uint8 *data, int byteCount) {
 
 void BLE_start() {
 	if (bleRunning) return; // BLE already running
+	pauseIOCore(); // the I/O core's sendBytes() uses the BLE state
 
 	// Initialize three letter ID and name
 	initBLEDeviceName("MicroBlocks");
@@ -270,6 +271,7 @@ void BLE_start() {
 	pUARTService->start();
 
 	bleRunning = true;
+	resumeIOCore();
 
 	BLE_resumeAdvertising();
 	show_BLE_ID();
@@ -277,6 +279,7 @@ void BLE_start() {
 
 void BLE_stop() {
 	if (!bleRunning) return; // BLE already stopped
+	pauseIOCore(); // the I/O core's sendBytes() uses the BLE state
 
 	if (connID != -1) { pServer->disconnect(connID); }
 	connID = -1;
@@ -292,6 +295,7 @@ void BLE_stop() {
 	pRxCharacteristic = NULL;
 
 	bleRunning = false;
+	resumeIOCore();
 }
 
 // Stop and resume advertising (for use by Octo primitives)
@@ -553,10 +557,22 @@ void BLE_UART_Send(uint8 *data, int byteCount) {
 
 // IDE receive and send (same for both version of BLE)
 
+#ifdef DUAL_CORE
+
+void updateIDEConnection() {
+	// Called by the VM core with the I/O core paused, since recvBytes() runs on the I/O core.
+
+	updateConnectionState();
+}
+
+#endif
+
 int recvBytes(uint8 *buf, int count) {
 	int bytesRead;
 
-	updateConnectionState();
+	#ifndef DUAL_CORE
+		updateConnectionState(); // the VM core calls updateIDEConnection() instead
+	#endif
 
 	if (!BLE_connected_to_IDE) { // no BLE connection; use Serial
 		bytesRead = Serial.available();
@@ -607,6 +623,10 @@ int sendBytes(uint8 *buf, int start, int end) {
 	return Serial.write(&buf[start], end - start);
 }
 
+#ifdef DUAL_CORE
+	void updateIDEConnection() { }
+#endif
+
 // stubs for non-BLE:
 void BLE_start() { }
 void BLE_stop() { }
@@ -618,8 +638,10 @@ void BLE_resumeAdvertising() { }
 void restartSerial() {
 	// Needed to work around a micro:bit issue that Serial can lock up during Flash compaction.
 
+	pauseIOCore();
 	Serial.end();
 	Serial.begin(115200);
+	resumeIOCore();
 }
 
 // BLE enable/disable functions (do nothing on non-BLE boards)
@@ -18,6 +18,11 @@
 #include "interp.h"
 #include "persist.h"
 
+#if defined(ARDUINO_ARCH_ESP32)
+	#include "freertos/FreeRTOS.h"
+	#include "freertos/task.h"
+#endif
+
 
 #if defined(WII)
 extern void loopje_wii(void);
@@ -33,9 +38,22 @@ extern void loopje_wii(void);
 
 // Interpreter State
 
+#ifdef WIDE_CHUNKS
+CodeChunkRecord *chunks = NULL;
+int chunkTableSize = 0;
+#else
 CodeChunkRecord chunks[MAX_CHUNKS];
+int chunkTableSize = MAX_CHUNKS;
+#endif
 
-Task tasks[MAX_TASKS];
+#ifdef GROWABLE_STACKS
+Task **tasks = NULL;
+#else
+static Task taskEntries[MAX_TASKS];
+static Task *taskPointers[MAX_TASKS];
+Task **tasks = taskPointers;
+#endif
+int taskTableSize = 0;
 int taskCount = 0;
 
 OBJ vars[MAX_VARS];
@@ -88,6 +106,10 @@ static void printObj(OBJ obj) {
 		snprintf(dst, n, "[%d item list]", obj2int(FIELD(obj, 0)));
 	} else if (objType(obj) == ByteArrayType) {
 		snprintf(dst, n, "(%d bytes)", BYTES(obj));
+	} else if (objType(obj) == SliceType) {
+		snprintf(dst, n, "(%d bytes)", SLICE_COUNT(obj));
+	} else if (objType(obj) == DictionaryType) {
+		snprintf(dst, n, "[%d entry dictionary]", obj2int(FIELD(obj, 0)));
 	} else {
 		snprintf(dst, n, "(object type: %d)", objType(obj));
 	}
@@ -137,8 +159,6 @@ OBJ lastBroadcast = zeroObj; // Note: This variable must be processed by the gar
 static void primSendBroadcast(int argCount, OBJ *args) {
 	// Variadic broadcast; all args are concatenated into printBuffer.
 	printArgs(argCount, args, false, false);
-	// save the last broadcasted message
-	lastBroadcast = newStringFromBytes(printBuffer, printBufferByteCount);
 	startReceiversOfBroadcast(printBuffer, printBufferByteCount);
 	sendBroadcastToIDE(printBuffer, printBufferByteCount);
 }
@@ -343,18 +363,12 @@ static OBJ primCompare(int op, OBJ obj1, OBJ obj2) {
 
 static int stringsEqual(OBJ obj1, OBJ obj2) {
 	// Return true if the given strings have the same length and contents.
-	// Assume s1 and s2 are of Strings.
-
-	int byteCount = 4 * objWords(obj1);
-	if (byteCount != (4 * objWords(obj2))) return false; // different lengths
-	char *s1 = (char *) &FIELD(obj1, 0);
-	char *s2 = (char *) &FIELD(obj2, 0);
-	char *end = s1 + byteCount;
-	while (s1 < end) {
-		if (!*s1 && !*s2) return true; // null terminator in both strings
-		if (*s1++ != *s2++) return false; // not equal
-	}
-	return true;
+	// Assume s1 and s2 are of Strings. Do not compare word counts, since a string that
+	// was a string builder may have spare capacity. An empty string may have no words.
+
+	char *s1 = objWords(obj1) ? (char *) &FIELD(obj1, 0) : (char *) "";
+	char *s2 = objWords(obj2) ? (char *) &FIELD(obj2, 0) : (char *) "";
+	return (0 == strcmp(s1, s2));
 }
 
 static OBJ argOrDefault(OBJ *fp, int argNum, OBJ defaultValue) {
@@ -396,7 +410,7 @@ static int chunkIndexForFunction(char *functionName) {
 	// Return the chunk index for the function with the given name or -1 if not found.
 
 	int nameLength = strlen(functionName);
-	for (int i = 0; i < MAX_CHUNKS; i++) {
+	for (int i = 0; i < chunkTableSize; i++) {
 		int chunkType = chunks[i].chunkType;
 		if ((functionHat == chunkType) &&
 			 functionNameMatches(i, functionName, nameLength)) {
@@ -415,13 +429,665 @@ static int findCallee(char *functionOrPrimitiveName) {
 
 	// Look for a user-defined function match (slow if no match found!)
 	int result = chunkIndexForFunction(functionOrPrimitiveName);
-	if (result >= 0) return (0xFFFFFF00 | result); // set top 24 bits to show callee is a chunk
-	// assume: result < 256 (MAX_CHUNKS) so it fits in low 8 bits
+	if (result >= 0) return (0xFFFF0000 | result); // set top 16 bits to show callee is a chunk
+	// assume: result < 65536 (MAX_CHUNKS) so it fits in low 16 bits
 
 	fail(primitiveNotImplemented);
 	return -1;
 }
 
+// Callee Inline Cache
+
+// Caches findCallee() results for function names that are string literals in code
+// chunks, keyed on the address of the literal. Names in the object store are not
+// cached since they may be moved or garbage collected. The cache must be cleared
+// whenever the chunk table changes.
+
+#define CALLEE_CACHE_SIZE 32 // must be a power of 2!
+#define CALLEE_CACHE_MASK (CALLEE_CACHE_SIZE - 1)
+
+typedef struct {
+	OBJ name;
+	int callee;
+} CalleeCacheEntry;
+
+static CalleeCacheEntry calleeCache[CALLEE_CACHE_SIZE];
+
+void clearCalleeCache() {
+	memset(calleeCache, 0, sizeof(calleeCache));
+}
+
+static int cachedCallee(OBJ nameObj) {
+	if (inObjectStore(nameObj)) return findCallee(obj2str(nameObj));
+
+	CalleeCacheEntry *entry = &calleeCache[(((uint32) nameObj) >> 2) & CALLEE_CACHE_MASK];
+	if (entry->name != nameObj) {
+		int callee = findCallee(obj2str(nameObj));
+		if (-1 == callee) return -1; // not found; don't cache failures
+		entry->name = nameObj;
+		entry->callee = callee;
+	}
+	return entry->callee;
+}
+
+// Code Scanning
+
+static int instructionWords(int16 *ip) {
+	// Return the number of 16-bit words in the instruction at ip.
+
+	int op = CMD(*ip);
+	int arg = ARG(*ip);
+	switch (op) {
+	case 3: // pushLargeInteger
+	case 5: // pushLiteral
+	case 34: // callFunction
+	case 36: // commandPrimitive
+	case 37: // reporterPrimitive
+		return 2;
+	case 4: // pushHugeInteger
+	case 68: // callFunctionWide
+		return 3;
+	case 22: case 23: case 24: case 25: case 26: // jumps
+	case 28: case 29: case 30: case 31:
+		return arg ? 1 : 2; // zero arg means offset is in the next word
+	}
+	return 1;
+}
+
+int16 *nextPrimitiveCallSite(int16 **ipPtr, int16 *end) {
+	// Return the address of the second word of the next primitive call instruction
+	// at or after *ipPtr and advance *ipPtr past it. Return NULL at the end of the code.
+
+	int16 *ip = *ipPtr;
+	while (ip < end) {
+		int op = CMD(*ip);
+		if (127 == op) break; // codeEnd; literals follow
+		int16 *next = ip + instructionWords(ip);
+		if ((36 == op) || (37 == op)) { // commandPrimitive or reporterPrimitive
+			*ipPtr = next;
+			return ip + 1;
+		}
+		ip = next;
+	}
+	*ipPtr = end;
+	return NULL;
+}
+
+// Superinstruction Fusion
+
+#ifdef FUSE_OPS
+
+// opcodes used by fusion
+#define PUSH_IMMEDIATE 2
+#define PUSH_LARGE_INTEGER 3
+#define PUSH_HUGE_INTEGER 4
+#define PUSH_LITERAL 5
+#define PUSH_GLOBAL 6
+#define STORE_GLOBAL 7
+#define PUSH_LOCAL 10
+#define STORE_LOCAL 11
+#define PUSH_ARG 13
+#define JMP_FALSE 25
+#define REPORTER_PRIMITIVE 37
+#define ADD 50
+#define LESS_THAN 61
+#define AT 81
+#define CODE_END 127
+
+// fused opcodes (using unused opcodes starting at 100)
+#define INCREMENT_LOCAL_FUSED 100 // pushLocal a; pushImmediate k; add; storeLocal b
+#define INCREMENT_GLOBAL_FUSED 101 // pushGlobal a; pushImmediate k; add; storeGlobal b
+#define LOCAL_LESS_JMP_FUSED 102 // pushLocal a; pushImmediate k; lessThan; jmpFalse offset
+#define GLOBAL_LESS_JMP_FUSED 103 // pushGlobal a; pushImmediate k; lessThan; jmpFalse offset
+#define PUSH_LOCAL_BUILDER_FUSED 104 // pushLocal a (first argument of an APPEND_FUSED join)
+#define PUSH_GLOBAL_BUILDER_FUSED 105 // pushGlobal a (first argument of an APPEND_FUSED join)
+#define APPEND_FUSED 106 // reporterPrimitive data:join; storeLocal/storeGlobal a
+
+static int fusedOpFor(int16 *ip, int16 *end) {
+	// Return the fused opcode for the instruction sequence at ip or zero if none.
+
+	if ((ip + 4) > end) return 0;
+	int op = ip[0] & 0xFF;
+	if (((PUSH_LOCAL != op) && (PUSH_GLOBAL != op)) || (PUSH_IMMEDIATE != (ip[1] & 0xFF))) return 0;
+	uint16 op3 = ip[2];
+	int op4 = ip[3] & 0xFF;
+	if (OP(ADD, 2) == op3) {
+		if ((PUSH_LOCAL == op) && (STORE_LOCAL == op4)) return INCREMENT_LOCAL_FUSED;
+		if ((PUSH_GLOBAL == op) && (STORE_GLOBAL == op4)) return INCREMENT_GLOBAL_FUSED;
+	}
+	if ((OP(LESS_THAN, 2) == op3) && (JMP_FALSE == op4) && (ARG(ip[3]) != 0)) {
+		return (PUSH_LOCAL == op) ? LOCAL_LESS_JMP_FUSED : GLOBAL_LESS_JMP_FUSED;
+	}
+	return 0;
+}
+
+static int16 * appendJoinFor(int16 *ip, int16 *end) {
+	// If the instructions at ip are "set a to (join a ...)", where a is a local or global
+	// variable and the other join arguments are computed by simple instructions that cannot
+	// read a without releasing a string builder, return the address of the join instruction.
+	// Otherwise, return NULL.
+
+#ifdef STRING_BUILDERS
+	int op = CMD(*ip);
+	if ((PUSH_LOCAL != op) && (PUSH_GLOBAL != op)) return NULL;
+	int storeOp = (PUSH_LOCAL == op) ? STORE_LOCAL : STORE_GLOBAL;
+	int depth = 1; // number of join arguments pushed
+	int16 *p = ip + 1;
+	while ((p + 3) <= end) {
+		switch (CMD(*p)) {
+		case PUSH_IMMEDIATE: case PUSH_LARGE_INTEGER: case PUSH_HUGE_INTEGER:
+		case PUSH_LITERAL: case PUSH_GLOBAL: case PUSH_LOCAL: case PUSH_ARG:
+			depth++;
+			break;
+		case AT:
+			if (2 != ARG(*p)) return NULL;
+			depth--;
+			break;
+		case REPORTER_PRIMITIVE: {
+			if ((depth != ((*p >> 8) & 0xFF)) || (depth < 2)) return NULL;
+			if ((storeOp != CMD(p[2])) || (ARG(p[2]) != ARG(*ip))) return NULL;
+			int16 *callSite = p + 1;
+			if (DataPrims != ((*callSite >> 10) & 0x3F)) return NULL;
+			if (0 != strcmp(obj2str((OBJ) (callSite + (*callSite & 0x3FF))), "join")) return NULL;
+			return p;
+		}
+		default:
+			return NULL;
+		}
+		if (depth < 1) return NULL;
+		p += instructionWords(p);
+	}
+#endif
+	return NULL;
+}
+
+static int fusedCodeBytes = 0; // RAM used by fused chunk copies
+
+void fuseChunk(int chunkIndex) {
+	// Make a RAM copy of the given chunk with fused instructions if it has any fusable
+	// instruction sequences. If not, or if there is not enough memory, do nothing.
+	// The copy ends after the codeEnd instruction; literals are used from the original.
+
+	releaseFusedChunk(chunkIndex);
+	OBJ code = chunks[chunkIndex].code;
+	if (!code) return;
+
+	int16 *start = (int16 *) (code + PERSISTENT_HEADER_WORDS);
+	int16 *end = start + (2 * code[1]);
+	int16 *ip = start;
+	while ((ip < end) && (CODE_END != CMD(*ip))) ip += instructionWords(ip);
+	if (ip >= end) return; // no codeEnd; should not happen
+	end = ip + 1; // literals follow codeEnd
+	int instructionWordCount = ((end - start) + 1) / 2; // 32-bit words, rounded up
+	int byteCount = 4 * (PERSISTENT_HEADER_WORDS + instructionWordCount);
+
+	OBJ runCode = NULL;
+	for (ip = start; ip < end; ip += instructionWords(ip)) {
+		int fusedOp = fusedOpFor(ip, end);
+		int16 *joinCall = fusedOp ? NULL : appendJoinFor(ip, end);
+		if (joinCall) fusedOp = (PUSH_LOCAL == CMD(*ip)) ? PUSH_LOCAL_BUILDER_FUSED : PUSH_GLOBAL_BUILDER_FUSED;
+		if (fusedOp) {
+			if (!runCode) {
+				if ((fusedCodeBytes + byteCount) > MAX_FUSED_CODE_BYTES) return; // over budget
+				runCode = (OBJ) malloc(byteCount);
+				if (!runCode) return; // not enough memory; run unfused code
+				memcpy(runCode, code, byteCount);
+				runCode[1] = instructionWordCount;
+				fusedCodeBytes += byteCount;
+			}
+			int16 *dst = ((int16 *) runCode) + (ip - (int16 *) code);
+			*dst = (*dst & 0xFF00) | fusedOp; // replace opcode, keeping arg
+			if (joinCall) {
+				dst += joinCall - ip;
+				*dst = (*dst & 0xFF00) | APPEND_FUSED;
+			}
+		}
+	}
+	chunks[chunkIndex].runCode = runCode;
+}
+
+void releaseFusedChunk(int chunkIndex) {
+	// Free the fused copy of the given chunk, if any. Tasks running the fused copy are
+	// switched to the original code (the instruction offsets are the same).
+
+	OBJ runCode = chunks[chunkIndex].runCode;
+	if (!runCode) return;
+	for (int i = 0; i < taskTableSize; i++) {
+		if (tasks[i]->code == runCode) tasks[i]->code = chunks[chunkIndex].code;
+	}
+	chunks[chunkIndex].runCode = NULL;
+	fusedCodeBytes -= 4 * (PERSISTENT_HEADER_WORDS + runCode[1]);
+	free(runCode);
+}
+
+#else
+
+void fuseChunk(int chunkIndex) { }
+void releaseFusedChunk(int chunkIndex) { }
+
+#endif // FUSE_OPS
+
+// Wake Queue
+
+// Tasks waiting on the microsecond clock are kept in a min-heap ordered by wakeTime so
+// the scheduler only touches tasks that are due. Entries are not removed when a task is
+// stopped; instead, an entry is discarded when it reaches the top of the heap if its
+// task is no longer waiting for that wakeTime. Comparisons are safe across clock wrap.
+
+typedef struct {
+	uint32 wakeTime;
+	Task *task;
+} WakeQueueEntry;
+
+static WakeQueueEntry wakeQueue[MAX_TASKS];
+static int wakeQueueCount = 0;
+
+#define WAKES_BEFORE(t1, t2) (((int) ((t1) - (t2))) < 0)
+
+static int isStaleWakeEntry(WakeQueueEntry *entry) {
+	Task *task = entry->task;
+	return (waiting_micros != task->status) || (entry->wakeTime != task->wakeTime);
+}
+
+static void wakeQueuePush(Task *task, uint32 wakeTime) {
+	int i = wakeQueueCount++;
+	while (i > 0) { // sift up
+		int parent = (i - 1) / 2;
+		if (!WAKES_BEFORE(wakeTime, wakeQueue[parent].wakeTime)) break;
+		wakeQueue[i] = wakeQueue[parent];
+		i = parent;
+	}
+	wakeQueue[i].wakeTime = wakeTime;
+	wakeQueue[i].task = task;
+}
+
+static void wakeQueuePop() {
+	WakeQueueEntry last = wakeQueue[--wakeQueueCount];
+	int i = 0;
+	while (true) { // sift down
+		int child = (2 * i) + 1;
+		if (child >= wakeQueueCount) break;
+		if (((child + 1) < wakeQueueCount) &&
+			WAKES_BEFORE(wakeQueue[child + 1].wakeTime, wakeQueue[child].wakeTime)) {
+				child++;
+		}
+		if (!WAKES_BEFORE(wakeQueue[child].wakeTime, last.wakeTime)) break;
+		wakeQueue[i] = wakeQueue[child];
+		i = child;
+	}
+	wakeQueue[i] = last;
+}
+
+static void scheduleWakeup(Task *task) {
+	// Add a task to the wake queue. The caller sets the task status and wakeTime.
+	// If the queue is full of stale entries, rebuild it from the task list.
+
+	if (wakeQueueCount < MAX_TASKS) {
+		wakeQueuePush(task, task->wakeTime);
+		return;
+	}
+	wakeQueueCount = 0;
+	for (int i = 0; i < taskCount; i++) {
+		if (waiting_micros == tasks[i]->status) wakeQueuePush(tasks[i], tasks[i]->wakeTime);
+	}
+}
+
+static void wakeDueTasks(uint32 usecs) {
+	// Make all tasks whose wakeTime has arrived runnable.
+
+	while (wakeQueueCount > 0) {
+		WakeQueueEntry *top = &wakeQueue[0];
+		if (!isStaleWakeEntry(top)) {
+			if ((usecs - top->wakeTime) >= RECENT) return; // not yet due
+			top->task->status = running;
+		}
+		wakeQueuePop();
+	}
+}
+
+int usecsUntilNextWake(uint32 usecs) {
+	// Return the number of usecs until the next waiting task is due (zero if a task
+	// is already due) or -1 if no tasks are waiting.
+
+	while ((wakeQueueCount > 0) && isStaleWakeEntry(&wakeQueue[0])) wakeQueuePop();
+	if (!wakeQueueCount) return -1;
+	if ((usecs - wakeQueue[0].wakeTime) < RECENT) return 0;
+	return wakeQueue[0].wakeTime - usecs;
+}
+
+// Task Scheduling
+
+// The scheduler runs the most urgent runnable task: the one with the highest priority
+// or, among tasks of equal priority, a periodic task with the earliest deadline. Ties
+// are broken round-robin. A periodic task calls [misc:waitNextPeriod] at the end of
+// each activation; finishing after the deadline counts as a deadline miss.
+
+static Task *currentTask = NULL; // task being run by runTask()
+
+// Event Wakeups (see interp.h)
+
+#ifdef EVENT_WAKEUPS
+
+volatile uint8 pendingEvents = 0; // event sources signalled by interrupt handlers
+static uint8 primEvents = 0; // event sources noted by the primitive being called
+static int parkedTasks = 0; // number of tasks waiting for an event (may overcount)
+
+void noteEventSource(int events) {
+	// Called by primitives that read an input that reports its changes.
+
+	primEvents |= events;
+}
+
+void signalEvents(int events) {
+	// Make runnable all parked tasks that are waiting for any of the given events.
+
+	if (!parkedTasks) return;
+	int stillParked = 0;
+	for (int i = 0; i < taskCount; i++) {
+		Task *task = tasks[i];
+		if (waiting_event == task->status) {
+			if ((EVENT_ALL == events) || (task->waitEvents & events)) {
+				task->status = running;
+			} else {
+				stillParked++;
+			}
+		}
+	}
+	parkedTasks = stillParked;
+}
+
+// Watched Pins
+//
+// Digital pins read by tasks are watched so that tasks waiting for them to change can be
+// parked. The scheduler polls them while tasks are parked; polling a few pins is cheap and
+// avoids attaching interrupts to pins that other primitives may be using. Any read that
+// sees a level other than the last one recorded signals EVENT_PINS, so a task that reads
+// a pin cannot hide a change from the tasks parked on it.
+
+#define MAX_WATCHED_PINS 8
+
+static uint8 watchedPins[MAX_WATCHED_PINS];
+static uint8 watchedLevels[MAX_WATCHED_PINS];
+static int watchedPinCount = 0;
+
+static uint8 watchedButtons = 0; // WATCH_BUTTON_A and WATCH_BUTTON_B bits of the buttons read by tasks
+static uint8 buttonLevels = 0; // the button states last recorded (same bits)
+
+void watchPin(int pinNum, int level) {
+	// Record the level of a pin read by a task. Pins that cannot be watched are polled.
+
+	int i;
+	for (i = 0; i < watchedPinCount; i++) {
+		if (pinNum == watchedPins[i]) break;
+	}
+	if (i == watchedPinCount) {
+		if (watchedPinCount >= MAX_WATCHED_PINS) return; // watch list full
+		watchedPins[watchedPinCount++] = pinNum;
+	} else if (level != watchedLevels[i]) {
+		SIGNAL_PENDING_EVENT(EVENT_PINS); // the pin changed since it was recorded
+	}
+	watchedLevels[i] = level;
+	noteEventSource(EVENT_PINS);
+}
+
+void clearWatchedPins() {
+	watchedPinCount = 0;
+	watchedButtons = 0;
+}
+
+static int inputPinsChanged() {
+	// Return true if any watched pin has changed since it was last read.
+
+	int changed = false;
+	for (int i = 0; i < watchedPinCount; i++) {
+		int level = readWatchedPin(watchedPins[i]);
+		if (level != watchedLevels[i]) {
+			watchedLevels[i] = level;
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+// Watched Buttons
+//
+// Buttons read by tasks are watched, too. checkButtons() reads them periodically
+// and reports their states with watchButton(), so EVENT_BUTTONS is signalled only when a
+// button changes.
+
+void watchButton(int button, int isDown) {
+	// Record the state of a button read by a task or by checkButtons(). If it changed since it
+	// was last recorded, wake the tasks that saw the old state.
+
+	watchedButtons |= button;
+	int level = isDown ? button : 0;
+	if (level != (buttonLevels & button)) {
+		buttonLevels ^= button;
+		SIGNAL_PENDING_EVENT(EVENT_BUTTONS);
+	}
+}
+
+int buttonsWatched() {
+	return watchedButtons;
+}
+
+static void checkEventSources() {
+	// Signal the events recorded by interrupt handlers and any changes of watched inputs.
+
+	if (!parkedTasks) return;
+	int events = __atomic_exchange_n(&pendingEvents, 0, __ATOMIC_RELAXED);
+	if (inputPinsChanged()) events |= EVENT_PINS;
+	if (serialInputArrived()) events |= EVENT_SERIAL;
+	if (events) signalEvents(events);
+}
+
+static void parkTask(Task *task) {
+	// Park a task whose wait condition is false unless that condition must be polled.
+	// Clear its event sources (but not EVENT_WRITES) for the next condition test.
+
+	if (!(task->eventMask & EVENT_POLL)) {
+		task->status = waiting_event;
+		task->waitEvents = task->eventMask;
+		parkedTasks++;
+	}
+	task->eventMask &= EVENT_WRITES;
+}
+
+static void taskRan(Task *task) {
+	// Called after running a task. Wake parked tasks if the task may have changed
+	// something that they are waiting for.
+
+	if (task->eventMask & EVENT_WRITES) {
+		task->eventMask &= ~EVENT_WRITES;
+		signalEvents(EVENT_ALL);
+	}
+}
+
+#define NOTE_EVENTS(events) { task->eventMask |= (events); }
+#define WATCH_BUTTON(button, value) { watchButton((button), (trueObj == (value))); }
+#define NOTE_WRITES() { task->eventMask |= (EVENT_POLL | EVENT_WRITES); }
+#define BEGIN_PRIMITIVE() { primEvents = 0; }
+#define END_PRIMITIVE() { task->eventMask |= (primEvents ? primEvents : (EVENT_POLL | EVENT_WRITES)); }
+
+#else
+
+#define checkEventSources()
+#define taskRan(task)
+#define NOTE_EVENTS(events)
+#define WATCH_BUTTON(button, value)
+#define NOTE_WRITES()
+#define BEGIN_PRIMITIVE()
+#define END_PRIMITIVE()
+
+#endif
+
+static int moreUrgent(Task *task, Task *other) {
+	if (task->priority != other->priority) return task->priority > other->priority;
+	if (!task->period) return false;
+	if (!other->period) return true;
+	return WAKES_BEFORE(task->deadline, other->deadline);
+}
+
+static int nextTaskIndex(int lastIndex) {
+	// Return the index of the most urgent running task or -1 if there are none.
+	// The search starts after lastIndex so that tasks of equal urgency take turns.
+
+	int result = -1;
+	int i = lastIndex;
+	for (int t = 0; t < taskCount; t++) {
+		i++;
+		if (i >= taskCount) i = 0;
+		if (running == tasks[i]->status) {
+			if ((result < 0) || moreUrgent(tasks[i], tasks[result])) result = i;
+		}
+	}
+	return result;
+}
+
+static void suspendCurrentTaskUntil(uint32 wakeTime) {
+	// Suspend the current task until the given time. Called by primitives.
+
+	currentTask->status = waiting_micros;
+	currentTask->wakeTime = wakeTime;
+	scheduleWakeup(currentTask);
+	errorCode = sleepSignal;
+}
+
+OBJ primSetTaskPriority(int argCount, OBJ *args) {
+	if (argCount < 1) return fail(notEnoughArguments);
+	if (!isInt(args[0])) return fail(needsIntegerError);
+	int priority = obj2int(args[0]);
+	if (priority < 0) priority = 0;
+	if (priority > 255) priority = 255;
+	currentTask->priority = priority;
+	return falseObj;
+}
+
+OBJ primTaskPriority(int argCount, OBJ *args) {
+	return int2obj(currentTask->priority);
+}
+
+OBJ primSetTaskPeriod(int argCount, OBJ *args) {
+	// Set the period of the current task in microseconds (zero for none). The first
+	// period starts now. Also clears the task's deadline miss count.
+
+	if (argCount < 1) return fail(notEnoughArguments);
+	if (!isInt(args[0])) return fail(needsIntegerError);
+	int period = obj2int(args[0]);
+	if (period < 0) period = 0;
+	if (period > RECENT) period = RECENT;
+	currentTask->period = period;
+	currentTask->deadline = microsecs() + period;
+	currentTask->deadlineMisses = 0;
+	return falseObj;
+}
+
+OBJ primWaitNextPeriod(int argCount, OBJ *args) {
+	// Wait for the start of the next period. If the deadline has already passed, count
+	// a miss and start a new period immediately rather than trying to catch up.
+
+	if (!currentTask->period) return falseObj;
+	uint32 now = microsecs();
+	uint32 deadline = currentTask->deadline;
+	if (WAKES_BEFORE(deadline, now)) {
+		currentTask->deadlineMisses++;
+		currentTask->deadline = now + currentTask->period;
+		return falseObj;
+	}
+	currentTask->deadline = deadline + currentTask->period;
+	suspendCurrentTaskUntil(deadline);
+	return falseObj;
+}
+
+OBJ primDeadlineMisses(int argCount, OBJ *args) {
+	return int2obj(currentTask->deadlineMisses);
+}
+
+#ifdef PROFILER
+
+uint32 currentCodeLocation() {
+	// Return the location of the last instruction of the current task as <16 bit ip><16 bit
+	// chunkIndex>. The ip is only recorded while profiling (see PROFILE_OP()).
+
+	if (!currentTask) return UNKNOWN_ALLOC_SITE;
+	return (currentTask->ip << 16) | currentTask->currentChunkIndex;
+}
+
+#endif
+
+// Task Stacks
+
+#ifdef GROWABLE_STACKS
+
+int growTaskStack(Task *task, int wordsNeeded) {
+	// Grow the task's stack to hold at least wordsNeeded words. Return false if that
+	// would exceed MAX_STACK_WORDS or if there is not enough memory.
+
+	if (wordsNeeded > MAX_STACK_WORDS) return false;
+	int newSize = task->stackSize ? task->stackSize : INITIAL_STACK_WORDS;
+	while (newSize < wordsNeeded) newSize *= 2;
+	if (newSize > MAX_STACK_WORDS) newSize = MAX_STACK_WORDS;
+	OBJ *newStack = (OBJ *) realloc(task->stack, 4 * newSize);
+	if (!newStack) return false;
+	task->stack = newStack;
+	task->stackSize = newSize;
+	return true;
+}
+
+void freeTaskStack(Task *task) {
+	free(task->stack);
+	task->stack = NULL;
+	task->stackSize = 0;
+}
+
+#endif
+
+// Task and Chunk Tables
+
+int growTaskTable() {
+	// Add an unused entry to the end of the task table. Return false if the table already
+	// has MAX_TASKS entries or if there is not enough memory. Tasks are allocated one at a
+	// time and never freed, so Task pointers stay valid when the table grows.
+
+	if (taskTableSize >= MAX_TASKS) return false;
+	#ifdef GROWABLE_STACKS
+		Task **newTable = (Task **) realloc(tasks, (taskTableSize + 1) * sizeof(Task *));
+		if (!newTable) return false;
+		tasks = newTable;
+		Task *task = (Task *) calloc(1, sizeof(Task));
+		if (!task) return false;
+		tasks[taskTableSize] = task;
+	#else
+		tasks[taskTableSize] = &taskEntries[taskTableSize];
+	#endif
+	taskTableSize++;
+	return true;
+}
+
+int growChunkTable(int chunkIndex) {
+	// Make sure the chunk table has an entry for chunkIndex. Return false if chunkIndex is
+	// out of range or reserved, or if there is not enough memory.
+
+	if ((chunkIndex < 0) || (chunkIndex >= MAX_CHUNKS) || (255 == chunkIndex)) return false;
+	#ifdef WIDE_CHUNKS
+		if (chunkIndex < chunkTableSize) return true;
+		int newSize = chunkTableSize ? chunkTableSize : 64;
+		while (newSize <= chunkIndex) newSize *= 2;
+		if (newSize > MAX_CHUNKS) newSize = MAX_CHUNKS;
+		CodeChunkRecord *newTable = (CodeChunkRecord *) realloc(chunks, newSize * sizeof(CodeChunkRecord));
+		if (!newTable) return false;
+		memset(&newTable[chunkTableSize], 0, (newSize - chunkTableSize) * sizeof(CodeChunkRecord));
+		chunks = newTable;
+		chunkTableSize = newSize;
+	#endif
+	return true;
+}
+
+void clearChunkTable() {
+	for (int i = 0; i < chunkTableSize; i++) releaseFusedChunk(i);
+	if (chunkTableSize) memset(chunks, 0, chunkTableSize * sizeof(CodeChunkRecord));
+}
+
 // Interpreter
 
 // Macros to pop arguments for commands and reporters (pops args, leaves result on stack)
@@ -429,12 +1095,28 @@ static int findCallee(char *functionOrPrimitiveName) {
 #define POP_ARGS_REPORTER() { sp -= arg - 1; }
 
 // Macro to check for stack overflow
+#ifdef GROWABLE_STACKS
+// Grows the stack if needed, then rebases sp and fp since the stack may have moved.
+#define STACK_CHECK(n) { \
+	if (((sp + (n)) - task->stack) > task->stackSize) { \
+		int spOffset = sp - task->stack; \
+		int fpOffset = fp - task->stack; \
+		if (!growTaskStack(task, spOffset + (n))) { \
+			errorCode = stackOverflow; \
+			goto error; \
+		} \
+		sp = task->stack + spOffset; \
+		fp = task->stack + fpOffset; \
+	} \
+}
+#else
 #define STACK_CHECK(n) { \
 	if (((sp + (n)) - task->stack) > STACK_LIMIT) { \
 		errorCode = stackOverflow; \
 		goto error; \
 	} \
 }
+#endif
 
 // Macros to support function calls
 #define IN_CALL() (fp > task->stack)
@@ -447,10 +1129,35 @@ static void interpDebug(int ip, int cmd, int arg, int sp) {
 	outputString(tmpStr); \
 }
 
+// Opcode counter for benchmarking
+
+#ifdef BENCHMARK
+	uint32 opCount = 0;
+	#define COUNT_OP() { opCount++; }
+#else
+	#define COUNT_OP()
+#endif
+
+// Profiler hook (see runtime.c)
+
+#ifdef PROFILER
+	// while profiling, also record the ip so allocations can be attributed to it
+	#define PROFILE_OP() { \
+		if (profiling) { \
+			task->ip = ip - (int16 *) task->code; \
+			profileOp(CMD(op), task->currentChunkIndex); \
+		} \
+	}
+#else
+	#define PROFILE_OP()
+#endif
+
 // Macro to inline dispatch in the end of each opcode (avoiding a jump back to the top)
 #define DISPATCH() { \
 	if (errorCode) goto error; \
 	op = *ip++; \
+	COUNT_OP(); \
+	PROFILE_OP(); \
 	arg = ARG(op); \
 	task->sp = sp - task->stack; /* record stack pointer for garbage collector */ \
 	/* interpDebug((ip - (int16 *) task->code), CMD(op), arg, task->sp); */ \
@@ -504,7 +1211,7 @@ static void runTask(Task *task) {
 		&&forLoop_op,
 		&&jmpOr_op,
 		&&jmpAnd_op,
-		&&waitUntil_op,				// 30 (alias for jmpFalse_op)
+		&&waitUntil_op,				// 30 (jmpFalse_op that may park the task; see parkTask())
 		&&exitLoop_op,
 		&&waitMicros_op,
 		&&waitMillis_op,
@@ -542,7 +1249,7 @@ static void runTask(Task *task) {
 		&&greaterOrEq_op,			// 65
 		&&greaterThan_op,
 		&&not_op,
-	&&RESERVED_op,
+		&&callFunctionWide_op,		// callFunction with a 16-bit chunk index
 	&&RESERVED_op,
 		&&longMultiply_op,			// 70
 		&&absoluteValue_op,
@@ -574,13 +1281,13 @@ static void runTask(Task *task) {
 		&&spiSend_op,
 		&&spiRecv_op,
 	&&RESERVED_op,
-	&&RESERVED_op,					// 100
-	&&RESERVED_op,
-	&&RESERVED_op,
-	&&RESERVED_op,
-	&&RESERVED_op,
-	&&RESERVED_op,
-	&&RESERVED_op,
+		&&incrementLocalFused_op,	// 100 (fused instructions; see fuseChunk())
+		&&incrementGlobalFused_op,
+		&&localLessJmpFused_op,
+		&&globalLessJmpFused_op,
+		&&pushLocalBuilderFused_op,
+		&&pushGlobalBuilderFused_op,	// 105
+		&&appendFused_op,
 	&&RESERVED_op,
 	&&RESERVED_op,
 	&&RESERVED_op,
@@ -604,7 +1311,12 @@ static void runTask(Task *task) {
 		&&codeEnd_op,				// 127 (alias for halt_op)
 	};
 
+	#ifdef PROFILER
+		if (profiling) profileResume();
+	#endif
+
 	// Restore task state
+	currentTask = task;
 	ip = (int16 *) task->code + task->ip;
 	sp = task->stack + task->sp;
 	fp = task->stack + task->fp;
@@ -618,28 +1330,33 @@ static void runTask(Task *task) {
 			if (taskSleepMSecs > 0) {
 				task->status = waiting_micros;
 				task->wakeTime = microsecs() + (taskSleepMSecs * 1000);
+				scheduleWakeup(task);
 			}
 			goto suspend;
 		}
-		// tmp encodes the error location: <22 bit ip><8 bit chunkIndex>
-		tmp = ((ip - (int16 *) task->code) << 8) | (task->currentChunkIndex & 0xFF);
-		sendTaskError(task->taskChunkIndex, errorCode, tmp);
+		sendTaskError(task->taskChunkIndex, errorCode, ip - (int16 *) task->code, task->currentChunkIndex);
 		task->status = unusedTask;
-		if (unusedTask == tasks[taskCount - 1].status) taskCount--;
+		if (unusedTask == tasks[taskCount - 1]->status) taskCount--;
 		errorCode = noError; // clear the error
 		goto suspend;
 	suspend:
+		#ifdef PROFILER
+			if (profiling) profileSample(task->currentChunkIndex);
+		#endif
 		// save task state
 		task->ip = ip - (int16 *) task->code;
 		task->sp = sp - task->stack;
 		task->fp = fp - task->stack;
+		#ifdef GROWABLE_STACKS
+			if (unusedTask == task->status) freeTaskStack(task);
+		#endif
 		return;
 	RESERVED_op:
 	halt_op:
 	codeEnd_op:
 		sendTaskDone(task->taskChunkIndex);
 		task->status = unusedTask;
-		if (unusedTask == tasks[taskCount - 1].status) taskCount--;
+		if (unusedTask == tasks[taskCount - 1]->status) taskCount--;
 		goto suspend;
 	noop_op:
 	comment_op:
@@ -658,16 +1375,20 @@ static void runTask(Task *task) {
 	pushLiteral_op:
 		STACK_CHECK(1);
 		tmp = *ip; // offset to the literal is in the following 16-bit word
-		*sp++ = (OBJ) (ip++ + tmp);
+		*sp++ = (OBJ) (ORIGINAL_IP(ip++) + tmp);
 		DISPATCH();
 	pushGlobal_op:
 		STACK_CHECK(1);
-		*sp++ = vars[arg];
+		tmpObj = vars[arg];
+		RELEASE_BUILDER(tmpObj);
+		*sp++ = tmpObj;
 		DISPATCH();
 	storeGlobal_op:
+		NOTE_WRITES();
 		vars[arg] = *--sp;
 		DISPATCH();
 	incrementGlobal_op:
+		NOTE_WRITES();
 		tmp = evalInt(vars[arg]);
 		if (!errorCode) {
 			vars[arg] = int2obj(tmp + evalInt(*--sp));
@@ -702,7 +1423,9 @@ static void runTask(Task *task) {
 		DISPATCH();
 	pushLocal_op:
 		STACK_CHECK(1);
-		*sp++ = *(fp + arg);
+		tmpObj = *(fp + arg);
+		RELEASE_BUILDER(tmpObj);
+		*sp++ = tmpObj;
 		DISPATCH();
 	storeLocal_op:
 		*(fp + arg) = *--sp;
@@ -736,13 +1459,27 @@ static void runTask(Task *task) {
 #endif
 		DISPATCH();
 	jmpFalse_op:
-	waitUntil_op:
 		if (!arg) arg = *ip++; // zero arg means offset is in the next word
 		if (trueObj != (*--sp)) ip += arg; // treat any value but true as false
 #if USE_TASKS
 		if ((arg < 0) && (trueObj != *sp)) goto suspend;
 #endif
 		DISPATCH();
+	waitUntil_op:
+		if (!arg) arg = *ip++; // zero arg means offset is in the next word
+		if (trueObj != (*--sp)) ip += arg; // treat any value but true as false
+#if USE_TASKS
+		if ((arg < 0) && (trueObj != *sp)) {
+			#ifdef EVENT_WAKEUPS
+				parkTask(task);
+			#endif
+			goto suspend;
+		}
+#endif
+		#ifdef EVENT_WAKEUPS
+			task->eventMask &= EVENT_WRITES; // start collecting event sources for the next test
+		#endif
+		DISPATCH();
 	decrementAndJmp_op:
 		if (!arg) arg = *ip++; // zero arg means offset is in the next word
 		if (isInt(*(sp - 1))) {
@@ -768,25 +1505,33 @@ static void runTask(Task *task) {
 		// ...
 		// local 0 <- fp points here during call, so the value of local m is *(fp + m)
 		// *(fp - 1), the old fp
-		// *(fp - 2), return address, <22 bit ip><8 bit chunkIndex> encoded as an integer object
+		// *(fp - 2), return address, <14 bit ip><16 bit chunkIndex> encoded as an integer object
 		// *(fp - 3), # of function arguments
 		// arg N-1
 		// ...
 		// arg 0
+		// Code chunks are limited by the message size (about 1k bytes), so ip fits in 14 bits.
 		arg = *ip++;
-	callFunctionByName:
 		tmp = (arg >> 8) & 0xFF; // callee's chunk index (middle byte of arg)
-		if (chunks[tmp].chunkType != functionHat) {
+		arg &= 0xFF; // # of arguments (low byte of arg)
+		goto callFunctionByName;
+	callFunctionWide_op:
+		// same as callFunction but the callee's chunk index is 16 bits:
+		// <callFunctionWide><chunkIndex (16 bits)><# of arguments>
+		tmp = (uint16) *ip++;
+		arg = *ip++ & 0xFF;
+	callFunctionByName: // tmp is the callee's chunk index and arg is the # of arguments
+		if ((tmp >= chunkTableSize) || (chunks[tmp].chunkType != functionHat)) {
 			fail(badChunkIndexError);
 			goto error;
 		}
 		STACK_CHECK(3);
-		*sp++ = int2obj(arg & 0xFF); // # of arguments (low byte of arg)
-		*sp++ = int2obj(((ip - (int16 *) task->code) << 8) | (task->currentChunkIndex & 0xFF)); // return address
+		*sp++ = int2obj(arg); // # of arguments
+		*sp++ = int2obj(((ip - (int16 *) task->code) << 16) | task->currentChunkIndex); // return address
 		*sp++ = int2obj(fp - task->stack); // old fp
 		fp = sp;
-		task->currentChunkIndex = tmp; // callee's chunk index (middle byte of arg)
-		task->code = chunks[task->currentChunkIndex].code;
+		task->currentChunkIndex = tmp; // callee's chunk index
+		task->code = RUN_CODE(task->currentChunkIndex);
 		ip = (int16 *) (task->code + PERSISTENT_HEADER_WORDS); // first instruction in callee
 		DISPATCH();
 	returnResult_op:
@@ -803,12 +1548,13 @@ static void runTask(Task *task) {
 		sp = fp - obj2int(*(fp - 3)) - 3; // restore stack pointer; *(fp - 3) is the arg count
 		*sp++ = tmpObj; // push return value (no need for a stack check; just recovered at least 3 words from the old call frame)
 		tmp = obj2int(*(fp - 2)); // return address
-		task->currentChunkIndex = tmp & 0xFF;
-		task->code = chunks[task->currentChunkIndex].code;
-		ip = ((int16 *) task->code) + ((tmp >> 8) & 0x3FFFFF); // restore old ip
+		task->currentChunkIndex = tmp & 0xFFFF;
+		task->code = RUN_CODE(task->currentChunkIndex);
+		ip = ((int16 *) task->code) + ((tmp >> 16) & 0x3FFF); // restore old ip
 		fp = task->stack + obj2int(*(fp - 1)); // restore the old fp
 		DISPATCH();
 	waitMicros_op:
+		NOTE_EVENTS(EVENT_POLL);
 	 	tmp = evalInt(*(sp - 1)); // wait time in usecs
 	 	POP_ARGS_COMMAND();
 	 	if (tmp <= 30) {
@@ -820,8 +1566,10 @@ static void runTask(Task *task) {
 		}
 		task->status = waiting_micros;
 		task->wakeTime = (microsecs() + tmp) - 7; // adjusted for approximate scheduler overhead
+		scheduleWakeup(task);
 		goto suspend;
 	waitMillis_op:
+		NOTE_EVENTS(EVENT_POLL);
 	 	tmp = evalInt(*(sp - 1)); // wait time in usecs
 	 	POP_ARGS_COMMAND();
 	 	if (tmp <= 0) { DISPATCH(); } // don't wait at all
@@ -831,8 +1579,10 @@ static void runTask(Task *task) {
 	 	}
 		task->status = waiting_micros;
 		task->wakeTime = microsecs() + ((1000 * tmp) - 7);
+		scheduleWakeup(task);
 		goto suspend;
 	sendBroadcast_op:
+		NOTE_WRITES();
 		primSendBroadcast(arg, sp - arg);
 		POP_ARGS_COMMAND();
 		DISPATCH();
@@ -840,6 +1590,7 @@ static void runTask(Task *task) {
 		POP_ARGS_COMMAND(); // pop the broadcast name (a literal string)
 		DISPATCH();
 	stopAll_op:
+		NOTE_WRITES();
 		stopAllTasksButThis(task); // clears all tasks except the current one
 		DISPATCH();
 	forLoop_op:
@@ -859,6 +1610,8 @@ static void runTask(Task *task) {
 				tmp = countUTF8(obj2str(tmpObj));
 			} else if (IS_TYPE(tmpObj, ByteArrayType)) {
 				tmp = BYTES(tmpObj);
+			} else if (IS_TYPE(tmpObj, SliceType)) {
+				tmp = SLICE_COUNT(tmpObj);
 			} else {
 				fail(badForLoopArg);
 				goto error;
@@ -883,6 +1636,8 @@ static void runTask(Task *task) {
 			} else if (IS_TYPE(tmpObj, ByteArrayType)) {
 				// set the index variable to the next byte of a byte array
 				*(fp + arg) = int2obj(((uint8 *) &FIELD(tmpObj, 0))[tmp]);
+			} else if (IS_TYPE(tmpObj, SliceType)) {
+				*(fp + arg) = int2obj(SLICE_BYTES(tmpObj)[tmp]);
 			} else {
 				fail(badForLoopArg);
 				goto error;
@@ -912,6 +1667,7 @@ static void runTask(Task *task) {
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	getLastBroadcast_op:
+		NOTE_EVENTS(EVENT_BROADCAST);
 		*(sp - arg) = lastBroadcast;
 		POP_ARGS_REPORTER();
 		DISPATCH();
@@ -1036,6 +1792,7 @@ static void runTask(Task *task) {
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	random_op:
+		NOTE_EVENTS(EVENT_POLL);
 		*(sp - arg) = primRandom(arg, sp - arg);
 		POP_ARGS_REPORTER();
 		DISPATCH();
@@ -1087,6 +1844,7 @@ static void runTask(Task *task) {
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	atPut_op:
+		NOTE_WRITES();
 		primAtPut(arg, sp - arg);
 		POP_ARGS_COMMAND();
 		DISPATCH();
@@ -1112,29 +1870,38 @@ static void runTask(Task *task) {
 					*(sp - arg) = strcmp(type, "list") == 0 ? trueObj : falseObj;
 					break;
 				case ByteArrayType:
+				case SliceType:
 					*(sp - arg) = strcmp(type, "byte array") == 0 ? trueObj : falseObj;
 					break;
+				case DictionaryType:
+					*(sp - arg) = strcmp(type, "dictionary") == 0 ? trueObj : falseObj;
+					break;
 			}
 		}
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	millis_op:
+		NOTE_EVENTS(EVENT_POLL);
 		STACK_CHECK(1);
 		*sp++ = int2obj((uint32) ((totalMicrosecs() / 1000) & 0x3FFFFFFF)); // result range is 0 - 1073741823
 		DISPATCH();
 	micros_op:
+		NOTE_EVENTS(EVENT_POLL);
 		STACK_CHECK(1);
 		*sp++ = int2obj(microsecs() & 0x3FFFFFFF); // low 30-bits so result is positive
 		DISPATCH();
 	timer_op:
+		NOTE_EVENTS(EVENT_POLL);
 		STACK_CHECK(1);
 		*sp++ = int2obj(timer());
 		DISPATCH();
 	resetTimer_op:
+		NOTE_EVENTS(EVENT_POLL);
 		resetTimer();
 		POP_ARGS_COMMAND();
 		DISPATCH();
 	sayIt_op:
+		NOTE_EVENTS(EVENT_POLL);
 		if (!ideConnected()) {
 			POP_ARGS_COMMAND(); // serial port not open; do nothing
 			DISPATCH();
@@ -1149,8 +1916,10 @@ static void runTask(Task *task) {
 		// wait for data to be sent; prevents use in tight loop from clogging serial line
 		task->status = waiting_micros;
 		task->wakeTime = microsecs() + (extraByteDelay * (printBufferByteCount + 6));
+		scheduleWakeup(task);
 		goto suspend;
 	graphIt_op:
+		NOTE_EVENTS(EVENT_POLL);
 		if (!ideConnected()) {
 			POP_ARGS_COMMAND(); // serial port not open; do nothing
 			DISPATCH();
@@ -1169,6 +1938,7 @@ static void runTask(Task *task) {
 		// wait for data to be sent; prevents use in tight loop from clogging serial line
 		task->status = waiting_micros;
 		task->wakeTime = microsecs() + (extraByteDelay * (printBufferByteCount + 6));
+		scheduleWakeup(task);
 		goto suspend;
 	boardType_op:
 		*(sp - arg) = primBoardType();
@@ -1195,68 +1965,87 @@ static void runTask(Task *task) {
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	analogRead_op:
+		NOTE_EVENTS(EVENT_POLL);
 		*(sp - arg) = primAnalogRead(arg, sp - arg);
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	analogWrite_op:
+		NOTE_EVENTS(EVENT_POLL);
 		primAnalogWrite(sp - arg);
 		POP_ARGS_COMMAND();
 		DISPATCH();
 	digitalRead_op:
+		BEGIN_PRIMITIVE(); // notes EVENT_PINS if the pin is watched for changes
 		*(sp - arg) = primDigitalRead(arg, sp - arg);
+		END_PRIMITIVE();
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	digitalWrite_op:
+		NOTE_EVENTS(EVENT_POLL);
 		primDigitalWrite(sp - arg);
 		POP_ARGS_COMMAND();
 		DISPATCH();
 	digitalSet_op:
+		NOTE_EVENTS(EVENT_POLL);
 		// no args to pop; pin number is encoded in arg field of instruction
 		primDigitalSet(arg, true);
 		DISPATCH();
 	digitalClear_op:
+		NOTE_EVENTS(EVENT_POLL);
 		// no args to pop; pin number is encoded in arg field of instruction
 		primDigitalSet(arg, false);
 		DISPATCH();
 	buttonA_op:
+		NOTE_EVENTS(EVENT_BUTTONS);
 		*(sp - arg) = primButtonA(sp - arg);
+		WATCH_BUTTON(WATCH_BUTTON_A, *(sp - arg));
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	buttonB_op:
+		NOTE_EVENTS(EVENT_BUTTONS);
 		*(sp - arg) = primButtonB(sp - arg);
+		WATCH_BUTTON(WATCH_BUTTON_B, *(sp - arg));
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	setUserLED_op:
+		NOTE_EVENTS(EVENT_POLL);
 		primSetUserLED(sp - arg);
 		POP_ARGS_COMMAND();
 		DISPATCH();
 	i2cSet_op:
+		NOTE_EVENTS(EVENT_POLL);
 		primI2cSet(sp - arg);
 		POP_ARGS_COMMAND();
 		DISPATCH();
 	i2cGet_op:
+		NOTE_EVENTS(EVENT_POLL);
 		*(sp - arg) = primI2cGet(sp - arg);
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	spiSend_op:
+		NOTE_EVENTS(EVENT_POLL);
 		primSPISend(sp - arg);
 		POP_ARGS_COMMAND();
 		DISPATCH();
 	spiRecv_op:
+		NOTE_EVENTS(EVENT_POLL);
 		*(sp - arg) = primSPIRecv(sp - arg);
 		POP_ARGS_REPORTER();
 		DISPATCH();
 
 	// more time operations
 	secs_op:
+		NOTE_EVENTS(EVENT_POLL);
 		STACK_CHECK(1);
 		*sp++ = int2obj((uint32) ((totalMicrosecs() / 1000000)) & 0x3FFFFFFF); // result range is 0 - 1073741823
 		DISPATCH();
 	millisSince_op:
+		NOTE_EVENTS(EVENT_POLL);
 		*(sp - arg) = primMSecsSince(arg, sp - arg);
 		POP_ARGS_REPORTER();
 		DISPATCH();
 	microsSince_op:
+		NOTE_EVENTS(EVENT_POLL);
 		*(sp - arg) = primUSecsSince(arg, sp - arg);
 		POP_ARGS_REPORTER();
 		DISPATCH();
@@ -1270,35 +2059,107 @@ static void runTask(Task *task) {
 		DISPATCH();
 
 	// new primitive call ops:
+	// The second instruction word holds the primitive set index and name literal offset.
+	// callPrimitiveAt() uses its address to look up the resolved primitive function.
 	commandPrimitive_op:
-		tmp = (*ip >> 10) & 0x3F; // primitive set index
-		tmpObj = (OBJ) (ip + (*ip & 0x3FF)); // primitive name object
-		ip++; // skip second instruction word
 		arg = arg & 0xFF; // argument count
-		doPrimitiveCall(tmp, obj2str(tmpObj), arg, sp - arg);
+		BEGIN_PRIMITIVE();
+		callPrimitiveAt(ORIGINAL_IP(ip++), arg, sp - arg);
+		END_PRIMITIVE();
 		POP_ARGS_COMMAND();
 		DISPATCH();
 	reporterPrimitive_op:
-		tmp = (*ip >> 10) & 0x3F; // primitive set index
-		tmpObj = (OBJ) (ip + (*ip & 0x3FF)); // primitive name object
-		ip++; // skip second instruction word
 		arg = arg & 0xFF; // argument count
-		*(sp - arg) = doPrimitiveCall(tmp, obj2str(tmpObj), arg, sp - arg);
+		BEGIN_PRIMITIVE();
+		*(sp - arg) = callPrimitiveAt(ORIGINAL_IP(ip++), arg, sp - arg);
+		END_PRIMITIVE();
+		POP_ARGS_REPORTER();
+		DISPATCH();
+
+	// Fused instructions. The arg and the words following the fused opcode are those of the
+	// original instruction sequence, so if the fast path does not apply (e.g. an operand is
+	// not an integer) these just execute the original first instruction.
+	incrementLocalFused_op:
+		tmpObj = (OBJ) ARG(*ip); // pushImmediate value
+		if (isInt(*(fp + arg)) && isInt(tmpObj)) {
+			*(fp + ARG(ip[2])) = int2obj(obj2int(*(fp + arg)) + obj2int(tmpObj));
+			ip += 3;
+			DISPATCH();
+		}
+		goto pushLocal_op;
+	incrementGlobalFused_op:
+		NOTE_WRITES();
+		tmpObj = (OBJ) ARG(*ip); // pushImmediate value
+		if (isInt(vars[arg]) && isInt(tmpObj)) {
+			vars[ARG(ip[2])] = int2obj(obj2int(vars[arg]) + obj2int(tmpObj));
+			ip += 3;
+			DISPATCH();
+		}
+		goto pushGlobal_op;
+	localLessJmpFused_op:
+		tmpObj = (OBJ) ARG(*ip); // pushImmediate value
+		if (isInt(*(fp + arg)) && isInt(tmpObj)) {
+			tmp = ARG(ip[2]); // jmpFalse offset
+			ip += 3;
+			if (obj2int(*(fp + arg)) >= obj2int(tmpObj)) { // condition is false
+				ip += tmp;
+#if USE_TASKS
+				if (tmp < 0) goto suspend;
+#endif
+			}
+			DISPATCH();
+		}
+		goto pushLocal_op;
+	globalLessJmpFused_op:
+		tmpObj = (OBJ) ARG(*ip); // pushImmediate value
+		if (isInt(vars[arg]) && isInt(tmpObj)) {
+			tmp = ARG(ip[2]); // jmpFalse offset
+			ip += 3;
+			if (obj2int(vars[arg]) >= obj2int(tmpObj)) { // condition is false
+				ip += tmp;
+#if USE_TASKS
+				if (tmp < 0) goto suspend;
+#endif
+			}
+			DISPATCH();
+		}
+		goto pushGlobal_op;
+	pushLocalBuilderFused_op:
+		// like pushLocal but does not release a string builder; see appendFused_op
+		STACK_CHECK(1);
+		*sp++ = *(fp + arg);
+		DISPATCH();
+	pushGlobalBuilderFused_op:
+		STACK_CHECK(1);
+		*sp++ = vars[arg];
+		DISPATCH();
+	appendFused_op:
+		NOTE_WRITES();
+		// A join whose result is stored into the variable whose value is its first argument.
+		// No other reference to a string builder can exist, so it can be appended in place.
+		arg = arg & 0xFF; // argument count
+		#ifdef STRING_BUILDERS
+			*(sp - arg) = appendToStringBuilder(arg, sp - arg);
+			ip++; // skip the call site word
+		#else
+			*(sp - arg) = callPrimitiveAt(ORIGINAL_IP(ip++), arg, sp - arg);
+		#endif
 		POP_ARGS_REPORTER();
 		DISPATCH();
 
 	// call a function using the function name and parameter list:
 	callCustomCommand_op:
 	callCustomReporter_op:
+		NOTE_WRITES();
 		if (arg > 0) {
 			taskSleep(-1); // do background VM tasks sooner
 			uint32 callee = -1;
 			OBJ params = *(sp - 1); // save the parameters array, if any
 			// look up the function or primitive name
 			if ((arg == 1) && (IS_TYPE(*(sp - 1), StringType))) {
-				callee = findCallee(obj2str(*(sp - 1)));
+				callee = cachedCallee(*(sp - 1));
 			} else if ((arg == 2) && (IS_TYPE(*(sp - 2), StringType))) {
-				callee = findCallee(obj2str(*(sp - 2)));
+				callee = cachedCallee(*(sp - 2));
 			}
 			POP_ARGS_COMMAND();
 			if (callee != -1) { // found a callee
@@ -1306,6 +2167,7 @@ static void runTask(Task *task) {
 				if (arg == 2) { // has an optional parameters list (the second argument)
 					if (IS_TYPE(params, ListType)) { // push the parameters onto the stack
 						paramCount = (obj2int(FIELD(params, 0)) & 0xFF);
+						STACK_CHECK(paramCount);
 						for (int i = 1; i <= paramCount; i++) {
 							*sp++ = FIELD(params, i);
 						}
@@ -1317,12 +2179,12 @@ static void runTask(Task *task) {
 
 				// invoke the callee
 				task->sp = sp - task->stack; // record the stack pointer in case callee does a GC
-				if ((callee & 0xFFFFFF00) == 0xFFFFFF00) { // callee is a MicroBlocks function (i.e. a chunk index)
-					arg = ((callee & 0xFF) << 8) | paramCount;
+				if ((callee & 0xFFFF0000) == 0xFFFF0000) { // callee is a MicroBlocks function (i.e. a chunk index)
+					tmp = callee & 0xFFFF;
+					arg = paramCount;
 					goto callFunctionByName;
 				} else { // callee is a named primitive (i.e. a pointer to a C function)
-					tmpObj = ((PrimitiveFunction) callee)(paramCount, sp - paramCount); // call the primitive
-					tempGCRoot = NULL; // clear tempGCRoot in case it was used
+					tmpObj = callPrimitive((PrimitiveFunction) callee, paramCount, sp - paramCount);
 					sp -= paramCount;
 					*sp++ = tmpObj; // push primitive return value
 					DISPATCH();
@@ -1351,6 +2213,7 @@ void vmLoop() {
 			#endif
 			processMessage();
 			checkButtons();
+			compactCodeStoreStep();
 			#if defined(HAS_LED_MATRIX)
 				updateMicrobitDisplay();
 			#endif
@@ -1359,31 +2222,28 @@ void vmLoop() {
 			#endif
 			handleMicosecondClockWrap();
 			count = 95; // must be under 30 when building on mbed to avoid serial errors
+#ifndef DUAL_CORE
 		} else if ((count & 0xF) == 0) {
-			captureIncomingBytes();
+			captureIncomingBytes(); // not needed when the I/O core is receiving
+#endif
 		}
 		int runCount = 0;
-		uint32 usecs = 0; // compute times only the first time they are needed
-		for (int t = 0; t < taskCount; t++) {
-			currentTaskIndex++;
-			if (currentTaskIndex >= taskCount) currentTaskIndex = 0;
-			Task *task = &tasks[currentTaskIndex];
-			if (unusedTask == task->status) {
-				continue;
-			} else if (running == task->status) {
-				runTask(task);
-				runCount++;
-				break;
-			} else if (waiting_micros == task->status) {
-				if (!usecs) usecs = microsecs(); // get usecs
-				if ((usecs - task->wakeTime) < RECENT) {
-					task->status = running;
-					runTask(task);
-					runCount++;
-					break;
-				}
-			}
+		uint32 usecs = 0; // compute times only when some task is waiting
+		if (wakeQueueCount) {
+			usecs = microsecs();
+			wakeDueTasks(usecs);
 		}
+		checkEventSources();
+		int i = nextTaskIndex(currentTaskIndex);
+		if (i >= 0) {
+			currentTaskIndex = i;
+			runTask(tasks[i]);
+			taskRan(tasks[i]);
+			runCount++;
+		}
+		#ifdef INCREMENTAL_GC
+			gcStep();
+		#endif
 		if (taskSleepMSecs) {
 			// if any task called taskSleep(), do VM background tasks sooner
 			taskSleepMSecs = 0;
@@ -1394,17 +2254,21 @@ void vmLoop() {
 		if (!runCount) { // no active tasks; consider taking a nap
 			if (!usecs) usecs = microsecs(); // get usecs
 			int sleepUSecs = 500;
-			for (int i = 0; i < taskCount; i++) {
-				Task *task = &tasks[i];
-				if (waiting_micros == task->status) {
-					int usecsUntilWake = (task->wakeTime - usecs) - 5; // leave 5 extra usecs
-					if ((usecsUntilWake > 0) && (usecsUntilWake < sleepUSecs)) {
-						sleepUSecs = usecsUntilWake;
-					}
-				}
+			int usecsUntilWake = usecsUntilNextWake(usecs) - 5; // leave 5 extra usecs
+			if ((usecsUntilWake >= 0) && (usecsUntilWake < sleepUSecs)) {
+				sleepUSecs = usecsUntilWake;
 			}
 			if (sleepUSecs > 5) usleep(sleepUSecs); // nap a while to relinquish the CPU
 		}
+#elif defined(ARDUINO_ARCH_ESP32) && defined(EVENT_WAKEUPS)
+		if (!runCount) { // no runnable tasks; block for a tick so the core can idle or light sleep
+			if (!usecs) usecs = microsecs(); // get usecs
+			int usecsUntilWake = usecsUntilNextWake(usecs);
+			if ((usecsUntilWake < 0) || (usecsUntilWake > (1000 * portTICK_PERIOD_MS) + 500)) {
+				vTaskDelay(1);
+				count = -1; // do VM background tasks (e.g. check for serial input) right away
+			}
+		}
 #endif
 	}
 }
@@ -1417,8 +2281,6 @@ void vmLoop() {
 
 #include <emscripten.h>
 
-#define CLOCK_MASK 0xFFFFFFFF
-
 int shouldYield = false;
 void EMSCRIPTEN_KEEPALIVE taskSleep(int msecs) { shouldYield = true; }
 
@@ -1434,36 +2296,22 @@ void interpretStep() {
 		// Run the next runnable task. Wake up any waiting tasks whose wakeup time has arrived.
 		int runCount = 0;
 		uint32 usecs = microsecs(); // get usecs
-		for (int t = 0; t < taskCount; t++) {
-			currentTaskIndex++;
-			if (currentTaskIndex >= taskCount) currentTaskIndex = 0;
-			Task *task = &tasks[currentTaskIndex];
-			if (unusedTask == task->status) {
-				continue;
-			} else if (running == task->status) {
-				runTask(task);
-				runCount++;
-				break;
-			} else if (waiting_micros == task->status) {
-				if (((usecs - task->wakeTime) & CLOCK_MASK) < RECENT) task->status = running;
-			}
-			if (running == task->status) {
-				runTask(task);
-				runCount++;
-				break;
-			}
+		wakeDueTasks(usecs);
+		int i = nextTaskIndex(currentTaskIndex);
+		if (i >= 0) {
+			currentTaskIndex = i;
+			runTask(tasks[i]);
+			runCount++;
 		}
+		#ifdef INCREMENTAL_GC
+			gcStep();
+		#endif
 		if (!runCount) { // no active tasks; consider taking a nap
 			usecs = microsecs(); // get usecs
 			int sleepUSecs = 100000;
-			for (int i = 0; i < taskCount; i++) {
-				Task *task = &tasks[i];
-				if (waiting_micros == task->status) {
-					int usecsUntilWake = (task->wakeTime - usecs) & CLOCK_MASK;
-					if ((usecsUntilWake > 0) && (usecsUntilWake < sleepUSecs)) {
-						sleepUSecs = usecsUntilWake;
-					}
-				}
+			int usecsUntilWake = usecsUntilNextWake(usecs);
+			if ((usecsUntilWake > 0) && (usecsUntilWake < sleepUSecs)) {
+				sleepUSecs = usecsUntilWake;
 			}
 			if (sleepUSecs > 2000) {
 				shouldYield = true;
@@ -1488,21 +2336,243 @@ void runTasksUntilDone() {
 			count = 100; // reduce to 30 when building on mbed to avoid serial errors
 		}
 		hasActiveTasks = false;
-		uint32 usecs = 0; // compute times only the first time they are needed
+		if (wakeQueueCount) {
+			uint32 usecs = microsecs();
+			wakeDueTasks(usecs);
+			hasActiveTasks = (usecsUntilNextWake(usecs) >= 0);
+		}
+		checkEventSources();
 		for (int t = 0; t < taskCount; t++) {
-			Task *task = &tasks[t];
+			Task *task = tasks[t];
 			if (running == task->status) {
 				runTask(task);
+				taskRan(task);
 				hasActiveTasks = true;
-				continue;
-			} else if (unusedTask == task->status) {
-				continue;
-			} else if (waiting_micros == task->status) {
-				if (!usecs) usecs = microsecs(); // get usecs
-				if ((usecs - task->wakeTime) < RECENT) task->status = running;
 			}
-			if (running == task->status) runTask(task);
-			hasActiveTasks = true;
 		}
+		#ifdef INCREMENTAL_GC
+			gcStep();
+		#endif
+	}
+}
+
+#if defined(FUSE_OPS) && defined(BENCHMARK)
+
+// Superinstruction Fusion Test
+
+// Test programs for fusionTest() that use globals 0 and 1. The first two have all four
+// fused instruction sequences and results that depend on the initial value of global 0.
+// The third stores a string literal that must be in the original chunk, not the fused copy.
+// OP16() makes negative arguments and 16-bit opcodes fit an int16 without overflow.
+
+#define OP16(opcode, arg) ((int16) (uint16) OP(opcode, arg))
+
+static const int16 fusionTestCode1[] = {
+	OP16(9, 1),				// initLocals 1
+	OP16(6, 0),				// pushGlobal 0 (loop start)
+	OP16(2, int2obj(50)),		// pushImmediate 50
+	OP16(61, 2),				// lessThan
+	OP16(25, 9),				// jmpFalse (loop end)
+	OP16(10, 0),				// pushLocal 0
+	OP16(2, int2obj(3)),		// pushImmediate 3
+	OP16(50, 2),				// add
+	OP16(11, 0),				// storeLocal 0
+	OP16(6, 0),				// pushGlobal 0
+	OP16(2, int2obj(1)),		// pushImmediate 1
+	OP16(50, 2),				// add
+	OP16(7, 0),				// storeGlobal 0
+	OP16(22, -13),			// jmp (loop start)
+	OP16(10, 0),				// pushLocal 0 (loop end)
+	OP16(7, 1),				// storeGlobal 1
+	OP16(0, 0),				// halt
+	OP16(127, 0),				// codeEnd
+};
+
+static const int16 fusionTestCode2[] = {
+	OP16(9, 1),				// initLocals 1
+	OP16(10, 0),				// pushLocal 0 (loop start)
+	OP16(2, int2obj(60)),		// pushImmediate 60
+	OP16(61, 2),				// lessThan
+	OP16(25, 9),				// jmpFalse (loop end)
+	OP16(10, 0),				// pushLocal 0
+	OP16(2, int2obj(7)),		// pushImmediate 7
+	OP16(50, 2),				// add
+	OP16(11, 0),				// storeLocal 0
+	OP16(6, 0),				// pushGlobal 0
+	OP16(2, int2obj(-2)),		// pushImmediate -2
+	OP16(50, 2),				// add
+	OP16(7, 0),				// storeGlobal 0
+	OP16(22, -13),			// jmp (loop start)
+	OP16(10, 0),				// pushLocal 0 (loop end)
+	OP16(7, 1),				// storeGlobal 1
+	OP16(0, 0),				// halt
+	OP16(127, 0),				// codeEnd
+};
+
+static const int16 fusionTestCode3[] = {
+	OP16(6, 0),				// pushGlobal 0
+	OP16(2, int2obj(1)),	// pushImmediate 1
+	OP16(50, 2),			// add
+	OP16(7, 0),				// storeGlobal 0
+	OP16(5, 0), 5,			// pushLiteral (the literal is 5 words after the offset word)
+	OP16(7, 1),				// storeGlobal 1
+	OP16(0, 0),				// halt
+	OP16(127, 0),			// codeEnd
+	0,						// padding
+	0, 0, 0, 0,				// string literal "ab" (filled in by fusionTest())
+};
+
+static const int16 fusionTestCode4[] = {
+	OP16(9, 2),				// initLocals 2
+	OP16(10, 1),				// pushLocal 1 (loop start)
+	OP16(5, 0), 23,			// pushLiteral "ab"
+	OP16(6, 0),				// pushGlobal 0
+	OP16(37, 3), (DataPrims << 10) | 24,	// reporterPrimitive data:join
+	OP16(11, 1),				// storeLocal 1
+	OP16(6, 1),				// pushGlobal 1
+	OP16(10, 0),				// pushLocal 0
+	OP16(37, 2), (DataPrims << 10) | 19,	// reporterPrimitive data:join
+	OP16(7, 1),				// storeGlobal 1
+	OP16(10, 0),				// pushLocal 0
+	OP16(2, int2obj(1)),		// pushImmediate 1
+	OP16(50, 2),				// add
+	OP16(11, 0),				// storeLocal 0
+	OP16(10, 0),				// pushLocal 0
+	OP16(2, int2obj(20)),		// pushImmediate 20
+	OP16(61, 2),				// lessThan
+	OP16(25, 1),				// jmpFalse (loop end)
+	OP16(22, -21),			// jmp (loop start)
+	OP16(10, 1),				// pushLocal 1 (loop end)
+	OP16(7, 0),				// storeGlobal 0
+	OP16(0, 0),				// halt
+	OP16(127, 0),				// codeEnd
+	0, 0, 0, 0,				// string literal "ab" (filled in by fusionTest())
+	0, 0, 0, 0, 0, 0,		// string literal "join" (filled in by fusionTest())
+};
+
+static void setFusionTestLiteral(OBJ literal, const char *s) {
+	int wordCount = (strlen(s) + 4) / 4;
+	literal[0] = HEADER(StringType, wordCount);
+	memset(&literal[1], 0, 4 * wordCount);
+	memcpy(&literal[1], s, strlen(s));
+}
+
+static int hasFusedOp(int chunkIndex, int fusedOp) {
+	// Return true if the fused copy of the given chunk contains the given fused opcode.
+
+	OBJ code = chunks[chunkIndex].code;
+	OBJ runCode = chunks[chunkIndex].runCode;
+	if (!runCode) return false;
+	int16 *start = (int16 *) (code + PERSISTENT_HEADER_WORDS);
+	for (int16 *ip = start; CODE_END != CMD(*ip); ip += instructionWords(ip)) {
+		int16 *fusedIP = (int16 *) (runCode + PERSISTENT_HEADER_WORDS) + (ip - start);
+		if (fusedOp == CMD(*fusedIP)) return true;
+	}
+	return false;
+}
+
+static int sameFusionTestResult(OBJ a, OBJ b) {
+	if (a == b) return true;
+	return IS_TYPE(a, StringType) && IS_TYPE(b, StringType) && (0 == strcmp(obj2str(a), obj2str(b)));
+}
+
+static void runFusionTestChunk(int chunkIndex, OBJ initialValue, OBJ *results) {
+	// Run the given chunk to completion with global 0 set to initialValue and record
+	// the resulting values of globals 0 and 1.
+
+	vars[0] = initialValue;
+	vars[1] = zeroObj;
+	startTaskForChunk(chunkIndex);
+	for (int i = 0; i < taskTableSize; i++) {
+		Task *task = tasks[i];
+		if ((chunkIndex == task->taskChunkIndex) && (running == task->status)) {
+			while (running == task->status) runTask(task);
+		}
+	}
+	results[0] = vars[0];
+	results[1] = vars[1];
+}
+
+void fusionTest() {
+	// Differential test of superinstruction fusion: run test programs with and without
+	// fusion for several initial values (including ones that make the fused instructions
+	// fall back to unfused execution) and check that the results are the same.
+
+	const int16 *programs[] = { fusionTestCode1, fusionTestCode2, fusionTestCode3, fusionTestCode4 };
+	const int programWords[] = {
+		sizeof(fusionTestCode1) / sizeof(int16),
+		sizeof(fusionTestCode2) / sizeof(int16),
+		sizeof(fusionTestCode3) / sizeof(int16),
+		sizeof(fusionTestCode4) / sizeof(int16) };
+	static int testChunk[PERSISTENT_HEADER_WORDS + (sizeof(fusionTestCode4) / 4)];
+	OBJ literal = (OBJ) &testChunk[PERSISTENT_HEADER_WORDS + 5]; // string in fusionTestCode3
+
+	int chunkIndex = 254; // highest chunk index that fits in a narrow record header
+	growChunkTable(chunkIndex);
+	while ((chunkIndex >= 0) &&
+		((chunkIndex >= chunkTableSize) || (unusedChunk != chunks[chunkIndex].chunkType))) {
+			chunkIndex--;
+	}
+	if (chunkIndex < 0) {
+		printf("fusionTest: no free chunk\n");
+		return;
+	}
+
+	// vars[2..4] keep the unfused results and the initial value safe from garbage collection
+	OBJ savedVars[5] = { vars[0], vars[1], vars[2], vars[3], vars[4] };
+	OBJ initialValues[] = { zeroObj, int2obj(-100), int2obj(49), int2obj(1000), trueObj, NULL };
+	int count = sizeof(initialValues) / sizeof(OBJ);
+	int failures = 0;
+
+	for (int p = 0; p < 4; p++) {
+		testChunk[0] = ('R' << 24) | (chunkCode << 16) | (chunkIndex << 8) | command;
+		testChunk[1] = programWords[p] / 2;
+		memcpy(&testChunk[PERSISTENT_HEADER_WORDS], programs[p], 2 * programWords[p]);
+		if (2 == p) setFusionTestLiteral(literal, "ab");
+		if (3 == p) { // literals of fusionTestCode4
+			setFusionTestLiteral((OBJ) &testChunk[PERSISTENT_HEADER_WORDS + 13], "ab");
+			setFusionTestLiteral((OBJ) &testChunk[PERSISTENT_HEADER_WORDS + 15], "join");
+		}
+		chunks[chunkIndex].code = testChunk;
+		chunks[chunkIndex].chunkType = command;
+
+		for (int i = 0; i < count; i++) {
+			vars[4] = initialValues[i];
+			if (!vars[4]) vars[4] = newStringFromBytes("7", 1);
+			OBJ fused[2];
+
+			releaseFusedChunk(chunkIndex);
+			runFusionTestChunk(chunkIndex, vars[4], &vars[2]);
+			fuseChunk(chunkIndex);
+			if (!chunks[chunkIndex].runCode) {
+				printf("fusionTest: nothing was fused\n");
+				failures++;
+			}
+			#ifdef STRING_BUILDERS
+				if ((3 == p) && !(hasFusedOp(chunkIndex, PUSH_LOCAL_BUILDER_FUSED) &&
+						hasFusedOp(chunkIndex, PUSH_GLOBAL_BUILDER_FUSED) && hasFusedOp(chunkIndex, APPEND_FUSED))) {
+					printf("fusionTest: joins were not fused\n");
+					failures++;
+				}
+			#endif
+			runFusionTestChunk(chunkIndex, vars[4], fused);
+
+			if (!sameFusionTestResult(vars[2], fused[0]) || !sameFusionTestResult(vars[3], fused[1])) {
+				printf("fusionTest: program %d case %d differs\n", p + 1, i + 1);
+				failures++;
+			}
+			if ((2 == p) && isInt(vars[4]) && (fused[1] != literal)) {
+				printf("fusionTest: literal is not in the original chunk\n");
+				failures++;
+			}
+		}
+		releaseFusedChunk(chunkIndex);
+		forgetPrimitivesInChunk(testChunk);
+		chunks[chunkIndex].code = NULL;
+		chunks[chunkIndex].chunkType = unusedChunk;
 	}
+	for (int i = 0; i < 5; i++) vars[i] = savedVars[i];
+	printf("%s\n", failures ? "fusionTest failed" : "fusionTest passed");
 }
+
+#endif // FUSE_OPS && BENCHMARK
@@ -40,6 +40,11 @@ extern OBJ vars[MAX_VARS];
 // newer versions of a chunk are appended to the end of Flash. At startup time, Flash memory
 // is scanned, and the chunks[] table is reconstructed with references to the latest version
 // of each chunk.
+//
+// When WIDE_CHUNKS is defined, chunk indices are 16 bits and the chunk table grows as
+// needed up to MAX_CHUNKS entries. Chunk index 255 is never used; it is reserved for
+// messages to the IDE that are not associated with a chunk. Chunks with indices above
+// 255 are sent and received using wide messages and stored using wide records.
 
 typedef enum {
 	unusedChunk = 0,
@@ -54,13 +59,75 @@ typedef enum {
 	buttonsAandBHat = 9,
 } ChunkType_t;
 
+// Superinstruction Fusion
+//
+// When FUSE_OPS is defined, common opcode sequences are rewritten into fused opcodes in a
+// RAM copy of the code chunk (runCode). The original code is kept for CRCs, sending code
+// to the IDE, and the code store. Fused instructions have the same length as the sequence
+// they replace, so instruction offsets (e.g. return addresses) are the same in both.
+// The copy holds only the instructions; literals and primitive names are always used from
+// the original code, so nothing outside the interpreter points into a copy that may be
+// freed. Copies use at most MAX_FUSED_CODE_BYTES of RAM; chunks beyond that run unfused.
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(GNUBLOCKS)
+	#define FUSE_OPS true
+	#define MAX_FUSED_CODE_BYTES (16 * 1024)
+#endif
+
 typedef struct {
 	OBJ code;
+#ifdef FUSE_OPS
+	OBJ runCode; // code with fused instructions, or NULL if not yet fused
+#endif
 	uint8 chunkType;
 } CodeChunkRecord;
 
-#define MAX_CHUNKS 255
-extern CodeChunkRecord chunks[MAX_CHUNKS];
+#if defined(ARDUINO_ARCH_ESP32) || defined(GNUBLOCKS)
+	#define WIDE_CHUNKS true
+#endif
+
+#ifdef WIDE_CHUNKS
+	#define MAX_CHUNKS 65535
+	extern CodeChunkRecord *chunks;
+#else
+	#define MAX_CHUNKS 255
+	extern CodeChunkRecord chunks[MAX_CHUNKS];
+#endif
+extern int chunkTableSize; // number of entries in chunks[]
+
+int growChunkTable(int chunkIndex);
+void clearChunkTable();
+
+// ORIGINAL_IP() maps an instruction address in the running task's code to the same
+// instruction in the original chunk, where literals and primitive call sites live.
+
+#ifdef FUSE_OPS
+	#define RUN_CODE(chunkIndex) (chunks[chunkIndex].runCode ? chunks[chunkIndex].runCode : chunks[chunkIndex].code)
+	#define ORIGINAL_IP(ip) ((int16 *) chunks[task->currentChunkIndex].code + ((ip) - (int16 *) task->code))
+#else
+	#define RUN_CODE(chunkIndex) (chunks[chunkIndex].code)
+	#define ORIGINAL_IP(ip) (ip)
+#endif
+
+void fuseChunk(int chunkIndex);
+void releaseFusedChunk(int chunkIndex);
+
+// Broadcast Receiver Index
+//
+// When BROADCAST_INDEX is defined, startReceiversOfBroadcast() looks up receivers in an index
+// from broadcast name to receiver chunks instead of checking every chunk. The index is rebuilt
+// on the next broadcast after clearBroadcastIndex(), which must be called whenever the chunk
+// table changes.
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(GNUBLOCKS)
+	#define BROADCAST_INDEX true
+#endif
+
+#ifdef BROADCAST_INDEX
+	void clearBroadcastIndex();
+#else
+	#define clearBroadcastIndex()
+#endif
 
 // Task List
 
@@ -69,8 +136,12 @@ extern CodeChunkRecord chunks[MAX_CHUNKS];
 // inside a call to user-defined function. It also holds the task status, processor
 // state (instruction pointer (ip), stack pointer (sp), and frame pointer (fp)),
 // and the wakeTime (used when a task is waiting on the microsecond clock).
-// In the current design, Tasks have a fixed-size stack built in. In the future,
-// this will become a reference to a growable stack object in memory.
+// The scheduler prefers higher priority tasks. A task with a period (in usecs) runs
+// once per period and counts the times it finishes an activation after its deadline.
+// When GROWABLE_STACKS is defined, the task stack is allocated with malloc() when the
+// task starts, doubles in size as needed up to MAX_STACK_WORDS, and is freed when the
+// task ends. Otherwise, each task has a fixed-size stack of STACK_LIMIT words built in.
+// The task table holds pointers to Tasks so that Tasks do not move when it grows.
 //
 // "When <condition>" hats have their condition test compiled into them. They
 // loop back and suspend themselves when the condition is false. When the condition
@@ -80,34 +151,115 @@ typedef enum {
 	unusedTask = 0, // task entry is available
 	waiting_micros = 1, // waiting for microseconds to reach wakeTime
 	running = 2,
+	waiting_event = 3, // waiting for an event that may change its wait condition (see below)
 } MicroBlocksTaskStatus_t;
 
-#ifdef GNUBLOCKS
-	#define STACK_LIMIT 10000 // Task size is 6 + STACK_LIMIT words
+// Event Wakeups
+//
+// When EVENT_WAKEUPS is defined, a task whose "wait until" or "when" condition is false is
+// parked (status waiting_event) instead of evaluating its condition on every pass of the
+// scheduler, provided that the condition reads only inputs that report their changes. While
+// a task runs, the event sources that it reads are collected in its eventMask. Reading
+// anything else (the clock, an analog pin, most primitives) adds EVENT_POLL, which keeps the
+// task polling; changing shared state adds EVENT_WRITES as well. A parked task runs again
+// when signalEvents() is called with one of the sources in its waitEvents or with EVENT_ALL,
+// which is signalled after a task run that includes EVENT_WRITES and when a message arrives
+// from the IDE, since either may change a variable.
+//
+// Interrupt handlers set bits in pendingEvents; the scheduler passes them to signalEvents().
+// Digital pins read by conditions and serial input are checked by the scheduler while
+// tasks are parked, since their interrupts may already be used by other primitives.
+// primDigitalRead() reports the pins it reads with watchPin(); the scheduler reads watched
+// pins with readWatchedPin(), which is platform specific. The button reporters record the
+// buttons they read with watchButton(); checkButtons() reads those buttons every few
+// milliseconds and signals EVENT_BUTTONS when one changes.
+
+#if (defined(ARDUINO_ARCH_ESP32) || defined(GNUBLOCKS)) && !defined(EMSCRIPTEN)
+	#define EVENT_WAKEUPS true
+#endif
+
+#define EVENT_PINS		1
+#define EVENT_BUTTONS	2
+#define EVENT_SERIAL	4
+#define EVENT_ENCODER	8
+#define EVENT_BROADCAST	16
+#define EVENT_WRITES	64 // changed a variable, list, or task that another task may be waiting on
+#define EVENT_POLL		128 // depends on something that does not report changes
+#define EVENT_ALL		255
+
+#define WATCH_BUTTON_A	1 // button bits for watchButton()
+#define WATCH_BUTTON_B	2
+
+#ifdef EVENT_WAKEUPS
+	extern volatile uint8 pendingEvents;
+	// atomic so that a bit set by an interrupt handler meanwhile is not lost
+	#define SIGNAL_PENDING_EVENT(events) __atomic_fetch_or(&pendingEvents, (events), __ATOMIC_RELAXED)
+	void noteEventSource(int events);
+	void signalEvents(int events);
+	void watchPin(int pinNum, int level);
+	void clearWatchedPins();
+	void watchButton(int button, int isDown);
+	int buttonsWatched();
+	int readWatchedPin(int pinNum);
+	int serialInputArrived();
+#else
+	#define noteEventSource(events)
+	#define signalEvents(events)
+#endif
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(GNUBLOCKS)
+	#define GROWABLE_STACKS true
+	#define INITIAL_STACK_WORDS 32 // must be a power of 2!
+#endif
+
+#if defined(GNUBLOCKS)
+	#define MAX_STACK_WORDS 100000
+#elif defined(ARDUINO_ARCH_ESP32)
+	#define MAX_STACK_WORDS 8192
 #elif (defined(NRF51) || defined(ESP8266) || defined(DUELink))
-	#define STACK_LIMIT 54 // Task size is 6 + STACK_LIMIT words
+	#define STACK_LIMIT 54 // Task size is 10 + STACK_LIMIT words
 #else
-	#define STACK_LIMIT 100 // Task size is 6 + STACK_LIMIT words
+	#define STACK_LIMIT 100 // Task size is 10 + STACK_LIMIT words
 #endif
 
 typedef struct {
 	uint8 status; // MicroBlocksTaskStatus_t, stored as a byte
-	uint8 taskChunkIndex; // chunk index of the top-level stack for this task
-	uint8 currentChunkIndex; // chunk index when inside a function
+	uint8 priority; // higher priority tasks run first (default: 0)
+	uint16 taskChunkIndex; // chunk index of the top-level stack for this task
+	uint16 currentChunkIndex; // chunk index when inside a function
+#ifdef EVENT_WAKEUPS
+	uint8 eventMask; // event sources read since the last wait condition test
+	uint8 waitEvents; // event sources that may change the condition of a parked task
+#endif
 	uint32 wakeTime;
+	uint32 period; // usecs; zero if not a periodic task
+	uint32 deadline; // end of the current period
+	uint32 deadlineMisses;
 	OBJ code;
 	int ip; // ip offset in code
 	int sp;
 	int fp;
+#ifdef GROWABLE_STACKS
+	int stackSize; // in words
+	OBJ *stack;
+#else
 	OBJ stack[STACK_LIMIT];
+#endif
 } Task;
 
 // Task list shared by interp.c and runtime.c
 
-#define MAX_TASKS 10
-extern Task tasks[MAX_TASKS];
+#ifdef GROWABLE_STACKS
+	#define MAX_TASKS 255 // the task table grows as needed
+#else
+	#define MAX_TASKS 10
+#endif
+extern Task **tasks; // table of taskTableSize Task pointers
+extern int taskTableSize;
 extern int taskCount;
 
+int growTaskTable();
+
 // Extra delay used to limit serial transmission speed
 
 extern int extraByteDelay;
@@ -209,6 +361,8 @@ extern int extraByteDelay;
 #define encoderNotStarted		53	// Encoder not started; pin may not support interrupts
 #define scriptTooLarge			54	// Script too large
 #define udpPortNotOpen			55	// UDP port not open
+#define needsDictionary			56	// Needs a dictionary
+#define badDictionaryKey		57	// Dictionary keys must be strings or integers
 #define sleepSignal				255	// Not a real error; used to make current task sleep
 
 // Runtime Operations
@@ -218,22 +372,30 @@ int failure();
 void initTasks(void);
 void startAll();
 void stopAllTasksButThis(Task *task);
+#ifdef GROWABLE_STACKS
+int growTaskStack(Task *task, int wordsNeeded);
+void freeTaskStack(Task *task);
+#endif
 void startReceiversOfBroadcast(char *msg, int byteCount);
 void processMessage(void);
 int hasOutputSpace(int byteCount);
 void logData(char *s);
 void outputString(const char *s);
-void sendTaskDone(uint8 chunkIndex);
-void sendTaskError(uint8 chunkIndex, uint8 errorCode, int where);
-void sendTaskReturnValue(uint8 chunkIndex, OBJ returnValue);
+void sendTaskDone(int chunkIndex);
+void sendTaskError(int chunkIndex, uint8 errorCode, int ipOffset, int whereChunkIndex);
+void sendTaskReturnValue(int chunkIndex, OBJ returnValue);
 void sendBroadcastToIDE(char *s, int len);
-int broadcastMatches(uint8 chunkIndex, char *msg, int byteCount);
-void sendSayForChunk(char *s, int len, uint8 chunkIndex);
+int broadcastMatches(int chunkIndex, char *msg, int byteCount);
+void sendSayForChunk(char *s, int len, int chunkIndex);
 void vmLoop(void);
+int usecsUntilNextWake(uint32 usecs);
 void interpretStep();
+void clearCalleeCache();
 void taskSleep(int msecs);
 void vmPanic(const char *s);
 int indexOfVarNamed(const char *varName);
+char * varNameAt(int varIndex);
+void updateVarNameIndex();
 void processFileMessage(int msgType, int dataSize, char *data);
 void waitAndSendMessage(int msgType, int chunkIndex, int dataSize, char *data);
 void suspendCodeFileUpdates();
@@ -258,11 +420,18 @@ static inline int evalInt(OBJ obj) {
 
 // Testing Support
 
-void startTaskForChunk(uint8 chunkIndex);
+void startTaskForChunk(int chunkIndex);
 void runTasksUntilDone(void);
 
+#ifdef BENCHMARK
+	extern uint32 opCount; // number of instructions dispatched
+#endif
+
 void interpTests1(void);
 void taskTest(void);
+#ifdef BENCHMARK
+	void fusionTest(void);
+#endif
 
 void compactCodeStore();
 void outputRecordHeaders();
@@ -278,6 +447,19 @@ void handleMicosecondClockWrap();
 int ideConnected();
 int recvBytes(uint8 *buf, int count);
 int sendBytes(uint8 *buf, int start, int end);
+
+#ifdef DUAL_CORE
+// IDE communication through the I/O core (dualCore.c)
+int dualCoreRecvBytes(uint8 *buf, int count);
+int dualCoreSendBytes(uint8 *buf, int start, int end);
+void startIOCore();
+void pauseIOCore();
+void resumeIOCore();
+void updateIDEConnection();
+#else
+#define pauseIOCore()
+#define resumeIOCore()
+#endif
 void captureIncomingBytes();
 void restartSerial();
 
@@ -315,11 +497,18 @@ OBJ primFillList(int argCount, OBJ *args);
 OBJ primAt(int argCount, OBJ *args);
 OBJ primAtPut(int argCount, OBJ *args);
 OBJ primLength(int argCount, OBJ *args);
+OBJ appendToStringBuilder(int argCount, OBJ *args);
 
 OBJ primHexToInt(int argCount, OBJ *args);
 
 OBJ primBroadcastToIDEOnly(int argCount, OBJ *args);
 
+OBJ primSetTaskPriority(int argCount, OBJ *args);
+OBJ primTaskPriority(int argCount, OBJ *args);
+OBJ primSetTaskPeriod(int argCount, OBJ *args);
+OBJ primWaitNextPeriod(int argCount, OBJ *args);
+OBJ primDeadlineMisses(int argCount, OBJ *args);
+
 OBJ primAnalogPins(OBJ *args);
 OBJ primDigitalPins(OBJ *args);
 OBJ primAnalogRead(int argCount, OBJ *args);
@@ -446,6 +635,36 @@ void addPrimitiveSet(PrimitiveSetIndex primSetIndex, const char *setName, int en
 OBJ doPrimitiveCall(PrimitiveSetIndex setIndex, const char *primName, int argCount, OBJ *args);
 void primsInit();
 
+#ifdef BYTE_SLICES
+	void prepareSliceArgs(PrimitiveFunction primFunc, int argCount, OBJ *args);
+#endif
+
+// Resolved Primitive Cache
+
+OBJ callPrimitiveAt(int16 *callSite, int argCount, OBJ *args);
+OBJ callPrimitive(PrimitiveFunction primFunc, int argCount, OBJ *args);
+void cachePrimitivesInChunk(int *chunkCode);
+void forgetPrimitivesInChunk(int *chunkCode);
+void clearPrimitiveCache();
+#ifdef BENCHMARK
+	void primCallBenchmark();
+#endif
+int16 *nextPrimitiveCallSite(int16 **ipPtr, int16 *end);
+
+// Profiler
+//
+// When PROFILER is defined, the IDE can turn profiling on and off at runtime and read
+// opcode counts, time per chunk, and time per named primitive (see runtime.c). It is off
+// by default since it adds a test to every instruction dispatch; build with -DPROFILER.
+
+#ifdef PROFILER
+extern int profiling;
+void profileOp(int cmd, int chunkIndex);
+void profileResume();
+void profileSample(int chunkIndex);
+uint32 currentCodeLocation();
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -1152,7 +1152,20 @@ static void initPins(void) {
 	#define HAS_INPUT_PULLDOWN true
 #endif
 
+// Watched Pins (see interp.c)
+
+#ifdef EVENT_WAKEUPS
+
+int readWatchedPin(int pinNum) {
+	return digitalRead(pinNum);
+}
+
+#endif
+
 void turnOffPins() {
+	#ifdef EVENT_WAKEUPS
+		clearWatchedPins();
+	#endif
 	for (int pin = 0; pin < TOTAL_PINS; pin++) {
 		int turnOffPin = ((OUTPUT == currentMode[pin]) || (INPUT_PULLUP == currentMode[pin]));
 		#if defined(HAS_INPUT_PULLDOWN)
@@ -1463,7 +1476,11 @@ OBJ primDigitalRead(int argCount, OBJ *args) {
 		if (7 == pinNum) mode = INPUT_PULLUP; // slide switch
 	#endif
 	SET_MODE(pinNum, mode);
-	return (HIGH == digitalRead(pinNum)) ? trueObj : falseObj;
+	int level = digitalRead(pinNum);
+	#ifdef EVENT_WAKEUPS
+		watchPin(pinNum, level);
+	#endif
+	return (HIGH == level) ? trueObj : falseObj;
 }
 
 void primDigitalWrite(OBJ *args) {
@@ -79,21 +79,203 @@
 #define OBJSTORE_WORDS ((OBJSTORE_BYTES / 4) + 4)
 
 #if defined(ARDUINO_ARCH_ESP32)
+	#include "esp_heap_caps.h"
+	#include "nvs.h"
+
 	static OBJ *objstore = NULL; // allocated from heap on ESP32
+	static int objstoreInPSRAM = false;
 #else
 	static OBJ objstore[OBJSTORE_WORDS];
 #endif
 
+static int storeWords = OBJSTORE_WORDS; // may be changed at boot time on ESP32
+
 static OBJ memStart = NULL;
 static OBJ memEnd = NULL;
 static OBJ freeChunk = NULL;
 
 OBJ tempGCRoot = NULL; // used during resizeObj() and primitives that allocate multiple objects
 
+int gcCount = 0;
+int gcCycleCount = 0;
+int gcMinorCount = 0;
+uint32 gcTotalUSecs = 0;
+uint32 gcMaxUSecs = 0;
+uint32 gcPauseHistogram[GC_PAUSE_BUCKETS];
+
 extern OBJ lastBroadcast; // an additional GC root
 
+// Incremental garbage collector state (see "Incremental Garbage Collector" below)
+
+#ifdef INCREMENTAL_GC
+
+#define GRAY_STACK_SIZE 256
+
+typedef enum {
+	gcIdlePhase = 0,
+	gcMarkPhase = 1,
+	gcSweepPhase = 2,
+} GCPhase_t;
+
+uint32 gcMaxPauseUSecs = 1000;
+int gcMarking = false; // true while marking; enables the write barrier
+
+static GCPhase_t gcPhase = gcIdlePhase;
+static OBJ grayStack[GRAY_STACK_SIZE];
+static int grayCount = 0;
+static int grayOverflow = false;
+static OBJ scanCursor = NULL; // next chunk to sweep or to rescan after a gray stack overflow
+static OBJ freeList = NULL; // free chunks found by the sweeper, linked through their first field
+static int freeListWords = 0;
+static int wordsAllocated = 0; // words allocated since the last cycle started
+
+#else
+
+uint32 gcMaxPauseUSecs = 0;
+
+#endif
+
+// Nursery state (see "Nursery" below)
+
+#ifdef GENERATIONAL_GC
+
+#define PSRAM_NURSERY_WORDS 4096 // nursery size limit when the object store is in PSRAM
+#define MAX_YOUNG_WORDS (nurseryWords / 8) // larger objects are allocated in the old space
+#define NURSERY_LOW_WORDS (nurseryWords / 4) // collect the nursery when free space is below this
+#define REMEMBERED_SET_SIZE 256
+#define REMEMBERED_FLAG 0x10000000 // header bit set on objects in the remembered set
+
+static int nurseryWords = OBJSTORE_WORDS / 8; // set by memInit()
+
+OBJ nurseryStart = NULL; // forwarding word of the first nursery chunk
+OBJ nurseryEnd = NULL;
+
+static OBJ nurseryFree = NULL; // the nursery free chunk; NULL if the nursery is disabled
+static OBJ rememberedSet[REMEMBERED_SET_SIZE]; // old objects that may refer to young ones
+static int rememberedCount = 0;
+static int rememberedOverflow = false;
+
+static void setupNursery();
+static void releaseNursery();
+static void forgetRememberedSet();
+
+#endif
+
+// String interning state (see "String Interning" below)
+
+#ifdef INTERN_STRINGS
+
+#define INTERN_TABLE_SIZE 32 // must be a power of 2!
+
+static OBJ internTable[INTERN_TABLE_SIZE];
+
+#endif
+
+// Slice table state (see "Byte Array Slices" below)
+
+#ifdef BYTE_SLICES
+
+static OBJ sliceTable[MAX_SLICES]; // weak references to the live slices
+int sliceCount = 0;
+
+static void updateSlices(OBJ (*survivor)(OBJ));
+
+#endif
+
+// Allocation record state (see "Allocation Sites" below)
+
+#ifdef PROFILER
+
+#define ALLOC_RECORDS 512
+
+typedef struct {
+	OBJ obj;
+	uint32 site;
+} AllocRecord;
+
+static AllocRecord *allocRecords = NULL; // allocated when the profiler starts
+static int allocRecordCount = 0;
+static uint32 allocRecordsMissed = 0;
+
+static void recordAllocation(OBJ obj);
+static void forgetAllocation(OBJ obj);
+static void forwardAllocationRecords();
+
+#endif
+
 // Initialization
 
+#if defined(ARDUINO_ARCH_ESP32)
+
+// On ESP32, the object store is allocated from the heap at boot time. Its size and whether
+// to allocate it in PSRAM are read from NVS (see setObjectStoreConfig()). If those settings
+// are missing or the allocation fails, a store of the default size is allocated.
+
+#define OBJSTORE_NVS_NAMESPACE "microblocks"
+#define MIN_OBJSTORE_KBYTES 4
+#define MAX_OBJSTORE_KBYTES 65536 // limited by the 24-bit word count in object headers
+
+static void allocateObjectStore() {
+	uint32 kBytes = 0;
+	uint8 usePSRAM = false;
+	nvs_handle_t handle;
+	if (ESP_OK == nvs_open(OBJSTORE_NVS_NAMESPACE, NVS_READONLY, &handle)) {
+		nvs_get_u32(handle, "storeKB", &kBytes);
+		nvs_get_u8(handle, "storePSRAM", &usePSRAM);
+		nvs_close(handle);
+	}
+	if (kBytes) {
+		if (kBytes < MIN_OBJSTORE_KBYTES) kBytes = MIN_OBJSTORE_KBYTES;
+		if (kBytes > MAX_OBJSTORE_KBYTES) kBytes = MAX_OBJSTORE_KBYTES;
+		storeWords = (1024 * kBytes) / 4;
+		if (usePSRAM && heap_caps_get_free_size(MALLOC_CAP_SPIRAM)) {
+			objstore = (OBJ *) heap_caps_malloc(4 * storeWords, MALLOC_CAP_SPIRAM);
+			objstoreInPSRAM = (objstore != NULL);
+		} else {
+			objstore = (OBJ *) heap_caps_malloc(4 * storeWords, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+		}
+	}
+	if (!objstore) { // use the default
+		storeWords = OBJSTORE_WORDS;
+		objstore = (OBJ *) malloc(4 * storeWords);
+	}
+	if (!objstore) vmPanic("ESP32 could not allocate objectstore");
+}
+
+#endif
+
+int setObjectStoreConfig(int kBytes, int usePSRAM) {
+	// Record the object store size in kilobytes and whether to allocate it in PSRAM.
+	// The settings take effect the next time the board starts; zero kBytes restores
+	// the default. Return false if the object store size is fixed on this board.
+
+	#if defined(ARDUINO_ARCH_ESP32)
+		nvs_handle_t handle;
+		if (kBytes < 0) kBytes = 0;
+		if (ESP_OK != nvs_open(OBJSTORE_NVS_NAMESPACE, NVS_READWRITE, &handle)) return false;
+		int ok =
+			(ESP_OK == nvs_set_u32(handle, "storeKB", kBytes)) &&
+			(ESP_OK == nvs_set_u8(handle, "storePSRAM", (usePSRAM != 0))) &&
+			(ESP_OK == nvs_commit(handle));
+		nvs_close(handle);
+		return ok;
+	#else
+		return false;
+	#endif
+}
+
+int objectStoreBytes() {
+	return 4 * storeWords;
+}
+
+int objectStoreInPSRAM() {
+	#if defined(ARDUINO_ARCH_ESP32)
+		return objstoreInPSRAM;
+	#else
+		return false;
+	#endif
+}
+
 void memInit() {
 	// verify 32-bit architecture
 	if (!(sizeof(int) == 4 && sizeof(int*) == 4 && sizeof(float) == 4)) {
@@ -101,18 +283,21 @@ void memInit() {
 	}
 
 	#if defined(ARDUINO_ARCH_ESP32)
-		
-	
-		//#include <esp_heap_caps.h>
-		//sodb
-		//objstore = (OBJ *) heap_caps_malloc(OBJSTORE_WORDS * 4, MALLOC_CAP_SPIRAM);
-		objstore = (OBJ *) malloc(4 * OBJSTORE_WORDS);
-		if (!objstore) vmPanic("ESP32 could not allocate objectstore");
+		allocateObjectStore();
+	#endif
+
+	#ifdef GENERATIONAL_GC
+		// PSRAM is accessed through a small cache, so the nursery is kept small enough
+		// for the young objects to stay in the cache when the object store is in PSRAM
+		nurseryWords = storeWords / 8;
+		if (objectStoreInPSRAM() && (nurseryWords > PSRAM_NURSERY_WORDS)) {
+			nurseryWords = PSRAM_NURSERY_WORDS;
+		}
 	#endif
 
 	// initialize object heap memory
 	memStart = (OBJ) objstore;
-	memEnd = (OBJ) (objstore + OBJSTORE_WORDS);
+	memEnd = (OBJ) (objstore + storeWords);
 	memClear();
 }
 
@@ -122,14 +307,42 @@ void memClear() {
 	// clear global variables
 	for (int i = 0; i < MAX_VARS; i++) vars[i] = zeroObj;
 	lastBroadcast = zeroObj;
+	#ifdef INTERN_STRINGS
+		memset(internTable, 0, sizeof(internTable));
+	#endif
+	#ifdef BYTE_SLICES
+		sliceCount = 0;
+	#endif
 
 	// zero objectstore memory (not essential)
 	memset(objstore, 0, sizeof(objstore));
 
 	// create the free chunk (prefixed by a forwarding word)
 	objstore[0] = (OBJ) 0; // forwarding word
-	objstore[1] = (OBJ) HEADER(FREE_CHUNK, OBJSTORE_WORDS - 2); // free chunk
+	objstore[1] = (OBJ) HEADER(FREE_CHUNK, storeWords - 2); // free chunk
 	freeChunk = (OBJ) &objstore[1];
+
+	#ifdef INCREMENTAL_GC
+		// discard any incremental collection in progress
+		gcPhase = gcIdlePhase;
+		gcMarking = false;
+		grayCount = 0;
+		grayOverflow = false;
+		scanCursor = NULL;
+		freeList = NULL;
+		freeListWords = 0;
+		wordsAllocated = 0;
+	#endif
+
+	#ifdef GENERATIONAL_GC
+		rememberedCount = 0;
+		rememberedOverflow = false;
+		setupNursery();
+	#endif
+
+	#ifdef PROFILER
+		allocRecordCount = 0;
+	#endif
 }
 
 int wordsFree() {
@@ -137,6 +350,11 @@ int wordsFree() {
 	return (result < 0) ? 0 : result;
 }
 
+int inObjectStore(OBJ obj) {
+	// Return true if obj is in the object store (i.e. may be moved or garbage collected).
+	return (memStart <= obj) && (obj < memEnd);
+}
+
 void vmPanic(const char *errorMessage) {
 	// Called when VM encounters a fatal error. Output the given message and loop forever.
 	// NOTE: This call never returns!
@@ -153,31 +371,124 @@ void applyForwarding();
 void clearForwardingFields();
 void gc();
 
+static void recordPause(uint32 usecs);
+
+#ifdef INCREMENTAL_GC
+static OBJ allocFromFreeList(int wordCount);
+static void shadeChildren(OBJ obj);
+static void abortCycle();
+#endif
+
 // Object Allocation
 
-OBJ newObj(int type, int wordCount, OBJ fill) {
-	// Allocate a new object of the given size.
+#ifdef INCREMENTAL_GC
+
+static inline int allocationMark(OBJ obj) {
+	// Return the forwarding field for an object newly allocated in the old space. Objects
+	// allocated during a collection cycle are born marked, except for those placed in the
+	// part of the object store that has already been swept.
+
+	return gcMarking || ((gcSweepPhase == gcPhase) && (obj >= scanCursor));
+}
+
+#endif
+
+static OBJ carve(OBJ *freePtr, int wordCount) {
+	// Allocate a chunk for an object with wordCount fields from the start of the free chunk
+	// *freePtr, which must be large enough, and update *freePtr to the remaining free chunk.
+
+	OBJ result = *freePtr;
+	int available = WORDS(result);
+	OBJ rest = result + wordCount + 2;
+	*(rest - 1) = 0; // clear the forwarding word of the remaining free chunk
+	*rest = HEADER(FREE_CHUNK, available - (wordCount + 2));
+	*freePtr = rest;
+	return result;
+}
+
+static OBJ initObj(OBJ result, int type, int wordCount, OBJ fill) {
+	// Initialize the header, forwarding word, and fields of a newly allocated object.
+
+	*(result - 1) = 0; // clear its forwarding word
+	#ifdef INCREMENTAL_GC
+		if (!IS_YOUNG(result)) {
+			*(result - 1) = allocationMark(result);
+			wordsAllocated += wordCount + 2;
+		}
+	#endif
+	*result = HEADER(type, wordCount); // set header word
+	OBJ *ptr = (OBJ *) result + 1;
+	OBJ *end = ptr + wordCount;
+	while (ptr < end) { *ptr++ = fill; }
+	#ifdef GENERATIONAL_GC
+		// a new old object may be initialized with references to young objects without a barrier
+		if ((type > BinaryObjectTypes) && !IS_YOUNG(result)) gcRemember(result);
+	#endif
+	#ifdef PROFILER
+		if (profiling) recordAllocation(result);
+	#endif
+	return result;
+}
+
+static OBJ newOldObj(int type, int wordCount, OBJ fill) {
+	// Allocate a new object of the given size in the old space.
 
 	// check available space
 	int available = WORDS(freeChunk);
 	if (available < (wordCount + 2)) {
+		#ifdef INCREMENTAL_GC
+			OBJ result = allocFromFreeList(wordCount);
+			if (result) return initObj(result, type, wordCount, fill);
+		#endif
 		gc();
 		available = WORDS(freeChunk); // retry after garbage collection
+		#ifdef GENERATIONAL_GC
+			if ((available < (wordCount + 2)) && nurseryFree) { // give the nursery space to the old space
+				releaseNursery();
+				available = WORDS(freeChunk);
+			}
+		#endif
 		if (available < (wordCount + 2)) return fail(insufficientMemoryError);
 	}
 
-	// allocate result and update freeChunk
-	OBJ result = (OBJ) freeChunk;
-	freeChunk += wordCount + 2;
-	*freeChunk = HEADER(FREE_CHUNK, available - (wordCount + 2));
+	return initObj(carve(&freeChunk, wordCount), type, wordCount, fill);
+}
 
-	// initialize and return the new object
-	*(result - 1) = 0; // clear its forwarding word
-	*result = HEADER(type, wordCount); // set header word
-	OBJ *ptr = (OBJ *) result + 1;
-	OBJ *end = ptr + wordCount;
-	while (ptr < end) { *ptr++ = fill; }
-	return result;
+OBJ newObj(int type, int wordCount, OBJ fill) {
+	// Allocate a new object of the given size.
+
+	#ifdef GENERATIONAL_GC
+		// allocate small objects in the nursery, if there is room
+		if (nurseryFree && (wordCount <= MAX_YOUNG_WORDS) && (WORDS(nurseryFree) >= (wordCount + 2))) {
+			return initObj(carve(&nurseryFree, wordCount), type, wordCount, fill);
+		}
+	#endif
+	return newOldObj(type, wordCount, fill);
+}
+
+static int growInPlace(OBJ obj, int wordCount) {
+	// If obj is immediately followed by the free chunk and the free chunk is large enough,
+	// grow obj to wordCount words without moving it and return true. This avoids the scan of
+	// the entire object store needed to forward references to a moved object.
+
+	OBJ *freePtr = &freeChunk;
+	#ifdef GENERATIONAL_GC
+		if (IS_YOUNG(obj)) freePtr = &nurseryFree;
+	#endif
+	int oldCount = WORDS(obj);
+	if ((obj + oldCount + 2) != *freePtr) return false; // obj is not followed by the free chunk
+	int growBy = wordCount - oldCount;
+	int available = WORDS(*freePtr);
+	if (available < (growBy + 2)) return false;
+
+	*freePtr += growBy;
+	*(*freePtr - 1) = 0; // clear the forwarding word of the free chunk
+	**freePtr = HEADER(FREE_CHUNK, available - growBy);
+	*obj = (*obj & 0xF0000000) | HEADER(TYPE(obj), wordCount); // keep the flag bits
+	OBJ *ptr = (OBJ *) obj + 1 + oldCount;
+	OBJ *end = (OBJ *) obj + 1 + wordCount;
+	while (ptr < end) { *ptr++ = zeroObj; }
+	return true;
 }
 
 OBJ resizeObj(OBJ oldObj, int wordCount) {
@@ -185,9 +496,14 @@ OBJ resizeObj(OBJ oldObj, int wordCount) {
 
 	if (isInt(oldObj)) return oldObj;
 	if ((oldObj < memStart) || (oldObj >= memEnd)) return oldObj; // object must be in object store
+	if ((wordCount > WORDS(oldObj)) && growInPlace(oldObj, wordCount)) return oldObj;
 
 	tempGCRoot = oldObj; // record oldObj in case newObj() triggers GC that moves it
-	OBJ result = newObj(TYPE(oldObj), wordCount, zeroObj);
+	// The old objects that refer to an old oldObj are not in the remembered set, so they must
+	// not be made to refer to a young copy; copy an old oldObj into the old space.
+	OBJ result = IS_YOUNG(oldObj) ?
+		newObj(TYPE(oldObj), wordCount, zeroObj) :
+		newOldObj(TYPE(oldObj), wordCount, zeroObj);
 	oldObj = tempGCRoot; // restore oldObj
 	tempGCRoot = NULL;
 	if (!result) return oldObj;
@@ -196,7 +512,16 @@ OBJ resizeObj(OBJ oldObj, int wordCount) {
 	if (wordCount < copyCount) copyCount = wordCount; // new size is smaller
 	memcpy(result + 1, oldObj + 1, 4 * copyCount); // copy from the old to the new body
 
-	clearForwardingFields();
+	#ifdef INCREMENTAL_GC
+		// result is born marked and will not be scanned, so shade the fields it copied
+		if (gcMarking) shadeChildren(oldObj);
+		if (gcIdlePhase == gcPhase) clearForwardingFields(); // otherwise, keep the marks
+	#else
+		clearForwardingFields();
+	#endif
+	#ifdef PROFILER
+		forgetAllocation(result); // keep the allocation site of oldObj
+	#endif
 	*(oldObj - 1) = (uint32) result; // point forwarding field of oldObj to result
 	applyForwarding();
 	*(oldObj - 1) = 0; // clear forwarding field
@@ -227,6 +552,72 @@ OBJ newStringFromBytes(const char *bytes, int byteCount) {
 	return result;
 }
 
+// String Interning
+//
+// internString() looks up short strings in a small hash table before allocating them, so
+// creating the same short string again and again (a broadcast name, a JSON key, a number
+// converted to a string) does not allocate. The table is direct mapped: a new string replaces
+// the one in its slot. Strings are immutable, so an interned string can be shared. The table
+// entries are garbage collection roots.
+
+#ifdef INTERN_STRINGS
+
+OBJ internString(const char *bytes, int byteCount) {
+	if (byteCount > INTERN_MAX_BYTES) return newStringFromBytes(bytes, byteCount);
+
+	uint32 hash = 2166136261U; // FNV-1a
+	for (int i = 0; i < byteCount; i++) hash = (hash ^ (uint8) bytes[i]) * 16777619U;
+	OBJ *slot = &internTable[hash & (INTERN_TABLE_SIZE - 1)];
+
+	if (*slot) {
+		char *s = (char *) &(*slot)[HEADER_WORDS];
+		if ((0 == strncmp(s, bytes, byteCount)) && (0 == s[byteCount])) return *slot;
+	}
+	OBJ result = newStringFromBytes(bytes, byteCount);
+	if (result) *slot = result;
+	return result;
+}
+
+#else
+
+OBJ internString(const char *bytes, int byteCount) {
+	return newStringFromBytes(bytes, byteCount);
+}
+
+#endif
+
+#ifdef STRING_BUILDERS
+
+OBJ stringBuilderFor(OBJ s, int byteCount) {
+	// Return a string builder holding the bytes of the string s with room for byteCount
+	// bytes plus a terminator. If s is a builder that is too small, grow it in place if
+	// possible. Otherwise, copy s into a new builder with twice the needed capacity, so
+	// a sequence of appends copies each byte a constant number of times on average.
+
+	int wordCount = ((byteCount + 1) + 3) / 4; // leave room for terminator byte
+	if (*s & BUILDER_FLAG) {
+		int oldCount = WORDS(s);
+		if (wordCount <= oldCount) return s;
+		if (growInPlace(s, 2 * wordCount)) {
+			memset(&FIELD(s, oldCount), 0, 4 * (WORDS(s) - oldCount)); // zero the new capacity
+			return s;
+		}
+	}
+
+	tempGCRoot = s; // record s in case newObj() triggers GC that moves it
+	OBJ result = newObj(StringType, 2 * wordCount, 0);
+	s = tempGCRoot; // restore s
+	tempGCRoot = NULL;
+	if (!result) return result;
+
+	char *src = obj2str(s);
+	memcpy(&FIELD(result, 0), src, strlen(src));
+	*result |= BUILDER_FLAG;
+	return result;
+}
+
+#endif
+
 char* obj2str(OBJ obj) {
 	if (isInt(obj)) return (char *) "<Integer>";
 	if (isBoolean(obj)) return (char *) ((trueObj == obj) ? "true" : "false");
@@ -236,6 +627,135 @@ char* obj2str(OBJ obj) {
 	return (char *) "<Object>";
 }
 
+// Byte Array Slices
+
+#ifdef BYTE_SLICES
+
+static OBJ copyBytes(OBJ src, int start, int byteCount) {
+	// Return a new byte array with byteCount bytes of src starting at the given offset.
+
+	tempGCRoot = src; // record src in case newObj() triggers GC that moves it
+	OBJ result = newObj(ByteArrayType, (byteCount + 3) / 4, falseObj);
+	src = tempGCRoot; // restore src
+	tempGCRoot = NULL;
+	if (!result) return result;
+
+	setByteCountAdjust(result, byteCount);
+	memcpy(&FIELD(result, 0), ((uint8 *) &FIELD(src, 0)) + start, byteCount);
+	return result;
+}
+
+OBJ newSlice(OBJ parent, int start, int byteCount) {
+	// Return a slice of byteCount bytes of the given byte array starting at the given offset.
+	// Return a copy of those bytes if the slice table is full.
+
+	if (sliceCount >= MAX_SLICES) return copyBytes(parent, start, byteCount);
+
+	tempGCRoot = parent; // record parent in case newObj() triggers GC that moves it
+	OBJ result = newObj(SliceType, 3, zeroObj);
+	parent = tempGCRoot; // restore parent
+	tempGCRoot = NULL;
+	if (!result) return result;
+
+	FIELD(result, 0) = parent;
+	FIELD(result, 1) = int2obj(start);
+	FIELD(result, 2) = int2obj(byteCount);
+	*parent |= SHARED_FLAG;
+	sliceTable[sliceCount++] = result;
+	return result;
+}
+
+static void forgetSlice(OBJ slice) {
+	for (int i = sliceCount - 1; i >= 0; i--) {
+		if (slice == sliceTable[i]) {
+			sliceTable[i] = sliceTable[--sliceCount];
+			return;
+		}
+	}
+}
+
+OBJ sliceOwnBytes(OBJ slice) {
+	// Return a byte array with the bytes of the given slice that is not shared with any other
+	// slice, copying the bytes if necessary. The slice refers to that byte array from then on
+	// and is no longer in the slice table, so the byte array is never marked as shared.
+
+	OBJ parent = SLICE_PARENT(slice);
+	int byteCount = SLICE_COUNT(slice);
+	if (!(*parent & SHARED_FLAG) && (0 == SLICE_START(slice)) && (byteCount == BYTES(parent))) {
+		return parent; // already has its own bytes
+	}
+
+	tempGCRoot = slice; // record slice in case newObj() triggers GC that moves it
+	OBJ result = newObj(ByteArrayType, (byteCount + 3) / 4, falseObj);
+	slice = tempGCRoot; // restore slice
+	tempGCRoot = NULL;
+	if (!result) return result;
+
+	setByteCountAdjust(result, byteCount);
+	memcpy(&FIELD(result, 0), SLICE_BYTES(slice), byteCount);
+	GC_WRITE_BARRIER(FIELD(slice, 0));
+	GC_STORE_BARRIER(slice, result);
+	FIELD(slice, 0) = result;
+	FIELD(slice, 1) = int2obj(0);
+	forgetSlice(slice);
+	return result;
+}
+
+int unshareBytes(OBJ *bytesPtr) {
+	// Prepare to modify the byte array at *bytesPtr: if slices refer to it, make a copy of its
+	// bytes and make those slices refer to the copy. Allocating the copy may trigger a garbage
+	// collection, so *bytesPtr is updated if the byte array moves; other OBJ variables held by
+	// the caller may be stale afterwards. Return false if there is not enough memory.
+
+	OBJ bytes = *bytesPtr;
+	if (!(*bytes & SHARED_FLAG)) return true;
+
+	tempGCRoot = bytes; // record bytes in case newObj() triggers GC that moves it
+	OBJ copy = newObj(ByteArrayType, WORDS(bytes), falseObj);
+	bytes = *bytesPtr = tempGCRoot; // restore bytes
+	tempGCRoot = NULL;
+	if (!copy) return false;
+
+	memcpy(&FIELD(copy, 0), &FIELD(bytes, 0), 4 * WORDS(bytes));
+	setByteCountAdjust(copy, BYTES(bytes));
+	*copy |= SHARED_FLAG;
+
+	for (int i = 0; i < sliceCount; i++) {
+		OBJ slice = sliceTable[i];
+		if (bytes == SLICE_PARENT(slice)) {
+			GC_WRITE_BARRIER(bytes);
+			GC_STORE_BARRIER(slice, copy);
+			FIELD(slice, 0) = copy;
+		}
+	}
+	*bytes &= ~SHARED_FLAG;
+	return true;
+}
+
+static void updateSlices(OBJ (*survivor)(OBJ)) {
+	// Called by the garbage collector. The survivor function returns the location of an object
+	// after collection or NULL if it is garbage. Drop the slices that are garbage, update the
+	// others, and set SHARED_FLAG only on the byte arrays that live slices still refer to.
+
+	for (int i = 0; i < sliceCount; i++) {
+		OBJ parent = survivor(SLICE_PARENT(sliceTable[i]));
+		if (parent) *parent &= ~SHARED_FLAG;
+	}
+	int i = 0;
+	while (i < sliceCount) {
+		OBJ slice = survivor(sliceTable[i]);
+		if (slice) {
+			OBJ parent = survivor(SLICE_PARENT(slice));
+			if (parent) *parent |= SHARED_FLAG;
+			sliceTable[i++] = slice;
+		} else {
+			sliceTable[i] = sliceTable[--sliceCount];
+		}
+	}
+}
+
+#endif
+
 // Debugging Utilities
 
 void reportNum(const char *msg, int n) {
@@ -276,7 +796,7 @@ void dumpObjectStore() {
 	char s[100];
 
 	outputString("Object store:");
-	uint32 *end = (uint32 *) &objstore[OBJSTORE_WORDS];
+	uint32 *end = (uint32 *) &objstore[storeWords];
 	uint32 *next = (uint32 *) objstore + 1;
 	uint32 *base = (uint32 *) objstore;
 	while (next < end) {
@@ -323,11 +843,16 @@ void memDumpObj(OBJ obj) {
 
 // Object Forwarding
 
+// A forwarding field holds zero, a mark (1) set by the garbage collector, or a pointer to
+// the new location of the object.
+
+#define IS_FORWARDED(obj) (*(((uint32 *) (obj)) - 1) > 1)
+
 void clearForwardingFields() {
 	// Set all forwarding fields to zero. This may not be needed if we maintain the invariant
 	// that forward fields are zero except during garbage collection or forwarding operations.
 
-	uint32 *end = (uint32 *) &objstore[OBJSTORE_WORDS];
+	uint32 *end = (uint32 *) &objstore[storeWords];
 	uint32 *next = (uint32 *) objstore + 1;
 	while (next < end) {
 		*(next - 1) = 0; // clear forwarding field
@@ -338,32 +863,42 @@ void clearForwardingFields() {
 static inline OBJ forward(OBJ obj) {
 	if (isInt(obj)) return obj;
 	if ((obj < memStart) || (obj > memEnd)) return obj; // outside the object store
-	OBJ fwd = (OBJ) *(obj - 1);
-	return fwd ? fwd : obj; // forward if the forwarding field is not zero
+	return IS_FORWARDED(obj) ? (OBJ) *(obj - 1) : obj;
 }
 
-static void forwardRoots(void) {
+static void forwardRoots(OBJ (*forwardFunc)(OBJ)) {
 	// forward global variables
-	for (int i = 0; i < MAX_VARS; i++) vars[i] = forward(vars[i]);
-	lastBroadcast = forward(lastBroadcast);
+	for (int i = 0; i < MAX_VARS; i++) vars[i] = forwardFunc(vars[i]);
+	lastBroadcast = forwardFunc(lastBroadcast);
 
-	if (tempGCRoot) tempGCRoot = forward(tempGCRoot);
+	#ifdef INTERN_STRINGS
+		for (int i = 0; i < INTERN_TABLE_SIZE; i++) internTable[i] = forwardFunc(internTable[i]);
+	#endif
+
+	if (tempGCRoot) tempGCRoot = forwardFunc(tempGCRoot);
 
 	// forward objects on Task stacks
 	for (int i = 0; i < taskCount; i++) {
-		Task *task = &tasks[i];
+		Task *task = tasks[i];
 		if (task->status != unusedTask) {
-			for (int j = tasks[i].sp - 1; j >= 0; j--) {
-				task->stack[j] = forward(task->stack[j]);
+			for (int j = task->sp - 1; j >= 0; j--) {
+				task->stack[j] = forwardFunc(task->stack[j]);
 			}
 		}
 	}
+
+	#ifdef GENERATIONAL_GC
+		// forward the remembered set (an object in it may be replaced by resizeObj())
+		for (int i = 0; i < rememberedCount; i++) {
+			rememberedSet[i] = forwardFunc(rememberedSet[i]);
+		}
+	#endif
 }
 
 void applyForwarding() {
 	// Update all forwarded references.
 
-	uint32 *end = (uint32 *) &objstore[OBJSTORE_WORDS];
+	uint32 *end = (uint32 *) &objstore[storeWords];
 	uint32 *next = (uint32 *) objstore + 1;
 	while (next < end) {
 		if (TYPE(next) > BinaryObjectTypes) { // non-free chunk with OBJ fields (not a string)
@@ -371,14 +906,20 @@ void applyForwarding() {
 				OBJ child = (OBJ) next[i];
 				if (!isInt(child) && // child is not an integer
 					((memStart < child) && (child <= memEnd)) && // child is in the object store
-					*(child - 1)) { // child has a non-zero forwarding field
+					IS_FORWARDED(child)) { // child has a forwarding pointer
 						next[i] = *(child - 1); // update the forwarded OBJ
 				}
 			}
 		}
 		next += WORDS(next) + 2;
 	}
-	forwardRoots();
+	forwardRoots(forward);
+	#ifdef PROFILER
+		forwardAllocationRecords();
+	#endif
+	#ifdef BYTE_SLICES
+		for (int i = 0; i < sliceCount; i++) sliceTable[i] = forward(sliceTable[i]);
+	#endif
 }
 
 // Mark-Sweep-Compact Garbage Collector
@@ -386,6 +927,15 @@ void applyForwarding() {
 #define SET_MARK(obj) ((*(((uint32 *) (obj)) - 1)) = 1)
 #define IS_MARKED(obj) (*(((uint32 *) (obj)) - 1))
 
+#ifdef BYTE_SLICES
+
+static OBJ markedOrNull(OBJ obj) {
+	// Slice survivor function for gc(), called before sweep().
+	return IS_MARKED(obj) ? obj : NULL;
+}
+
+#endif
+
 void mark(OBJ root) {
 	// Mark all objects reachable from the given root.
 
@@ -429,20 +979,24 @@ void mark(OBJ root) {
 	}
 }
 
-static void markRoots(void) {
+static void markRoots(void (*markFunc)(OBJ)) {
 	// mark global variables
-	for (int i = 0; i < MAX_VARS; i++) mark(vars[i]);
-	mark(lastBroadcast);
+	for (int i = 0; i < MAX_VARS; i++) markFunc(vars[i]);
+	markFunc(lastBroadcast);
+
+	#ifdef INTERN_STRINGS
+		for (int i = 0; i < INTERN_TABLE_SIZE; i++) markFunc(internTable[i]);
+	#endif
 
 	// mark temporary object used during object resizing
-	if (tempGCRoot) mark(tempGCRoot);
+	if (tempGCRoot) markFunc(tempGCRoot);
 
 	// mark objects on Task stacks
 	for (int i = 0; i < taskCount; i++) {
-		Task *task = &tasks[i];
+		Task *task = tasks[i];
 		if (task->status != unusedTask) {
-			for (int j = tasks[i].sp - 1; j >= 0; j--) {
-				mark(task->stack[j]);
+			for (int j = task->sp - 1; j >= 0; j--) {
+				markFunc(task->stack[j]);
 			}
 		}
 	}
@@ -451,7 +1005,7 @@ static void markRoots(void) {
 void sweep() {
 	// Scan object memory and set the forwarding fields of surviving objects that will move.
 
-	uint32 *end = (uint32 *) &objstore[OBJSTORE_WORDS];
+	uint32 *end = (uint32 *) &objstore[storeWords];
 	uint32 *next = (uint32 *) objstore + 1;
 	uint32 *dst = next;
 	while (next < end) {
@@ -472,7 +1026,7 @@ void compact() {
 	// Consolidate free space into a single free chunk.
 
 	uint32 *next = (uint32 *) objstore + 1;
-	uint32 *end = (uint32 *) &objstore[OBJSTORE_WORDS];
+	uint32 *end = (uint32 *) &objstore[storeWords];
 	uint32 *dst = next;
 	while (next < end) {
 		uint32 wordCount = WORDS(next);
@@ -497,18 +1051,597 @@ void gc() {
 
 	uint32 usecs = microsecs();
 
+	#ifdef INCREMENTAL_GC
+		abortCycle(); // clears the marks of an incremental cycle in progress
+	#endif
+	#ifdef GENERATIONAL_GC
+		forgetRememberedSet(); // young objects are collected along with old ones
+	#endif
+
 	// assume: forwarding pointers cleared at end of compaction so no need to clear them here
-	markRoots();
+	markRoots(mark);
+	#ifdef BYTE_SLICES
+		updateSlices(markedOrNull); // applyForwarding() forwards the surviving slices
+	#endif
 	sweep();
 	applyForwarding();
 	compact();
 
-	usecs = microsecs() - usecs;
+	#ifdef INCREMENTAL_GC
+		freeList = NULL; // compaction merged all free chunks into the final free chunk
+		freeListWords = 0;
+		wordsAllocated = 0;
+	#endif
+	#ifdef GENERATIONAL_GC
+		// Leave the nursery empty until gcStep(). A primitive that triggered this gc() may
+		// hold an object that is now old and store new objects into it without a barrier,
+		// so the rest of its allocations must be old, too.
+		releaseNursery();
+	#endif
 
-	char s[100];
-	sprintf(s, "GC took %d usecs; free %d words", usecs, WORDS(freeChunk) - 2);
-	outputString(s);
+	usecs = microsecs() - usecs;
+	gcCount++;
+	recordPause(usecs);
 
 	captureIncomingBytes();
 	updateMicrobitDisplay();
 }
+
+// Pause Statistics
+
+static void recordPause(uint32 usecs) {
+	// Add a garbage collection pause to the statistics.
+
+	int i = 0;
+	while ((i < (GC_PAUSE_BUCKETS - 1)) && (usecs >= (32U << i))) i++;
+	gcPauseHistogram[i]++;
+	gcTotalUSecs += usecs;
+	if (usecs > gcMaxUSecs) gcMaxUSecs = usecs;
+}
+
+void clearGCStats() {
+	gcCount = 0;
+	gcCycleCount = 0;
+	gcMinorCount = 0;
+	gcTotalUSecs = 0;
+	gcMaxUSecs = 0;
+	memset(gcPauseHistogram, 0, sizeof(gcPauseHistogram));
+}
+
+// Allocation Sites
+//
+// While the profiler is running, initObj() records the code location that allocated each new
+// object, until the record table is full. The records are weak references: they are updated
+// when objects move and dropped when objects are reclaimed, so the records that remain describe
+// live objects. Totaling them by site shows which scripts are filling memory.
+
+#ifdef PROFILER
+
+void startAllocationRecording() {
+	// Discard the allocation records and start recording anew. Called when profiling starts.
+
+	if (!allocRecords) allocRecords = (AllocRecord *) malloc(ALLOC_RECORDS * sizeof(AllocRecord));
+	allocRecordCount = 0;
+	allocRecordsMissed = 0;
+}
+
+static void recordAllocation(OBJ obj) {
+	if (!allocRecords) return;
+	if (allocRecordCount >= ALLOC_RECORDS) {
+		allocRecordsMissed++;
+		return;
+	}
+	allocRecords[allocRecordCount].obj = obj;
+	allocRecords[allocRecordCount].site = currentCodeLocation();
+	allocRecordCount++;
+}
+
+static inline void dropAllocationRecord(int i) {
+	allocRecords[i] = allocRecords[--allocRecordCount];
+}
+
+static void forgetAllocation(OBJ obj) {
+	for (int i = allocRecordCount - 1; i >= 0; i--) {
+		if (obj == allocRecords[i].obj) {
+			dropAllocationRecord(i);
+			return;
+		}
+	}
+}
+
+static uint32 allocationSite(OBJ obj) {
+	for (int i = 0; i < allocRecordCount; i++) {
+		if (obj == allocRecords[i].obj) return allocRecords[i].site;
+	}
+	return UNKNOWN_ALLOC_SITE;
+}
+
+static void forwardAllocationRecords() {
+	// Called by applyForwarding(). Drop the records of objects that gc() has found to be
+	// garbage (sweep() turned them into free chunks) and forward the others.
+
+	int i = 0;
+	while (i < allocRecordCount) {
+		OBJ obj = allocRecords[i].obj;
+		if (FREE_CHUNK == TYPE(obj)) {
+			dropAllocationRecord(i);
+		} else {
+			allocRecords[i++].obj = forward(obj);
+		}
+	}
+}
+
+#ifdef GENERATIONAL_GC
+
+static void promoteAllocationRecords() {
+	// Called by collectNursery(). Young objects with a forwarding pointer were promoted;
+	// the others are garbage.
+
+	int i = 0;
+	while (i < allocRecordCount) {
+		OBJ obj = allocRecords[i].obj;
+		if (!IS_YOUNG(obj)) {
+			i++;
+		} else if (IS_FORWARDED(obj)) {
+			allocRecords[i++].obj = (OBJ) *(obj - 1);
+		} else {
+			dropAllocationRecord(i);
+		}
+	}
+}
+
+#endif
+
+#ifdef INCREMENTAL_GC
+
+static void sweepAllocationRecords() {
+	// Called when marking is done. Drop the records of the unmarked old objects that the
+	// sweeper will reclaim. Young objects are not marked; the nursery is not swept.
+
+	int i = 0;
+	while (i < allocRecordCount) {
+		OBJ obj = allocRecords[i].obj;
+		if (!IS_YOUNG(obj) && !IS_MARKED(obj)) {
+			dropAllocationRecord(i);
+		} else {
+			i++;
+		}
+	}
+}
+
+#endif
+
+static void censusSites(HeapCensus *census) {
+	// Total the allocation records by site and keep the sites with the most words.
+	// The records are sorted by site (insertion sort; the table is small).
+
+	for (int i = 1; i < allocRecordCount; i++) {
+		AllocRecord rec = allocRecords[i];
+		int j = i - 1;
+		while ((j >= 0) && (allocRecords[j].site > rec.site)) {
+			allocRecords[j + 1] = allocRecords[j];
+			j--;
+		}
+		allocRecords[j + 1] = rec;
+	}
+	int i = 0;
+	while (i < allocRecordCount) {
+		AllocSiteTotal total = { allocRecords[i].site, 0, 0 };
+		while ((i < allocRecordCount) && (allocRecords[i].site == total.site)) {
+			total.count++;
+			total.words += WORDS(allocRecords[i].obj) + 2;
+			i++;
+		}
+		int j = census->siteCount;
+		if (j < CENSUS_SITES) census->siteCount++;
+		else if (total.words <= census->sites[--j].words) continue; // not in the top sites
+		while ((j > 0) && (census->sites[j - 1].words < total.words)) {
+			census->sites[j] = census->sites[j - 1];
+			j--;
+		}
+		census->sites[j] = total;
+	}
+	census->unrecordedCount = allocRecordsMissed;
+}
+
+#endif // PROFILER
+
+// Heap Census
+
+void heapCensus(HeapCensus *census) {
+	memset(census, 0, sizeof(HeapCensus));
+	uint32 *end = (uint32 *) &objstore[storeWords];
+	uint32 *next = (uint32 *) objstore + 1;
+	while (next < end) {
+		int type = TYPE(next);
+		uint32 wordCount = WORDS(next);
+		census->count[type]++;
+		census->words[type] += wordCount + 2;
+		if (FREE_CHUNK == type) {
+			if (wordCount > census->largestFreeWords) census->largestFreeWords = wordCount;
+		} else if (!census->largest[CENSUS_LARGEST - 1] ||
+			(wordCount > WORDS(census->largest[CENSUS_LARGEST - 1]))) {
+				// insert into the list of largest objects
+				int i = CENSUS_LARGEST - 1;
+				while ((i > 0) && (!census->largest[i - 1] || (WORDS(census->largest[i - 1]) < wordCount))) {
+					census->largest[i] = census->largest[i - 1];
+					i--;
+				}
+				census->largest[i] = (OBJ) next;
+		}
+		next += wordCount + 2;
+	}
+	for (int i = 0; i < CENSUS_LARGEST; i++) {
+		census->largestSite[i] = UNKNOWN_ALLOC_SITE;
+		#ifdef PROFILER
+			if (census->largest[i]) census->largestSite[i] = allocationSite(census->largest[i]);
+		#endif
+	}
+	#ifdef PROFILER
+		censusSites(census);
+	#endif
+}
+
+// Nursery
+//
+// When GENERATIONAL_GC is defined, the last eighth of the object store forms a nursery
+// in which small objects are allocated. Most objects die young, so gcStep() collects the
+// nursery on its own when it is nearly full: the young objects reachable from the roots or
+// from the remembered set are copied ("promoted") to the old space, then the whole nursery
+// is free again. The cost is proportional to the surviving young objects, the roots, and the
+// remembered set, not to the size of the object store. The remembered set holds old objects
+// that may refer to young ones; GC_STORE_BARRIER() adds objects that are stored into, and
+// newly allocated old objects with pointer fields are added when they are created.
+//
+// The nursery is formatted as chunks like the rest of the object store, so gc() collects it
+// along with the old space, compacting the surviving young objects into the old space.
+// The nursery is only collected between task runs, never while a primitive is running. When it
+// fills up before then, objects are allocated in the old space. gc() empties the nursery and
+// gcStep() sets it up again between task runs, since gc() clears the remembered set while a
+// primitive may still be storing young objects into a container that gc() made old.
+
+#ifdef GENERATIONAL_GC
+
+static void setupNursery() {
+	// Split the final free chunk so that the end of the object store becomes the nursery.
+	// If there is not enough free space, the nursery stays disabled.
+
+	OBJ base = memEnd - nurseryWords; // forwarding word of the nursery free chunk
+	if ((freeChunk + nurseryWords) > base) {
+		nurseryStart = nurseryEnd = memEnd;
+		nurseryFree = NULL;
+		return;
+	}
+	*freeChunk = HEADER(FREE_CHUNK, (base - freeChunk) - 1);
+	*base = 0; // forwarding word
+	nurseryFree = base + 1;
+	*nurseryFree = HEADER(FREE_CHUNK, nurseryWords - 2);
+	nurseryStart = base;
+	nurseryEnd = memEnd;
+}
+
+static void releaseNursery() {
+	// Merge the empty nursery into the final free chunk of the old space.
+
+	*freeChunk = HEADER(FREE_CHUNK, (memEnd - freeChunk) - 1);
+	nurseryStart = nurseryEnd = memEnd;
+	nurseryFree = NULL;
+}
+
+void gcRemember(OBJ obj) {
+	// Add an old object that may refer to young objects to the remembered set.
+
+	if (*obj & REMEMBERED_FLAG) return; // already in the remembered set
+	if (rememberedCount >= REMEMBERED_SET_SIZE) {
+		rememberedOverflow = true; // the next nursery collection will be a full gc()
+		return;
+	}
+	*obj |= REMEMBERED_FLAG;
+	rememberedSet[rememberedCount++] = obj;
+}
+
+static void forgetRememberedSet() {
+	for (int i = 0; i < rememberedCount; i++) *rememberedSet[i] &= ~REMEMBERED_FLAG;
+	rememberedCount = 0;
+	rememberedOverflow = false;
+}
+
+static OBJ promote(OBJ obj) {
+	// Return the old space copy of a young object, copying it if necessary. The forwarding
+	// field of a young object points to its copy once it has been promoted.
+
+	if (!IS_YOUNG(obj)) return obj;
+	if (*(obj - 1)) return (OBJ) *(obj - 1); // already promoted
+
+	int wordCount = WORDS(obj);
+	OBJ result = carve(&freeChunk, wordCount);
+	memcpy(result, obj, 4 * (wordCount + 1)); // copy header and fields
+	#ifdef INCREMENTAL_GC
+		*(result - 1) = allocationMark(result);
+		wordsAllocated += wordCount + 2;
+	#endif
+	*(obj - 1) = (int) result;
+	return result;
+}
+
+static void promoteFields(OBJ obj) {
+	if (TYPE(obj) <= BinaryObjectTypes) return; // free chunk or no pointer fields
+	for (int i = WORDS(obj); i > 0; i--) obj[i] = (int) promote((OBJ) obj[i]);
+}
+
+#ifdef BYTE_SLICES
+
+static OBJ promotedOrNull(OBJ obj) {
+	// Slice survivor function for collectNursery(). Young objects with a forwarding pointer
+	// were promoted; the others are garbage.
+
+	if (!IS_YOUNG(obj)) return obj;
+	return IS_FORWARDED(obj) ? (OBJ) *(obj - 1) : NULL;
+}
+
+#endif
+
+static int collectNursery() {
+	// Promote the live young objects and empty the nursery. Promoted objects are copied to the
+	// start of the final free chunk, then scanned in order to promote the young objects they
+	// refer to. If there might not be room to promote every young object, or if the remembered
+	// set overflowed, do a full gc() instead and return false.
+
+	if (!nurseryFree) return true; // nursery is disabled
+	int usedWords = nurseryFree - (nurseryStart + 1);
+	if (!usedWords) return true; // nursery is empty
+	if (rememberedOverflow || (WORDS(freeChunk) < usedWords)) {
+		gc();
+		return false;
+	}
+
+	uint32 usecs = microsecs();
+	OBJ scan = freeChunk;
+	forwardRoots(promote);
+	for (int i = 0; i < rememberedCount; i++) {
+		OBJ obj = rememberedSet[i];
+		*obj &= ~REMEMBERED_FLAG;
+		promoteFields(obj);
+	}
+	rememberedCount = 0;
+	while (scan < freeChunk) {
+		promoteFields(scan);
+		scan += WORDS(scan) + 2;
+	}
+
+	#ifdef PROFILER
+		promoteAllocationRecords();
+	#endif
+	#ifdef BYTE_SLICES
+		updateSlices(promotedOrNull);
+	#endif
+
+	// empty the nursery
+	nurseryFree = nurseryStart + 1;
+	*nurseryFree = HEADER(FREE_CHUNK, nurseryWords - 2);
+
+	gcMinorCount++;
+	recordPause(microsecs() - usecs);
+	return true;
+}
+
+#endif // GENERATIONAL_GC
+
+// Incremental Garbage Collector
+//
+// The incremental collector reclaims garbage in steps of at most gcMaxPauseUSecs, run by
+// gcStep() between task runs, rather than in one stop-the-world pause. A cycle starts when
+// free space runs low. It shades the roots (global variables and task stacks), then marks
+// objects reachable from them using a stack of "gray" objects, objects that are marked but
+// whose fields have not yet been scanned. Once marking is done, the sweeper turns unmarked
+// objects into free chunks, merging adjacent ones, and links them into a free list that
+// newObj() uses when the final free chunk is too small. Objects never move, so no forwarding
+// is needed, but free space can fragment. When an allocation does not fit anywhere, gc()
+// abandons the cycle and does a full collection that compacts memory.
+//
+// Marking preserves a snapshot of the object graph taken at the start of the cycle: the write
+// barrier shades the old value of an object field before it is overwritten, and objects
+// allocated during marking are born marked. Storing into global variables or task stacks
+// needs no barrier since those are roots that were all shaded when the cycle started.
+
+#ifdef INCREMENTAL_GC
+
+#define TIME_UP(deadline) (((int) (microsecs() - (deadline))) >= 0)
+
+// Start a cycle when the free space drops below a quarter of the object store,
+// but only if at least an eighth of the object store was allocated since the last one.
+#define CYCLE_START_FREE_WORDS (storeWords / 4)
+#define CYCLE_MIN_ALLOCATION (storeWords / 8)
+
+void gcShade(OBJ obj) {
+	// If obj is an unmarked object in the object store, mark it. If it has pointer fields,
+	// push it on the gray stack to be scanned. If the gray stack is full, note the overflow;
+	// the object store will be rescanned for marked objects with unmarked children.
+
+	if (isInt(obj) || (obj < memStart) || (obj >= memEnd) || IS_MARKED(obj)) return;
+	if (IS_YOUNG(obj)) return; // young objects are collected by collectNursery()
+	SET_MARK(obj);
+	if (TYPE(obj) <= BinaryObjectTypes) return;
+	if (grayCount < GRAY_STACK_SIZE) {
+		grayStack[grayCount++] = obj;
+	} else {
+		grayOverflow = true;
+	}
+}
+
+static void shadeChildren(OBJ obj) {
+	if (TYPE(obj) <= BinaryObjectTypes) return; // free chunk or no pointer fields
+	for (int i = WORDS(obj); i > 0; i--) gcShade((OBJ) obj[i]);
+}
+
+static void addFreeChunk(OBJ chunk) {
+	// Add a free chunk to the free list. A chunk with no fields has no room for the link,
+	// so it is not added; it will be merged with its neighbors by the next sweep or gc().
+
+	if (WORDS(chunk) == 0) return;
+	chunk[1] = (int) freeList;
+	freeList = chunk;
+	freeListWords += WORDS(chunk);
+}
+
+static OBJ allocFromFreeList(int wordCount) {
+	// Remove and return the first free chunk with room for an object with wordCount fields,
+	// or NULL if there is none. The unused part of the chunk, if any, becomes a free chunk.
+
+	OBJ *link = &freeList;
+	for (OBJ chunk = freeList; chunk; link = (OBJ *) &chunk[1], chunk = (OBJ) chunk[1]) {
+		int available = WORDS(chunk);
+		if ((available != wordCount) && (available < (wordCount + 2))) continue; // too small
+		*link = (OBJ) chunk[1]; // unlink chunk
+		freeListWords -= available;
+		if (available > wordCount) { // split off the unused part
+			OBJ rest = chunk + wordCount + 2;
+			*(rest - 1) = 0; // forwarding word
+			*rest = HEADER(FREE_CHUNK, available - (wordCount + 2));
+			addFreeChunk(rest);
+		}
+		return chunk;
+	}
+	return NULL;
+}
+
+static void startCycle() {
+	#ifdef GENERATIONAL_GC
+		// empty the nursery so that only the roots refer to old objects
+		if (!collectNursery()) return; // did a full collection instead
+	#endif
+	gcPhase = gcMarkPhase;
+	gcMarking = true;
+	wordsAllocated = 0;
+	markRoots(gcShade);
+}
+
+static int markStep(uint32 deadline) {
+	// Scan gray objects until none remain or the deadline is reached. If the gray stack
+	// overflowed, rescan the object store for marked objects whose children may not have
+	// been shaded. Return true when marking is complete.
+
+	int count = 0;
+	while (true) {
+		if (((++count & 0x1F) == 0) && TIME_UP(deadline)) return false;
+		if (grayCount > 0) {
+			shadeChildren(grayStack[--grayCount]);
+		} else if (scanCursor) {
+			OBJ chunk = scanCursor;
+			scanCursor += WORDS(chunk) + 2;
+			// stop before freeChunk, since growInPlace() may move the start of freeChunk
+			if (scanCursor >= freeChunk) scanCursor = NULL;
+			if (IS_MARKED(chunk)) shadeChildren(chunk);
+		} else if (grayOverflow) {
+			grayOverflow = false;
+			scanCursor = (OBJ) &objstore[1];
+			if (scanCursor >= freeChunk) scanCursor = NULL;
+		} else {
+			return true;
+		}
+	}
+}
+
+#ifdef BYTE_SLICES
+
+static OBJ unsweptOrNull(OBJ obj) {
+	// Slice survivor function for the incremental collector, called when marking is done.
+	// Objects do not move. Young objects are not marked; the nursery is not swept.
+
+	return (IS_YOUNG(obj) || IS_MARKED(obj)) ? obj : NULL;
+}
+
+#endif
+
+static void startSweep() {
+	#ifdef PROFILER
+		sweepAllocationRecords();
+	#endif
+	#ifdef BYTE_SLICES
+		updateSlices(unsweptOrNull);
+	#endif
+	gcPhase = gcSweepPhase;
+	gcMarking = false;
+	freeList = NULL; // the sweeper rebuilds the free list
+	freeListWords = 0;
+	scanCursor = (OBJ) &objstore[1];
+}
+
+static int sweepStep(uint32 deadline) {
+	// Sweep from scanCursor until the final free chunk or the deadline is reached. Clear the
+	// marks of surviving objects and turn unmarked objects into free chunks, merging adjacent
+	// ones. A free chunk that ends at the final free chunk is merged into it. Return true when
+	// sweeping is complete.
+
+	OBJ run = NULL; // free chunk being extended; it is added to the free list when it ends
+	int count = 0;
+	while (scanCursor < freeChunk) {
+		if (((++count & 0x1F) == 0) && TIME_UP(deadline)) break;
+		OBJ chunk = scanCursor;
+		int wordCount = WORDS(chunk);
+		scanCursor += wordCount + 2;
+		if (IS_MARKED(chunk)) { // surviving object
+			*(chunk - 1) = 0; // clear mark
+			if (run) addFreeChunk(run);
+			run = NULL;
+		} else if (run) { // merge with the preceding free chunk
+			*run = HEADER(FREE_CHUNK, WORDS(run) + wordCount + 2);
+		} else {
+			run = chunk;
+			*run = HEADER(FREE_CHUNK, wordCount);
+		}
+	}
+	if (scanCursor < freeChunk) { // out of time
+		if (run) addFreeChunk(run);
+		return false;
+	}
+	if (run) {
+		*run = HEADER(FREE_CHUNK, WORDS(run) + WORDS(freeChunk) + 2);
+		freeChunk = run;
+	}
+	scanCursor = NULL;
+	return true;
+}
+
+static void abortCycle() {
+	// Abandon the current incremental collection cycle, if any.
+
+	if (gcIdlePhase == gcPhase) return;
+	clearForwardingFields();
+	gcPhase = gcIdlePhase;
+	gcMarking = false;
+	grayCount = 0;
+	grayOverflow = false;
+	scanCursor = NULL;
+}
+
+void gcStep() {
+	// Do up to gcMaxPauseUSecs of incremental garbage collection work, starting a new cycle
+	// if free space is low. Called between task runs, when primitives hold no objects.
+	// Collect the nursery first if it is nearly full.
+
+	#ifdef GENERATIONAL_GC
+		if (nurseryFree && ((WORDS(nurseryFree) < NURSERY_LOW_WORDS) || rememberedOverflow)) {
+			collectNursery();
+		}
+		if (!nurseryFree) setupNursery(); // re-enable the nursery after gc()
+	#endif
+
+	if (gcIdlePhase == gcPhase) {
+		if (!gcMaxPauseUSecs) return;
+		if (wordsAllocated < CYCLE_MIN_ALLOCATION) return;
+		if ((WORDS(freeChunk) + freeListWords) > CYCLE_START_FREE_WORDS) return;
+	}
+
+	uint32 startUSecs = microsecs();
+	uint32 deadline = startUSecs + gcMaxPauseUSecs;
+	if (gcIdlePhase == gcPhase) startCycle();
+	if ((gcMarkPhase == gcPhase) && markStep(deadline)) startSweep();
+	if ((gcSweepPhase == gcPhase) && sweepStep(deadline)) {
+		gcPhase = gcIdlePhase;
+		gcCycleCount++;
+	}
+	recordPause(microsecs() - startUSecs);
+}
+
+#endif // INCREMENTAL_GC
@@ -84,6 +84,8 @@ typedef int * OBJ;
 #define BinaryObjectTypes 7 // objects with type ID's <= 7 do not contain pointers
 #define ArrayType 8
 #define ListType 9
+#define SliceType 10 // part of a byte array (see "Byte Array Slices" below)
+#define DictionaryType 11 // hash table with string and integer keys (see dataPrims.c)
 
 // Booleans
 // Note: These are constants, not pointers to objects in memory.
@@ -110,7 +112,7 @@ typedef int * OBJ;
 
 #define HEADER_WORDS 1
 #define HEADER(typeID, wordCount) (((wordCount) << 4) | ((typeID) & 0xF))
-#define WORDS(obj) ((*((uint32*) (obj)) >> 4) & 0xFFFF)
+#define WORDS(obj) ((*((uint32*) (obj)) >> 4) & 0xFFFFFF)
 #define TYPE(obj) (*((uint32*) (obj)) & 0xF)
 
 static inline int objWords(OBJ obj) {
@@ -154,17 +156,184 @@ static inline int objType(OBJ obj) {
 
 extern OBJ tempGCRoot;
 
+// Garbage collection statistics (pause times in microseconds)
+// Bucket i of gcPauseHistogram counts pauses under 2^(i + 5) usecs; the last bucket counts
+// all longer pauses. gcCount counts stop-the-world collections, gcCycleCount counts
+// completed incremental collection cycles, and gcMinorCount counts nursery collections.
+
+#define GC_PAUSE_BUCKETS 12
+
+extern int gcCount;
+extern int gcCycleCount;
+extern int gcMinorCount;
+extern uint32 gcTotalUSecs;
+extern uint32 gcMaxUSecs;
+extern uint32 gcPauseHistogram[GC_PAUSE_BUCKETS];
+
+void clearGCStats();
+
+// Incremental Garbage Collection
+//
+// When INCREMENTAL_GC is defined, gcStep() does up to gcMaxPauseUSecs of collection work
+// each time it is called (zero disables incremental collection). GC_WRITE_BARRIER() must be
+// called with the old value of an OBJ field of an existing object before overwriting it.
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(GNUBLOCKS)
+	#define INCREMENTAL_GC true
+#endif
+
+extern uint32 gcMaxPauseUSecs;
+
+#ifdef INCREMENTAL_GC
+	extern int gcMarking;
+	void gcShade(OBJ obj);
+	void gcStep();
+	#define GC_WRITE_BARRIER(oldValue) { if (gcMarking) gcShade(oldValue); }
+#else
+	#define GC_WRITE_BARRIER(oldValue)
+#endif
+
+// Generational Garbage Collection
+//
+// When GENERATIONAL_GC is defined, small objects are allocated in a nursery that gcStep()
+// collects on its own (so it requires INCREMENTAL_GC). GC_STORE_BARRIER() must be called
+// with the object and the new value before storing an OBJ into a field of an existing object.
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(GNUBLOCKS)
+	#define GENERATIONAL_GC true
+#endif
+
+#ifdef GENERATIONAL_GC
+	extern OBJ nurseryStart;
+	extern OBJ nurseryEnd;
+	void gcRemember(OBJ obj);
+	#define IS_YOUNG(obj) (!isInt(obj) && (nurseryStart <= (OBJ) (obj)) && ((OBJ) (obj) < nurseryEnd))
+	#define GC_STORE_BARRIER(obj, value) { if (IS_YOUNG(value) && !IS_YOUNG(obj)) gcRemember(obj); }
+#else
+	#define IS_YOUNG(obj) false
+	#define GC_STORE_BARRIER(obj, value)
+#endif
+
+// String Interning
+//
+// When INTERN_STRINGS is defined, internString() may return an existing string equal to
+// the given bytes instead of allocating a new one. Strings of up to INTERN_MAX_BYTES are
+// interned. The result must not be modified.
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(GNUBLOCKS)
+	#define INTERN_STRINGS true
+#endif
+
+#define INTERN_MAX_BYTES 32
+
+// String Builders
+//
+// When STRING_BUILDERS is defined, "set s to (join s ...)" appends to s in place if s is a
+// string builder: a string with spare capacity (zero bytes after its terminator) that is
+// referenced only by that variable. Any other read of a variable must call RELEASE_BUILDER()
+// to turn a builder into an ordinary string, so aliases never see a string change.
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(GNUBLOCKS)
+	#define STRING_BUILDERS true
+#endif
+
+#define BUILDER_FLAG 0x80000000 // header bit set on string builders
+
+#ifdef STRING_BUILDERS
+	#define RELEASE_BUILDER(obj) { \
+		if (IS_TYPE(obj, StringType) && (*(obj) & BUILDER_FLAG)) *(obj) &= ~BUILDER_FLAG; }
+#else
+	#define RELEASE_BUILDER(obj)
+#endif
+
+// Byte Array Slices
+//
+// When BYTE_SLICES is defined, copying part of a byte array may return a slice that refers
+// to the bytes of its parent byte array instead of copying them. Slices are pointer objects,
+// so the garbage collector keeps their parents alive with no special code. A byte array that
+// slices refer to has SHARED_FLAG set. Live slices are recorded in a table of up to MAX_SLICES
+// weak references that the garbage collector updates; it clears SHARED_FLAG once the last
+// slice of a byte array dies. When the table is full, copying returns a byte array instead.
+//
+// Before a shared byte array is modified, UNSHARE_BYTES() moves its slices to a copy of its
+// bytes; primitives that store into byte array arguments must call it first. Before a slice is
+// modified, sliceOwnBytes() gives it its own bytes. prepareSliceArgs() replaces the slice
+// arguments of primitives that do not accept slices with byte arrays of their own.
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(GNUBLOCKS)
+	#define BYTE_SLICES true
+#endif
+
+#define SLICE_MIN_BYTES 16 // shorter parts of byte arrays are copied
+#define SHARED_FLAG 0x80000000 // header bit set on byte arrays that slices refer to
+#define MAX_SLICES 128 // maximum number of live slices
+
+#define SLICE_PARENT(slice) FIELD(slice, 0)
+#define SLICE_START(slice) obj2int(FIELD(slice, 1))
+#define SLICE_COUNT(slice) obj2int(FIELD(slice, 2))
+#define SLICE_BYTES(slice) (((uint8 *) &FIELD(SLICE_PARENT(slice), 0)) + SLICE_START(slice))
+
+#ifdef BYTE_SLICES
+	extern int sliceCount;
+	OBJ newSlice(OBJ parent, int start, int byteCount);
+	OBJ sliceOwnBytes(OBJ slice);
+	int unshareBytes(OBJ *bytesPtr);
+	#define UNSHARE_BYTES(bytes) unshareBytes(&(bytes)) // updates bytes if GC moves it
+#else
+	#define UNSHARE_BYTES(bytes) true
+#endif
+
 // Object Memory Operations
 
 void memInit();
 void memClear();
 int wordsFree();
+int inObjectStore(OBJ obj);
 void gc();
 
+int setObjectStoreConfig(int kBytes, int usePSRAM);
+int objectStoreBytes();
+int objectStoreInPSRAM();
+
+// Heap Census
+//
+// heapCensus() scans the object store and counts the chunks and words (including header and
+// forwarding words) of each type. Type zero counts the free chunks. While the profiler is
+// running, the allocation site of each new object is recorded (up to a limit) and the census
+// totals the live objects of the sites with the most words. A site is encoded as
+// <16 bit ip><16 bit chunkIndex>, or UNKNOWN_ALLOC_SITE if it was not recorded.
+
+#define CENSUS_TYPES 16
+#define CENSUS_LARGEST 5
+#define CENSUS_SITES 8
+#define UNKNOWN_ALLOC_SITE 0xFFFFFFFF
+
+typedef struct {
+	uint32 site;
+	uint32 count;
+	uint32 words;
+} AllocSiteTotal;
+
+typedef struct {
+	uint32 count[CENSUS_TYPES];
+	uint32 words[CENSUS_TYPES];
+	uint32 largestFreeWords; // size of the largest free chunk
+	OBJ largest[CENSUS_LARGEST]; // largest objects, largest first (NULL if unused)
+	uint32 largestSite[CENSUS_LARGEST];
+	AllocSiteTotal sites[CENSUS_SITES]; // sites with the most live words, most first
+	int siteCount;
+	uint32 unrecordedCount; // allocations not recorded because the record table was full
+} HeapCensus;
+
+void heapCensus(HeapCensus *census);
+void startAllocationRecording();
+
 OBJ newObj(int typeID, int wordCount, OBJ fill);
 OBJ resizeObj(OBJ obj, int wordCount);
 OBJ newString(int byteCount);
 OBJ newStringFromBytes(const char *bytes, int byteCount);
+OBJ internString(const char *bytes, int byteCount);
+OBJ stringBuilderFor(OBJ s, int byteCount);
 char* obj2str(OBJ obj);
 
 // Debugging Support
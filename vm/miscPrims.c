@@ -225,18 +225,18 @@ static OBJ jsonValue(char *item) {
 	case tjr_Array:
 	case tjr_Object:
 		end = tjr_endOfItem(item);
-		return newStringFromBytes(item, (end - item));
+		return internString(item, (end - item));
 	case tjr_Number:
 		return int2obj(tjr_readInteger(item));
 	case tjr_String:
 		tjr_readStringInto(item, buf, sizeof(buf));
-		return newStringFromBytes(buf, strlen(buf));
+		return internString(buf, strlen(buf));
 	case tjr_True:
 		return trueObj;
 	case tjr_False:
 		return falseObj;
 	case tjr_Null:
-		return newStringFromBytes("null", 4);
+		return internString("null", 4);
 	}
 	return newString(0); // json parse error or end
 }
@@ -312,7 +312,7 @@ static OBJ primJSONKeyAt(int argCount, OBJ *args) {
 	key[0] = '\0';
 	char *item = tjr_atPath(json, path);
 	tjr_keyAt(item, i, key, sizeof(key));
-	return newStringFromBytes(key, strlen(key));
+	return internString(key, strlen(key));
 }
 
 static OBJ primBMP680GasResistance(int argCount, OBJ *args) {
@@ -373,6 +373,11 @@ static PrimEntry entries[] = {
 	{"jsonCount", primJSONCount},
 	{"jsonValueAt", primJSONValueAt},
 	{"jsonKeyAt", primJSONKeyAt},
+	{"setTaskPriority", primSetTaskPriority},
+	{"taskPriority", primTaskPriority},
+	{"setTaskPeriod", primSetTaskPeriod},
+	{"waitNextPeriod", primWaitNextPeriod},
+	{"deadlineMisses", primDeadlineMisses},
 };
 
 void addMiscPrims() {
@@ -43,6 +43,7 @@ static OBJ primScanNext(int argCount, OBJ *args) {
 		return falseObj;
 	}
 
+	if (!UNSHARE_BYTES(arg0)) return falseObj; // allocation failed
 	uint8 *dst = (uint8 *) &FIELD(arg0, 0);
 	for (int i = 0; i < 8; i++) dst[i] = addr[i];
 	return trueObj;
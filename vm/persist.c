@@ -14,13 +14,17 @@
 // To add a new board, add a case to the #ifdef for that board and define the constants:
 //
 //		START - starting address of persistent memory
-//		HALF_SPACE - size (in bytes) of each half-space; must be a multiple of Flash page size
+//		HALF_SPACE - size (in bytes) of each region; must be a multiple of Flash page size
 //
 // and implement the platform-specific Flash functions:
 //
 //		void flashErase(int *startAddr, int *endAddr)
 //		void flashWriteData(int *dst, int wordCount, uint8 *src)
 //		void flashWriteWord(int *addr, int value)
+//
+// Flash-based persistent memory is divided into two (or, on ESP32, possibly more) regions
+// of HALF_SPACE bytes. New records are appended to the current region. When it fills up,
+// the live records are copied into another region, which then becomes the current one.
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -502,19 +506,47 @@ void flashWriteData(int *dst, int wordCount, uint8 *src) {
 
 // variables
 
-// persistent memory half-space ranges:
-static int *start0 = (int *) START;
-static int *end0 = (int *) (START + HALF_SPACE);
-static int *start1 = (int *) (START + HALF_SPACE);
-static int *end1 = (int *) (START + (2 * HALF_SPACE));;
+// persistent memory regions:
+#define MAX_REGIONS 8
+#define REGION_WORDS (HALF_SPACE / 4)
+
+#ifdef RAM_CODE_STORE
+	#define RECORD_WORDS REGION_WORDS
+#else
+	#define RECORD_WORDS (REGION_WORDS - 1) // last word of a Flash region holds its erase count
+#endif
+
+static int *regionBase = (int *) START;	// start of region 0
+#ifdef RAM_CODE_STORE
+	static const int regionCount = 1;		// a RAM code store has only one region
+#else
+	static int regionCount = 2;				// number of regions
+#endif
+static uint32 eraseCounts[MAX_REGIONS];	// number of times each region has been erased
 
-static int current;		// current half-space (0 or 1)
+static int current;		// current region
 static int *freeStart;	// first free word
 
 #ifdef USE_CODE_FILE
 	static int suspendFileUpdates = false;	// suspend slow file updates when loading a project/library
 #endif
 
+// Checkpoint records (see persist.h) are written periodically and after compaction on
+// boards that keep code in Flash, where restoring the code store replays the records.
+
+#if !defined(RAM_CODE_STORE) && !defined(CHECKPOINTS)
+	#define CHECKPOINTS true
+#endif
+
+#define CHECKPOINT_INTERVAL 32 // records appended between checkpoints
+
+static int *lastCheckpoint = NULL;		// most recent checkpoint record in the current region
+static int *lastDeleteAll = NULL;		// most recent deleteAll record in the current region
+static int recordsSinceCheckpoint = 0;	// records appended after lastCheckpoint
+
+static void cancelCompaction();
+static void setCompactionTrigger();
+
 // helper functions
 
 #if defined(ESP32_FLASH_CODESTORE)
@@ -531,72 +563,145 @@ static void initESP32Flash() {
 	int err = esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, (const void**) &ramBaseAddr, &map_handle);
 	if (err) vmPanic("mmap failure in initESP32Flash()");
 
-	start0 = (int *) ramBaseAddr;
-	end0 = (int *) (ramBaseAddr + HALF_SPACE);
-	start1 = (int *) (ramBaseAddr + HALF_SPACE);
-	end1 = (int *) (ramBaseAddr + (2 * HALF_SPACE));
+	// A partition larger than the usual two regions spreads the Flash wear over more regions
+	regionBase = (int *) ramBaseAddr;
+	regionCount = partition->size / HALF_SPACE;
+	if (regionCount > MAX_REGIONS) regionCount = MAX_REGIONS;
 }
 
 #endif
 
-static void clearHalfSpace(int halfSpace) {
-	int *startAddr = (0 == halfSpace) ? start0 : start1;
-	int *endAddr = (0 == halfSpace) ? end0 : end1;
-	flashErase(startAddr, endAddr);
+static void forgetCheckpoints() {
+	// Called when the current region is erased, compacted, or replaced.
+
+	lastCheckpoint = NULL;
+	lastDeleteAll = NULL;
+	recordsSinceCheckpoint = 0;
+}
+
+static void noteRecord(int *rec) {
+	// Keep track of the most recent checkpoint and deleteAll records as records are found
+	// at startup or appended. A checkpoint whose directory was not completely written (e.g.
+	// due to a power failure) is ignored; the records before it are replayed instead.
+
+	int type = (*rec >> 16) & 0xFF;
+	if (checkpoint == type) {
+		int count = *(rec + 1);
+		if ((0 == count) || (-1 != *(rec + count + 1))) {
+			lastCheckpoint = rec;
+			recordsSinceCheckpoint = 0;
+		}
+		return;
+	}
+	if (deleteAll == type) lastDeleteAll = rec;
+	recordsSinceCheckpoint++;
+}
+
+static int *regionStart(int region) {
+	return regionBase + (region * REGION_WORDS);
+}
+
+static int *regionEnd(int region) {
+	// Return the end of the record area of the given region.
+
+	return regionStart(region) + RECORD_WORDS;
+}
+
+static void readEraseCounts() {
+	// Details: On Flash, the last word of each region has the form <'E'><erase count (24 bits)>.
+	// All the sectors of a region are erased together, so they share one erase count.
+
+	for (int i = 0; i < regionCount; i++) {
+		eraseCounts[i] = 0;
+		#ifndef RAM_CODE_STORE
+			int word = *regionEnd(i);
+			if ('E' == ((word >> 24) & 0xFF)) eraseCounts[i] = word & 0xFFFFFF;
+		#endif
+	}
+}
+
+static void noteRegionErased(int region) {
+	// Record that all sectors of the given region have just been erased.
+
+	eraseCounts[region]++;
+	#ifndef RAM_CODE_STORE
+		flashWriteWord(regionEnd(region), ('E' << 24) | (eraseCounts[region] & 0xFFFFFF));
+	#endif
+}
+
+static void clearRegion(int region) {
+	flashErase(regionStart(region), regionStart(region) + REGION_WORDS);
+	noteRegionErased(region);
+}
+
+static int leastWornRegion() {
+	// Return the region to use when the current one is compacted or cleared: the other region
+	// that has been erased the fewest times. Regions that are equally worn are used in turn.
+
+	int result = current;
+	for (int i = 1; i < regionCount; i++) {
+		int region = (current + i) % regionCount;
+		if ((result == current) || (eraseCounts[region] < eraseCounts[result])) result = region;
+	}
+	return result;
 }
 
-static int cycleCount(int halfSpace) {
-	// Return the cycle count for the given half-space or zero if not initialized.
-	// Details: Each half-space begins with a word of the form <'S'><cycle count (24 bits)>.
-	// The cycle count is incremented each time persistent memory is compacted.
+static int cycleCount(int region) {
+	// Return the cycle count for the given region or zero if not initialized.
+	// Details: Each region begins with a word of the form <'S'><cycle count (24 bits)>.
+	// The cycle count is incremented each time persistent memory is compacted, so the
+	// region with the highest cycle count is the current one.
 
-	int *p = (0 == halfSpace) ? start0 : start1;
+	int *p = regionStart(region);
 	return ('S' == ((*p >> 24) & 0xFF)) ? (*p & 0xFFFFFF) : 0;
 }
 
-static void setCycleCount(int halfSpace, int cycleCount) {
+static int maxCycleCount() {
+	int result = 0;
+	for (int i = 0; i < regionCount; i++) {
+		int count = cycleCount(i);
+		if (count > result) result = count;
+	}
+	return result;
+}
+
+static void setCycleCount(int region, int cycleCount) {
 	// Store the given cycle count at the given address.
 
-	int *p = (0 == halfSpace) ? start0 : start1;
+	int *p = regionStart(region);
 	flashWriteWord(p, ('S' << 24) | (cycleCount & 0xFFFFFF));
 }
 
 static void initPersistentMemory() {
-	// Figure out which is the current half-space and find freeStart.
-	// If neither half-space has a valid cycle counter, initialize persistent memory.
+	// Figure out which is the current region and find freeStart.
+	// If no region has a valid cycle counter, initialize persistent memory.
 
 	#ifdef RAM_CODE_STORE
-		// Use a single persistent memory; HALF_SPACE is the total amount of RAM to use
-		// Make starts and ends the same to allow the same code to work for either RAM or Flash
-		start0 = start1 = (int *) START;
-		end0 = end1 = (int *) (START + HALF_SPACE);
+		// Use a single persistent memory (regionCount is 1); HALF_SPACE is the total amount of RAM to use
 	#elif defined(ESP32_FLASH_CODESTORE)
 		// init ESP32 for direct Flash codestore
 		initESP32Flash();
 	#endif
 
-	int c0 = cycleCount(0);
-	int c1 = cycleCount(1);
-
-	if (!c0 && !c1) { // neither half-space has a valid counter
+	forgetCheckpoints();
+	cancelCompaction();
+	readEraseCounts();
+	current = 0;
+	for (int i = 1; i < regionCount; i++) {
+		if (cycleCount(i) > cycleCount(current)) current = i;
+	}
+	if (!cycleCount(current)) { // no region has a valid counter
 		// Flash hasn't been used for uBlocks yet; erase it all.
-		flashErase(start0, end1);
+		for (int i = 0; i < regionCount; i++) clearRegion(i);
 		setCycleCount(0, 1);
 		current = 0;
-		freeStart = start0 + 1;
+		freeStart = regionStart(0) + 1;
+		setCompactionTrigger();
 		return;
 	}
 
-	int *end;
-	if (c0 > c1) {
-		current = 0;
-		freeStart = start0 + 1;
-		end = end0;
-	} else {
-		current = 1;
-		freeStart = start1 + 1;
-		end = end1;
-	}
+	freeStart = regionStart(current) + 1;
+	int *end = regionEnd(current);
 
 	while ((freeStart < end) && (-1 != *freeStart)) {
 		int header = *freeStart;
@@ -605,23 +710,45 @@ static void initPersistentMemory() {
 			clearPersistentMemory();
 			return;
 		}
+		noteRecord(freeStart);
 		freeStart += *(freeStart + 1) + 2; // increment by the record length plus 2-word header
 	}
 	if (freeStart >= end) freeStart = end;
+	setCompactionTrigger();
+}
+
+// Record Headers
+
+// Wide chunk records are reported as the corresponding narrow record types, so code that
+// scans the records only needs to use these functions to handle both.
+
+static int isWideRecord(int header) {
+	int type = (header >> 16) & 0xFF;
+	return (chunkCodeWide <= type) && (type <= chunkDeletedWide);
+}
+
+int recordType(int header) {
+	int type = (header >> 16) & 0xFF;
+	if ((chunkCodeWide <= type) && (type < chunkDeletedWide)) return chunkCode;
+	if (chunkDeletedWide == type) return chunkDeleted;
+	return type;
+}
+
+int recordID(int header) {
+	return isWideRecord(header) ? (header & 0xFFFF) : ((header >> 8) & 0xFF);
+}
+
+int recordExtra(int header) {
+	if (isWideRecord(header)) return (header >> 16) & 0x0F; // chunk type for chunkCodeWide
+	return header & 0xFF;
 }
 
 int * recordAfter(int *lastRecord) {
 	// Return a pointer to the record following the given record, or NULL if there are
 	// no more records. Pass NULL to get the first record.
 
-	int *start, *end;
-	if (0 == current) {
-		start = start0;
-		end = end0;
-	} else {
-		start = start1;
-		end = end1;
-	}
+	int *start = regionStart(current);
+	int *end = regionEnd(current);
 	int *p = lastRecord;
 	if (NULL == lastRecord) { // return the first record
 		p = (start + 1);
@@ -634,7 +761,7 @@ int * recordAfter(int *lastRecord) {
 }
 
 void outputRecordHeaders() {
-	// For debugging. Output all the record headers of the current half-space.
+	// For debugging. Output all the record headers of the current region.
 
 	int recordCount = 0;
 	int wordCount = 0;
@@ -645,10 +772,10 @@ void outputRecordHeaders() {
 	while (p) {
 		recordCount++;
 		wordCount += 2 + *(p + 1);
-		int id = (*p >> 8) & 0xFF;
+		int id = recordID(*p);
 		if (id > maxID) maxID = id;
 		sprintf(s, "%d %d %d (%d words)",
-			(*p >> 16) & 0xFF, (*p >> 8) & 0xFF, *p & 0xFF, *(p + 1));
+			(*p >> 16) & 0xFF, id, recordExtra(*p), *(p + 1));
 		outputString(s);
 
 // xxx debug: dump contents
@@ -670,16 +797,22 @@ void outputRecordHeaders() {
 		recordCount, wordCount, maxID, cycleCount(current));
 	outputString(s);
 
-	int bytesUsed = 4 * (freeStart - ((0 == current) ? start0 : start1));
+	int bytesUsed = 4 * (freeStart - regionStart(current));
 	sprintf(s, "%d bytes used (%d%%) of %d",
 		bytesUsed, (100 * bytesUsed) / HALF_SPACE, HALF_SPACE);
 	outputString(s);
+
+	for (int i = 0; i < regionCount; i++) {
+		sprintf(s, "region %d: cycle %d, erased %lu times%s",
+			i, cycleCount(i), (unsigned long) eraseCounts[i], (i == current) ? " (current)" : "");
+		outputString(s);
+	}
 }
 
 void eraseCheck() {
 	int badCount = 0;
-	int *start = (0 == current) ? start1 : start0; // inactive half space
-	int *end = (0 == current) ? end1 : end0;
+	int *start = regionStart(leastWornRegion()); // next region to be used
+	int *end = regionEnd(leastWornRegion());
 	for (int *p = start; p < end; p++) {
 		if (*p != 0xFFFFFFFF) badCount++;
 		if (*p != 0xFFFFFFFF) {
@@ -692,7 +825,7 @@ void eraseCheck() {
 }
 
 void dumpHex() {
-	int *start = (0 == current) ? start0 : start1;
+	int *start = regionStart(current);
 	int *end = freeStart + 5000;
 	for (int *p = start; p <= end; ) {
 		char s[200];
@@ -703,20 +836,6 @@ void dumpHex() {
 	}
 }
 
-static int * compactionStartRecord() {
-	// Return a pointer to the first record at which to start compaction or script restoration
-	// at startup.
-
-	int *ptr = recordAfter(NULL);
-	int *result = ptr; // first record in half-space; default if no 'deleteAll' records found
-	while (ptr) {
-		int type = (*ptr >> 16) & 0xFF;
-		ptr = recordAfter(ptr);
-		if (deleteAll == type) result = ptr;
-	}
-	return result;
-}
-
 static int * copyChunk(int *dst, int *src) {
 	// Copy the chunk record at src to dst and return the new value of dst.
 
@@ -726,156 +845,292 @@ static int * copyChunk(int *dst, int *src) {
 }
 
 static void updateChunkTable() {
-	memset(chunks, 0, sizeof(chunks)); // clear chunk table
+	clearChunkTable();
 
-	int *p = compactionStartRecord();
+	int *p = scanStart();
 	while (p) {
-		int recType = (*p >> 16) & 0xFF;
+		int recType = recordType(*p);
 		if (chunkCode == recType) {
-			int chunkIndex = (*p >> 8) & 0xFF;
-			if (chunkIndex < MAX_CHUNKS) {
-				chunks[chunkIndex].chunkType = *p & 0xFF;
+			int chunkIndex = recordID(*p);
+			if (growChunkTable(chunkIndex)) {
+				chunks[chunkIndex].chunkType = recordExtra(*p);
 				chunks[chunkIndex].code = p;
 			}
 		}
 		if (chunkDeleted == recType) {
-			int chunkIndex = (*p >> 8) & 0xFF;
-			if (chunkIndex < MAX_CHUNKS) {
+			int chunkIndex = recordID(*p);
+			if (chunkIndex < chunkTableSize) {
 				chunks[chunkIndex].chunkType = unusedChunk;
 				chunks[chunkIndex].code = NULL;
 			}
 		}
-		p = recordAfter(p);
+		p = scanNext(p);
+	}
+
+	for (int i = 0; i < chunkTableSize; i++) {
+		if (chunks[i].code) fuseChunk(i);
 	}
 
 	// update code pointers for tasks
-	for (int i = 0; i < MAX_TASKS; i++) {
-		if (tasks[i].status) { // task entry is in use
-			tasks[i].code = chunks[tasks[i].taskChunkIndex].code;
+	for (int i = 0; i < taskTableSize; i++) {
+		if (tasks[i]->status) { // task entry is in use
+			tasks[i]->code = RUN_CODE(tasks[i]->currentChunkIndex);
 		}
 	}
+
+	// code may have moved, so re-resolve primitive calls and function names
+	clearCalleeCache();
+	clearBroadcastIndex();
+	clearPrimitiveCache();
+	for (int i = 0; i < chunkTableSize; i++) {
+		if (chunks[i].code) cachePrimitivesInChunk(chunks[i].code);
+	}
+
+	// variable name records may have moved
+	updateVarNameIndex();
 }
 
-// Flash Compaction
+#if defined(CHECKPOINTS) || !defined(RAM_CODE_STORE)
 
-#ifndef RAM_CODE_STORE
+static int isLiveRecord(int *rec) {
+	// Return true if the given record is the current record for its chunk or variable,
+	// false if it is not, or -1 if that is not known (its chunk or variable is not loaded).
 
-static char chunkProcessed[256];
-static char varProcessed[256];
+	int type = recordType(*rec);
+	int id = recordID(*rec);
+	if (chunkCode == type) {
+		if (id >= chunkTableSize) return -1;
+		return rec == chunks[id].code;
+	}
+	if (varName == type) {
+		if (id >= MAX_VARS) return -1;
+		return (char *) (rec + PERSISTENT_HEADER_WORDS) == varNameAt(id);
+	}
+	return false;
+}
 
-static int * copyChunkInfo(int id, int *src, int *dst) {
-	// Copy the most recent data about the chunk with the given ID to dst and return
-	// the new dst pointer. If the given chunk id has been processed do nothing.
+#endif
 
-	if (chunkProcessed[id]) return dst;
+// Checkpoints
 
-	int *chunkSrc = 0;
+#ifdef CHECKPOINTS
 
-	// scan rest of the records to get the most recent info about this chunk
-	while (src) {
-		if (id == ((*src >> 8) & 0xFF)) { // id field matches
-			int type = (*src >> 16) & 0xFF;
-			switch (type) {
-			case chunkCode:
-				chunkSrc = src;
-				break;
-			case chunkDeleted:
-				chunkSrc = 0;
-				break;
-			}
-		}
-		src = recordAfter(src);
+static void writeCheckpoint() {
+	// Append a checkpoint record whose directory lists the live chunk and variable name
+	// records. Called when the chunk table and variable name index match the records.
+	// Skipped if there is not enough room or if some records are not loaded; in that case,
+	// the next attempt is made after another CHECKPOINT_INTERVAL records rather than on
+	// every append, since each attempt scans the region.
+
+	recordsSinceCheckpoint = 0;
+	int count = 0;
+	for (int *p = scanStart(); p; p = scanNext(p)) {
+		int live = isLiveRecord(p);
+		if (live < 0) return;
+		if (live) count++;
 	}
-	if (chunkSrc) {
-		dst = copyChunk(dst, chunkSrc);
+	if ((freeStart + 2 + count) > regionEnd(current)) return;
+
+	int *start = regionStart(current);
+	int *rec = freeStart;
+	int header = ('R' << 24) | (checkpoint << 16);
+	flashWriteWord(freeStart++, header);
+	flashWriteWord(freeStart++, count);
+	#if USE_CODE_FILE
+		if (!suspendFileUpdates) {
+			writeCodeFileWord(header);
+			writeCodeFileWord(count);
+		}
+	#endif
+	for (int *p = scanStart(); p && (p < rec); p = scanNext(p)) {
+		if (isLiveRecord(p)) {
+			#if USE_CODE_FILE
+				if (!suspendFileUpdates) writeCodeFileWord(p - start);
+			#endif
+			flashWriteWord(freeStart++, p - start);
+		}
 	}
-	chunkProcessed[id] = true;
-	return dst;
+	#if USE_CODE_FILE
+		if (!suspendFileUpdates) writeCodeFile(NULL, 0);
+	#endif
+	noteRecord(rec);
 }
 
-static int * copyVarInfo(int id, int *src, int *dst) {
-	if (varProcessed[id]) return dst;
+#endif
 
-	// record info from first reference to this variable
-	int type = (*src >> 16) & 0xFF;
-	int *nameRec = (varName == type) ? src : NULL;
+// Flash Compaction
 
-	// scan rest of the records to get the most recent info about this variable
-	while (src) {
-		int type = (*src >> 16) & 0xFF;
-		switch (type) {
-		case varName:
-			if (id == ((*src >> 8) & 0xFF)) nameRec = src;
-			break;
-		case varsClearAll:
-			nameRec = NULL;
-			break;
-		}
-		src = recordAfter(src);
-	}
-	if (nameRec) dst = copyChunk(dst, nameRec);
-	varProcessed[id] = true;
-	return dst;
+// Compaction copies the live records of the current region into the least worn of the other
+// regions, which then becomes the current region. It is normally done incrementally by the
+// VM loop (see compactCodeStoreStep()), starting when the free space left could no longer
+// hold the largest record and a checkpoint. Every compaction erases a region, so starting
+// later means fewer erases for the same code changes. Each step either erases one sector,
+// copies about COPY_STEP_WORDS words of records, or commits the compaction, so tasks are
+// paused for at most one step at a time. Records appended after copying starts are copied
+// unchanged, since the chunk table no longer describes the records being copied.
+// If the current region fills up first, the rest of the compaction is done all at once.
+
+#ifndef RAM_CODE_STORE
+
+#define COMPACTION_STEP_MSECS 10	// minimum time between incremental compaction steps
+#define ERASE_STEP_WORDS 1024		// words erased per step (one 4K Flash sector)
+#define COPY_STEP_WORDS 256			// words copied per step (a larger record is copied in one step)
+#define MAX_RECORD_WORDS (2 + 256)	// header words plus the most data an IDE message can carry
+
+typedef enum {
+	compactionIdle,
+	compactionErasing,
+	compactionCopying,
+} CompactionState_t;
+
+static CompactionState_t compactionState = compactionIdle;
+static int compactionRegion;		// region being filled
+static int *compactionErase;		// next word to erase in compactionRegion
+static int *compactionSrc;			// next record to consider copying
+static int *compactionDst;			// next free word in compactionRegion
+static int *compactionTail;			// records from here on were appended after copying started
+static int *compactionTrigger;		// start compacting when freeStart passes this
+static uint32 lastCompactionStep = 0;
+
+static void cancelCompaction() {
+	compactionState = compactionIdle;
 }
 
-static void compactFlash() {
-	// Copy only the most recent chunk and variable records to the other half-space.
-	// Details:
-	//	1. erase the other half-space
-	//	2. clear the chunk and variable processed flags
-	//	3. find the start point for the scan (half space start or after latest 'deleteAll' record)
-	//	4. for each chunk and variable record in the current half-space
-	//		a. if the chunk or variable has been processed, skip it
-	//		b. gather the most recent information about that chunk or variable
-	//		c. copy that information into the other half-space
-	//		d. mark the chunk or variable as processed
-	//	5. switch to the other half-space
-	//	6. remember the free pointer for the new half-space
+static void setCompactionTrigger() {
+	// Reserve room for the largest record and a checkpoint. The checkpoint estimate allows for
+	// CHECKPOINT_INTERVAL records more than the last one lists. If that room is not free now,
+	// compacting again would not help, so wait until the region is full.
 
-	uint32_t startT = millisecs();
+	int checkpointWords = 2 + (lastCheckpoint ? *(lastCheckpoint + 1) : 0) + CHECKPOINT_INTERVAL;
+	compactionTrigger = regionEnd(current) - (MAX_RECORD_WORDS + checkpointWords);
+	if (compactionTrigger <= freeStart) compactionTrigger = regionEnd(current);
+}
 
-	// clear the processed flags
-	memset(chunkProcessed, 0, sizeof(chunkProcessed));
-	memset(varProcessed, 0, sizeof(varProcessed));
+static int mustCopy(int *rec) {
+	// Return true if the given record, which was written before copying started, must be
+	// copied. Records for chunks or variables that are not loaded are kept in case they are live.
 
-	// clear the destination half-space and init dst pointer
-	clearHalfSpace(!current);
-	int *dst = ((0 == !current) ? start0 : start1) + 1;
+	int type = recordType(*rec);
+	if ((chunkCode == type) || (varName == type)) return false != isLiveRecord(rec);
+	if (chunkDeleted == type) return recordID(*rec) >= chunkTableSize;
+	return false;
+}
 
-	int *src = compactionStartRecord();
-	while (src) {
-		captureIncomingBytes();
-		int header = *src;
-		int type = (header >> 16) & 0xFF;
-		int id = (header >> 8) & 0xFF;
-		if ((chunkCode <= type) && (type <= chunkDeleted)) {
-			dst = copyChunkInfo(id, src, dst);
-		} else if ((varName <= type) && (type <= varsClearAll)) {
-			dst = copyVarInfo(id, src, dst);
-		}
-		src = recordAfter(src);
+static int * nextRecordToCopy(int *rec) {
+	// Return the record to consider after the given one or NULL if there are no more.
+	// Records before compactionTail are visited using the checkpoint directory (if any) to
+	// skip superseded ones. Every record after that is visited except checkpoint records.
+
+	int *next;
+	if (rec < compactionTail) {
+		next = scanNext(rec);
+		if (next && (next < compactionTail)) return next;
+		if (compactionTail >= freeStart) return NULL;
+		next = compactionTail;
+	} else {
+		next = recordAfter(rec);
 	}
+	while (next && (checkpoint == recordType(*next))) next = recordAfter(next);
+	return next;
+}
 
-	// increment the cycle counter and switch to the other half-space
-	setCycleCount(!current, cycleCount(current) + 1); // this commits the compaction
-	current = !current;
-	freeStart = dst;
+static void beginCompaction() {
+	compactionRegion = leastWornRegion();
+	compactionErase = regionStart(compactionRegion);
+	compactionState = compactionErasing;
+}
+
+static void commitCompaction() {
+	// Make the compacted region the current one.
+
+	setCycleCount(compactionRegion, maxCycleCount() + 1); // this commits the compaction
+	current = compactionRegion;
+	freeStart = compactionDst;
+	compactionState = compactionIdle;
+	forgetCheckpoints();
+	// note the deleteAll records appended while copying (checkpoints are never copied)
+	for (int *p = recordAfter(NULL); p && (p < freeStart); p = recordAfter(p)) noteRecord(p);
 
 	updateChunkTable();
+	#ifdef CHECKPOINTS
+		writeCheckpoint();
+	#endif
+	setCompactionTrigger();
 
 	#if defined(NRF51) || defined(ARDUINO_BBC_MICROBIT_V2) || defined(CALLIOPE_V3)
 		// Compaction messes up the serial port on the micro:bit v1 and v2 and Calliope
 		restartSerial();
 	#endif
+}
+
+static void compactionStep() {
+	// Do one step of the compaction in progress.
+
+	if (compactionErasing == compactionState) {
+		int *end = regionStart(compactionRegion) + REGION_WORDS;
+		int *stepEnd = compactionErase + ERASE_STEP_WORDS;
+		if (stepEnd > end) stepEnd = end;
+		flashErase(compactionErase, stepEnd);
+		compactionErase = stepEnd;
+		if (compactionErase >= end) {
+			noteRegionErased(compactionRegion);
+			compactionSrc = scanStart();
+			compactionDst = regionStart(compactionRegion) + 1;
+			compactionTail = freeStart;
+			compactionState = compactionCopying;
+		}
+		return;
+	}
+
+	if (!compactionSrc && (compactionTail < freeStart)) {
+		compactionSrc = compactionTail; // the region was empty when copying started
+	}
+	int *end = regionEnd(compactionRegion);
+	int wordsCopied = 0;
+	while (compactionSrc && (wordsCopied < COPY_STEP_WORDS)) {
+		int *src = compactionSrc;
+		if ((src >= compactionTail) || mustCopy(src)) {
+			int wordCount = *(src + 1) + 2;
+			if ((compactionDst + wordCount) > end) {
+				outputString("Not enough room to compact Flash code store");
+				compactionState = compactionIdle;
+				compactionTrigger = regionEnd(current); // don't try again until it is full
+				return;
+			}
+			compactionDst = copyChunk(compactionDst, src);
+			wordsCopied += wordCount;
+		}
+		compactionSrc = nextRecordToCopy(src);
+	}
+	if (!compactionSrc) commitCompaction();
+}
+
+static void compactFlash() {
+	// Finish the compaction in progress (if any) or do a complete compaction without pausing.
+
+	uint32_t startT = millisecs();
+	int oldRegion = current;
+
+	if (compactionIdle == compactionState) beginCompaction();
+	while (compactionIdle != compactionState) {
+		captureIncomingBytes();
+		compactionStep();
+	}
+	if (current == oldRegion) return; // compaction failed
 
 	char s[100];
-	int bytesUsed = 4 * (freeStart - ((0 == current) ? start0 : start1));
+	int bytesUsed = 4 * (freeStart - regionStart(current));
 	sprintf(s, "Compacted Flash code store (%lu msecs)\n%d bytes used (%d%%) of %d",
-		millisecs() - startT,
+		(unsigned long) (millisecs() - startT),
 		bytesUsed, (100 * bytesUsed) / HALF_SPACE, HALF_SPACE);
 	outputString(s);
 }
 
+#else
+
+static void cancelCompaction() { }
+static void setCompactionTrigger() { }
+
 #endif // compactFlash
 
 // RAM compaction
@@ -885,12 +1140,12 @@ static void compactFlash() {
 static int keepCodeChunk(int id, int header, int *start) {
 	// Return true if this code chunk should be kept when compacting RAM.
 
-	if (unusedChunk == chunks[id].chunkType) return false; // code chunk was deleted
+	if ((id >= chunkTableSize) || (unusedChunk == chunks[id].chunkType)) return false; // code chunk was deleted
 
 	int *rec = start;
 	while (rec) {
 		if (*rec == header) return false; // superceded
-		rec = recordAfter(rec);
+		rec = scanNext(rec);
 	}
 	return true;
 }
@@ -909,7 +1164,7 @@ static void compactRAM(int printStats) {
 	// Details:
 	//	1. find the start point for the scan (half space start or after latest 'deleteAll' record)
 	//	2. find the most recent "varsClearAll" record
-	//	3. for each chunk and variable record in the current half-space
+	//	3. for each chunk and variable record in the current region
 	//		a. deterimine if the record should be kept or skipped
 	//		b. if kept, copy the record down to the destination pointer
 	//	4. update the free pointer
@@ -919,8 +1174,8 @@ static void compactRAM(int printStats) {
 
 	uint32 startT = millisecs();
 
-	int *dst = ((0 == !current) ? start0 : start1) + 1;
-	int *src = compactionStartRecord();
+	int *dst = regionStart(current) + 1;
+	int *src = scanStart();
 
 	if (!src) { // nothing to compact
 		if (printStats) outputString("RAM code store is empty");
@@ -932,14 +1187,14 @@ static void compactRAM(int printStats) {
 	int *rec = src;
 	while (rec) {
 		if (varsClearAll == ((*rec >> 16) & 0xFF)) varsStart = rec;
-		rec = recordAfter(rec);
+		rec = scanNext(rec);
 	}
 
 	while (src) {
-		int *next = recordAfter(src);
+		int *next = scanNext(src);
 		int header = *src;
-		int type = (header >> 16) & 0xFF;
-		int id = (header >> 8) & 0xFF;
+		int type = recordType(header);
+		int id = recordID(header);
 		if ((type == chunkCode) && keepCodeChunk(id, header, next)) {
 			dst = copyChunk(dst, src);
 		} else if ((varName == type) && (src >= varsStart)) {
@@ -950,7 +1205,8 @@ static void compactRAM(int printStats) {
 	}
 
 	freeStart = dst;
-	memset(freeStart, 0, (4 * (end0 - freeStart))); // clear everything following freeStart
+	memset(freeStart, 0, (4 * (regionEnd(current) - freeStart))); // clear everything following freeStart
+	forgetCheckpoints(); // checkpoint and deleteAll records were not kept
 
 	updateChunkTable();
 
@@ -958,16 +1214,16 @@ static void compactRAM(int printStats) {
 	#if USE_CODE_FILE
 		setCycleCount(current, cycleCount(current) + 1);
 		clearCodeFile(cycleCount(current));
-		int *codeStart = ((0 == current) ? start0 : start1) + 1; // skip half-space header
+		int *codeStart = regionStart(current) + 1; // skip region header
 		writeCodeFile((uint8 *) codeStart, 4 * (freeStart - codeStart));
 	#endif
 
 	if (printStats) {
 		char s[100];
-		int bytesUsed = 4 * (freeStart - ((0 == current) ? start0 : start1));
+		int bytesUsed = 4 * (freeStart - regionStart(current));
 
 		sprintf(s, "Compacted RAM code store (%lu msecs)\n%d bytes used (%d%%) of %d",
-			millisecs() - startT,
+			(unsigned long) (millisecs() - startT),
 			bytesUsed, (100 * bytesUsed) / HALF_SPACE, HALF_SPACE);
 		outputString(s);
 	}
@@ -975,39 +1231,46 @@ static void compactRAM(int printStats) {
 #endif
 
 #ifdef EMSCRIPTEN
-int *ramStart() { return start0; }
-int ramSize() { return 4 * (freeStart - start0); }
+int *ramStart() { return regionStart(0); }
+int ramSize() { return 4 * (freeStart - regionStart(0)); }
 #endif
 
 
 // entry points
 
 void clearPersistentMemory() {
-	int c0 = cycleCount(0);
-	int c1 = cycleCount(1);
-	int count = (c0 > c1) ? c0 : c1;
-	current = !current;
-	clearHalfSpace(current);
-	freeStart = (0 == current) ? start0 + 1 : start1 + 1;
+	int count = maxCycleCount();
+	cancelCompaction();
+	current = leastWornRegion();
+	clearRegion(current);
+	freeStart = regionStart(current) + 1;
 	setCycleCount(current, count + 1);
+	forgetCheckpoints();
+	setCompactionTrigger();
 }
 
 int * appendPersistentRecord(int recordType, int id, int extra, int byteCount, uint8 *data) {
-	// Append the given record at the end of the current half-space and return it's address.
+	// Append the given record at the end of the current region and return it's address.
 	// Header word: <tag = 'R'><record type><id of chunk/variable/comment><extra> (8-bits each)
 	// Perform a compaction if necessary.
+	#ifdef CHECKPOINTS
+		if (recordsSinceCheckpoint >= CHECKPOINT_INTERVAL) writeCheckpoint();
+	#endif
 	int wordCount = (byteCount + 3) / 4;
-	int *end = (0 == current) ? end0 : end1;
-	if ((freeStart + 2 + wordCount) > end) {
+	if ((freeStart + 2 + wordCount) > regionEnd(current)) {
 		compactCodeStore();
-		end = (0 == current) ? end0 : end1;
-		if ((freeStart + 2 + wordCount) > end) {
+		if ((freeStart + 2 + wordCount) > regionEnd(current)) {
 			outputString("Not enough room even after compaction");
 			return NULL;
 		}
 	}
 	// write the record
 	int header = ('R' << 24) | ((recordType & 0xFF) << 16) | ((id & 0xFF) << 8) | (extra & 0xFF);
+	if ((id > 255) && (chunkCode == recordType)) {
+		header = ('R' << 24) | ((chunkCodeWide | (extra & 0x0F)) << 16) | (id & 0xFFFF);
+	} else if ((id > 255) && (chunkDeleted == recordType)) {
+		header = ('R' << 24) | (chunkDeletedWide << 16) | (id & 0xFFFF);
+	}
 
 // xxx debug: dump contents
 // char s[500];
@@ -1033,6 +1296,7 @@ int * appendPersistentRecord(int recordType, int id, int extra, int byteCount, u
 	flashWriteWord(freeStart++, wordCount);
 	if (wordCount) flashWriteData(freeStart, wordCount, data);
 	freeStart += wordCount;
+	noteRecord(result);
 	return result;
 }
 
@@ -1044,13 +1308,29 @@ void compactCodeStore() {
 	#endif
 }
 
+void compactCodeStoreStep() {
+	// Called periodically by the VM loop. Start an incremental compaction when the current
+	// region is getting full and do the next step of a compaction in progress.
+
+	#ifndef RAM_CODE_STORE
+		if (compactionIdle == compactionState) {
+			if (freeStart < compactionTrigger) return;
+			beginCompaction();
+		}
+		if ((millisecs() - lastCompactionStep) < COMPACTION_STEP_MSECS) return;
+		compactionStep();
+		lastCompactionStep = millisecs();
+	#endif
+}
+
 void restoreScripts() {
 	initPersistentMemory();
 
 	#if USE_CODE_FILE
 		int codeFileBytes = initCodeFile(flash, HALF_SPACE);
-		int *start = current ? start1 : start0;
-		freeStart = start + (codeFileBytes / 4);
+		freeStart = regionStart(current) + (codeFileBytes / 4);
+		forgetCheckpoints();
+		for (int *p = recordAfter(NULL); p && (p < freeStart); p = recordAfter(p)) noteRecord(p);
 	#elif defined(ARDUINO_ARCH_ESP32)
 		initFileSystem();
 	#endif
@@ -1059,7 +1339,7 @@ void restoreScripts() {
 
 	// Give feedback:
 	int chunkCount = 0;
-	for (int i = 0; i < MAX_CHUNKS; i++) {
+	for (int i = 0; i < chunkTableSize; i++) {
 		if (chunks[i].code) chunkCount++;
 	}
 	char s[100];
@@ -1069,16 +1349,41 @@ void restoreScripts() {
 }
 
 int *scanStart() {
-	// Return a pointer to the first record at which to start scanning the current code.
-
-	int *ptr = recordAfter(NULL);
-	int *result = ptr; // default if no 'deleteAll' records found
-	while (ptr) {
-		int type = (*ptr >> 16) & 0xFF;
-		ptr = recordAfter(ptr);
-		if (deleteAll == type) result = ptr;
+	// Return a pointer to the first record at which to start scanning the current code,
+	// skipping the records before the most recent checkpoint or 'deleteAll' record.
+
+	if (lastDeleteAll && (lastDeleteAll > lastCheckpoint)) return recordAfter(lastDeleteAll);
+	if (lastCheckpoint) {
+		int *start = regionStart(current);
+		if (*(lastCheckpoint + 1) > 0) return start + *(lastCheckpoint + 2); // first directory entry
+		return recordAfter(lastCheckpoint);
 	}
-	return result;
+	return recordAfter(NULL);
+}
+
+int *scanNext(int *record) {
+	// Return the record following the given one in a scan started by scanStart() or NULL
+	// if there are no more records. Records before the most recent checkpoint are visited
+	// using its directory, which skips the superseded ones.
+
+	if (lastCheckpoint && (record < lastCheckpoint)) {
+		int *start = regionStart(current);
+		int *entries = lastCheckpoint + 2;
+		int count = *(lastCheckpoint + 1);
+		int offset = record - start;
+		int lo = 0, hi = count; // binary search for the first entry after record
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (entries[mid] <= offset) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		if (lo < count) return start + entries[lo];
+		return recordAfter(lastCheckpoint);
+	}
+	return recordAfter(record);
 }
 
 void suspendCodeFileUpdates() {
@@ -1098,11 +1403,11 @@ void resumeCodeFileUpdates() {
 
 // testing
 
-static void dumpWords(int halfSpace, int count) {
-	// Dump the first count words of the given half-space.
+static void dumpWords(int region, int count) {
+	// Dump the first count words of the given region.
 
 	char s[100];
-	int *p = (current == 0) ? start0 : start1;
+	int *p = regionStart(region);
 	for (int i = 0; i < count; i++) {
 		sprintf(s, "%d %d %d %d",
 			(*p >> 24) & 0xFF,
@@ -1115,13 +1420,13 @@ static void dumpWords(int halfSpace, int count) {
 }
 
 static void showRecordHeaders() {
-	// Dump the record headers of the current half-space.
+	// Dump the record headers of the current region.
 
 	char s[100];
 	int *p = recordAfter(NULL);
 	while (p) {
 		sprintf(s, "Record at offset %d: %d %d %d %d (%d words)",
-			(p - start0),
+			(p - regionStart(current)),
 			(*p >> 24) & 0xFF, (*p >> 16) & 0xFF, (*p >> 8) & 0xFF, *p & 0xFF, *(p + 1));
 		outputString(s);
 		p = recordAfter(p);
@@ -1174,7 +1479,7 @@ void persistTest() {
 	char s[100];
 	sprintf(s, "Final: current %d used %d c0 %d c1 %d",
 		current,
-		freeStart - ((0 == current) ? start0 : start1),
-		cycleCount(0), cycleCount(1));
+		freeStart - regionStart(current),
+		cycleCount(0), (regionCount > 1) ? cycleCount(1) : 0);
 	outputString(s);
 }
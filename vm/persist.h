@@ -19,6 +19,16 @@ extern "C" {
 //	... word count data words ...
 //
 // Not all record types use the <extra> header field.
+//
+// Records for chunks with indices over 255 use the wide record types, with the header:
+//	<'R'><record type><id of chunk (16-bits)>
+// The chunk type of a chunkCodeWide record is kept in the low 4 bits of the record type.
+//
+// A checkpoint record is a directory of the code store at the point where it is written.
+// Its data words are the offsets (in words, from the start of the region) of the chunk
+// and variable name records that were live at that point, in increasing order. Records
+// before the most recent checkpoint that are not in its directory are superseded, so
+// restoring the code store only needs to replay the directory and the records after it.
 
 #define PERSISTENT_HEADER_WORDS 2
 
@@ -27,19 +37,27 @@ typedef enum {
 	chunkAttribute = 11, // deprecated
 	chunkCode = 12, // 16-bit code chunk
 	chunkDeleted = 19,
+	chunkCodeWide = 64, // 64-79: 16-bit code chunk with a 16-bit id
+	chunkDeletedWide = 80,
 	varName = 21,
 	varsClearAll = 29,
+	checkpoint = 30,
 	deleteAll = 218, // 218 in hex is 0xDA, short for "delete all"
 } RecordType_t;
 
 // Persistent Memory Operations
 
 int * appendPersistentRecord(int recordType, int id, int extra, int byteCount, uint8 *data);
+int recordType(int header);
+int recordID(int header);
+int recordExtra(int header);
 void clearPersistentMemory();
 int * recordAfter(int *lastRecord);
 void restoreScripts();
 int *scanStart();
+int *scanNext(int *record);
 void compactCodeStore();
+void compactCodeStoreStep();
 
 #ifdef EMSCRIPTEN
 int *ramStart();
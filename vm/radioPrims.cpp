@@ -367,6 +367,7 @@ static OBJ primPacketReceive(int argCount, OBJ *args) {
 		if (!gotData) return falseObj; // no packet received
 		int packetLen = packet[0];
 		for (int i = 0; i < 32; i++) {
+			GC_WRITE_BARRIER(FIELD(arg0, i + 1));
 			FIELD(arg0, i + 1) = (i <= packetLen) ? int2obj(packet[i]) : int2obj(0);
 		}
 		receivedMessageSenderID = (packet[12] << 24) | (packet[11] << 16) | (packet[10] << 8) | packet[9];
@@ -31,6 +31,7 @@ static void sendMessage(int msgType, int chunkIndex, int dataSize, char *data);
 static void sendChunkCRC(int chunkID);
 static void sendData();
 static void deferIDEDisconnect();
+static void addVarNameToIndex(int varIndex, int *nameRec);
 
 // debugging
 
@@ -128,6 +129,436 @@ OBJ doPrimitiveCall(PrimitiveSetIndex setIndex, const char *primName, int argCou
 	return falseObj;
 }
 
+static int putUInt32(uint8 *dst, uint32 n) {
+	dst[0] = n & 0xFF;
+	dst[1] = (n >> 8) & 0xFF;
+	dst[2] = (n >> 16) & 0xFF;
+	dst[3] = (n >> 24) & 0xFF;
+	return 4;
+}
+
+// Profiler
+
+// When profiling is on, the interpreter counts opcode executions and samples the clock
+// every PROFILE_SAMPLE_OPS instructions, charging the elapsed time to the chunk of the
+// running task. Named primitive calls are timed individually. Times are in usecs and
+// chunk times include the time spent in primitives. The IDE starts, stops, and reads
+// the profile with extended message 4 (see processExtendedMessage()).
+
+#ifdef PROFILER
+
+#define PROFILE_SAMPLE_OPS 16
+#define PROFILE_PRIMS 32
+
+typedef struct {
+	PrimitiveFunction primFunc;
+	uint32 count;
+	uint32 usecs;
+} PrimProfileEntry;
+
+int profiling = false;
+static uint32 profileOpCounts[128];
+static uint32 *profileChunkUSecs = NULL; // usecs per chunk index, allocated when started
+static int profileChunkCount = 0;
+static PrimProfileEntry profilePrims[PROFILE_PRIMS];
+static uint32 profileLastSample = 0;
+static uint32 profileStartTime = 0;
+static uint32 profileUSecs = 0; // total profiled time, excluding the current run
+static int profileCountdown = PROFILE_SAMPLE_OPS;
+
+void profileResume() {
+	// Called when a task resumes; time outside of tasks is not charged to any chunk.
+
+	profileLastSample = microsecs();
+}
+
+void profileSample(int chunkIndex) {
+	uint32 now = microsecs();
+	if (chunkIndex < profileChunkCount) profileChunkUSecs[chunkIndex] += now - profileLastSample;
+	profileLastSample = now;
+}
+
+void profileOp(int cmd, int chunkIndex) {
+	profileOpCounts[cmd]++;
+	if (--profileCountdown > 0) return;
+	profileCountdown = PROFILE_SAMPLE_OPS;
+	profileSample(chunkIndex);
+}
+
+static OBJ profiledPrimitiveCall(PrimitiveFunction primFunc, int argCount, OBJ *args) {
+	uint32 startT = microsecs();
+	OBJ result = primFunc(argCount, args);
+	uint32 usecs = microsecs() - startT;
+
+	for (int i = 0; i < PROFILE_PRIMS; i++) {
+		PrimProfileEntry *entry = &profilePrims[i];
+		if (!entry->primFunc) entry->primFunc = primFunc; // unused entry
+		if (primFunc == entry->primFunc) {
+			entry->count++;
+			entry->usecs += usecs;
+			break;
+		}
+	}
+	return result;
+}
+
+static void startProfiling() {
+	memset(profileOpCounts, 0, sizeof(profileOpCounts));
+	free(profileChunkUSecs);
+	profileChunkUSecs = (uint32 *) calloc(chunkTableSize, sizeof(uint32));
+	profileChunkCount = profileChunkUSecs ? chunkTableSize : 0;
+	memset(profilePrims, 0, sizeof(profilePrims));
+	profileStartTime = microsecs();
+	profileUSecs = 0;
+	startAllocationRecording();
+	profiling = true;
+}
+
+static void stopProfiling() {
+	if (profiling) profileUSecs += microsecs() - profileStartTime;
+	profiling = false;
+}
+
+static int primNameInto(char *dst, int size, PrimitiveFunction primFunc) {
+	// Write "set:name" for the given primitive into dst and return its length.
+
+	for (int i = 0; i < PrimitiveSetCount; i++) {
+		PrimEntry *entries = primSets[i].entries;
+		for (int j = 0; j < primSets[i].entryCount; j++) {
+			if (primFunc == entries[j].primFunc) {
+				int len = snprintf(dst, size, "%s:%s", primSets[i].setName, entries[j].primName);
+				return (len < size) ? len : size - 1;
+			}
+		}
+	}
+	return snprintf(dst, size, "?");
+}
+
+static char profileBuf[400];
+static int profileBufCount = 0;
+
+static void flushProfileRecords() {
+	if (profileBufCount > 1) waitAndSendMessage(extendedMsg, 4, profileBufCount, profileBuf);
+	profileBufCount = 0;
+}
+
+static void addProfileRecord(int kind, uint8 *bytes, int byteCount) {
+	// Add a record to the current profile data message, sending the message first if
+	// it is full or if the record kind changes. Each message starts with the kind byte.
+
+	if ((profileBufCount > 0) &&
+		((kind != profileBuf[0]) || ((profileBufCount + byteCount) > (int) sizeof(profileBuf)))) {
+			flushProfileRecords();
+	}
+	if (0 == profileBufCount) profileBuf[profileBufCount++] = kind;
+	memcpy(&profileBuf[profileBufCount], bytes, byteCount);
+	profileBufCount += byteCount;
+}
+
+static void sendProfile() {
+	// Send the profile as a series of extended messages (msgID 4). The first data byte
+	// of each message is the record kind. All numbers are 32-bit little endian.
+	//	1: opcode counts:		<opcode (1 byte)><count>
+	//	2: chunk times:			<chunkIndex (2 bytes)><usecs>
+	//	3: primitive times:		<count><usecs><name length (1 byte)><set:name>
+	//	0: end of profile:		<total profiled usecs><profiling (1 byte)>
+
+	uint8 record[120];
+	for (int i = 0; i < 128; i++) {
+		if (!profileOpCounts[i]) continue;
+		record[0] = i;
+		addProfileRecord(1, record, 1 + putUInt32(&record[1], profileOpCounts[i]));
+	}
+	for (int i = 0; i < profileChunkCount; i++) {
+		if (!profileChunkUSecs[i]) continue;
+		record[0] = i & 0xFF;
+		record[1] = (i >> 8) & 0xFF;
+		addProfileRecord(2, record, 2 + putUInt32(&record[2], profileChunkUSecs[i]));
+	}
+	for (int i = 0; i < PROFILE_PRIMS; i++) {
+		PrimProfileEntry *entry = &profilePrims[i];
+		if (!entry->primFunc) break;
+		putUInt32(&record[0], entry->count);
+		putUInt32(&record[4], entry->usecs);
+		record[8] = primNameInto((char *) &record[9], 100, entry->primFunc);
+		addProfileRecord(3, record, 9 + record[8]);
+	}
+	uint32 totalUSecs = profileUSecs + (profiling ? (microsecs() - profileStartTime) : 0);
+	record[putUInt32(record, totalUSecs)] = profiling;
+	addProfileRecord(0, record, 5);
+	flushProfileRecords();
+}
+
+#endif // PROFILER
+
+// Garbage Collector Statistics
+
+static void sendGCStats() {
+	// Send the garbage collector statistics as extended message 5. All numbers are 32-bit
+	// little endian: <full GC count><incremental cycle count><total pause usecs>
+	// <max pause usecs><incremental max pause setting><pause histogram (GC_PAUSE_BUCKETS counts)>
+	// <nursery collection count>
+
+	uint8 data[4 * (6 + GC_PAUSE_BUCKETS)];
+	int count = 0;
+	count += putUInt32(&data[count], gcCount);
+	count += putUInt32(&data[count], gcCycleCount);
+	count += putUInt32(&data[count], gcTotalUSecs);
+	count += putUInt32(&data[count], gcMaxUSecs);
+	count += putUInt32(&data[count], gcMaxPauseUSecs);
+	for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+		count += putUInt32(&data[count], gcPauseHistogram[i]);
+	}
+	count += putUInt32(&data[count], gcMinorCount);
+	waitAndSendMessage(extendedMsg, 5, count, (char *) data);
+}
+
+// Heap Census
+
+static void sendHeapCensus() {
+	// Send a heap census (see heapCensus()) as extended message 6. All numbers are 32-bit
+	// little endian: <full GC count><total GC pause usecs><object store words>
+	// <largest free chunk words><count, words for each of CENSUS_TYPES types>
+	// <type, words, allocation site for each of the CENSUS_LARGEST largest objects>
+	// <unrecorded allocation count><site count><site, count, words for each site>
+
+	HeapCensus census;
+	heapCensus(&census);
+
+	uint8 data[4 * (5 + (2 * CENSUS_TYPES) + (3 * CENSUS_LARGEST) + (3 * CENSUS_SITES))];
+	int count = 0;
+	count += putUInt32(&data[count], gcCount);
+	count += putUInt32(&data[count], gcTotalUSecs);
+	count += putUInt32(&data[count], objectStoreBytes() / 4);
+	count += putUInt32(&data[count], census.largestFreeWords);
+	for (int i = 0; i < CENSUS_TYPES; i++) {
+		count += putUInt32(&data[count], census.count[i]);
+		count += putUInt32(&data[count], census.words[i]);
+	}
+	for (int i = 0; i < CENSUS_LARGEST; i++) {
+		OBJ obj = census.largest[i];
+		count += putUInt32(&data[count], obj ? TYPE(obj) : 0);
+		count += putUInt32(&data[count], obj ? WORDS(obj) : 0);
+		count += putUInt32(&data[count], census.largestSite[i]);
+	}
+	count += putUInt32(&data[count], census.unrecordedCount);
+	count += putUInt32(&data[count], census.siteCount);
+	for (int i = 0; i < census.siteCount; i++) {
+		count += putUInt32(&data[count], census.sites[i].site);
+		count += putUInt32(&data[count], census.sites[i].count);
+		count += putUInt32(&data[count], census.sites[i].words);
+	}
+	waitAndSendMessage(extendedMsg, 6, count, (char *) data);
+}
+
+// Resolved Primitive Cache
+
+// Maps the address of the second word of a primitive call instruction (the "call site")
+// to its PrimitiveFunction so the strcmp lookup of doPrimitiveCall() is done only once.
+// resolvedCalls is a hash table with one entry for every call site in the loaded chunks,
+// so callPrimitiveAt() finds its entry in constant time. It uses linear probing and is
+// kept at most half full. Call sites are always in the original code of a chunk, not its
+// fused copy (see FUSE_OPS). Entries are added when a chunk is stored, removed when it is
+// replaced or deleted, and cleared whenever code may have moved.
+
+typedef struct {
+	int16 *callSite; // NULL if the slot is empty
+	PrimitiveFunction primFunc;
+} ResolvedCall;
+
+static ResolvedCall *resolvedCalls = NULL;
+static int resolvedCount = 0;
+static int resolvedCapacity = 0; // always a power of two
+
+static PrimitiveFunction resolvePrimitive(int16 *callSite) {
+	// Return the primitive function for the given call site or NULL if not found.
+	// The call site word has the primitive set index in the top 6 bits and the
+	// offset to the primitive name literal in the low 10 bits.
+
+	int setIndex = (*callSite >> 10) & 0x3F;
+	if (setIndex >= PrimitiveSetCount) return NULL;
+	char *primName = obj2str((OBJ) (callSite + (*callSite & 0x3FF)));
+	PrimEntry *entries = primSets[setIndex].entries;
+	int entryCount = primSets[setIndex].entryCount;
+	for (int i = 0; i < entryCount; i++) {
+		if (0 == strcmp(entries[i].primName, primName)) return entries[i].primFunc;
+	}
+	return NULL;
+}
+
+static inline ResolvedCall *resolvedSlot(ResolvedCall *table, int capacity, int16 *callSite) {
+	// Return the slot for the given call site or, if there is none, the empty slot
+	// where it would be added. The table must have at least one empty slot.
+
+	uint32 hash = (uint32) ((size_t) callSite >> 1) * 2654435761U;
+	int mask = capacity - 1;
+	int i = (hash ^ (hash >> 16)) & mask;
+	while (table[i].callSite && (table[i].callSite != callSite)) i = (i + 1) & mask;
+	return &table[i];
+}
+
+static PrimitiveFunction resolvedPrimitive(int16 *callSite) {
+	// Return the cached primitive function for the given call site or NULL if none.
+
+	if (!resolvedCount) return NULL;
+	return resolvedSlot(resolvedCalls, resolvedCapacity, callSite)->primFunc;
+}
+
+static int rehashResolvedCalls(int newCapacity, int16 *start, int16 *end) {
+	// Copy the entries into a new table with the given capacity, omitting those for
+	// call sites in the given address range. Return false if there is not enough memory.
+
+	ResolvedCall *newTable = (ResolvedCall *) calloc(newCapacity, sizeof(ResolvedCall));
+	if (!newTable) return false;
+	int newCount = 0;
+	for (int i = 0; i < resolvedCapacity; i++) {
+		int16 *callSite = resolvedCalls[i].callSite;
+		if (!callSite || ((start <= callSite) && (callSite < end))) continue;
+		*resolvedSlot(newTable, newCapacity, callSite) = resolvedCalls[i];
+		newCount++;
+	}
+	free(resolvedCalls);
+	resolvedCalls = newTable;
+	resolvedCount = newCount;
+	resolvedCapacity = newCapacity;
+	return true;
+}
+
+static void addResolvedCall(int16 *callSite, PrimitiveFunction primFunc) {
+	if ((2 * (resolvedCount + 1)) > resolvedCapacity) {
+		int newCapacity = resolvedCapacity ? (2 * resolvedCapacity) : 64;
+		if (!rehashResolvedCalls(newCapacity, NULL, NULL)) return; // not enough memory; this call site will be resolved on every call
+	}
+	ResolvedCall *slot = resolvedSlot(resolvedCalls, resolvedCapacity, callSite);
+	if (!slot->callSite) resolvedCount++;
+	slot->callSite = callSite;
+	slot->primFunc = primFunc;
+}
+
+static void removeResolvedCalls(int16 *start, int16 *end) {
+	// Remove the entries for all call sites in the given address range. If there is
+	// not enough memory to rebuild the table, clear it; call sites are then resolved
+	// again when they are called.
+
+	if (!resolvedCount) return;
+	if (!rehashResolvedCalls(resolvedCapacity, start, end)) clearPrimitiveCache();
+}
+
+void clearPrimitiveCache() {
+	if (resolvedCount) memset(resolvedCalls, 0, resolvedCapacity * sizeof(ResolvedCall));
+	resolvedCount = 0;
+}
+
+void forgetPrimitivesInChunk(int *chunkCode) {
+	// Remove the call sites of the given code chunk (e.g. when it is replaced or deleted).
+
+	if (!chunkCode) return;
+	removeResolvedCalls((int16 *) chunkCode, (int16 *) (chunkCode + PERSISTENT_HEADER_WORDS + chunkCode[1]));
+}
+
+void cachePrimitivesInChunk(int *chunkCode) {
+	// Resolve all primitive calls in the given code chunk.
+
+	if (!chunkCode) return;
+	int16 *ip = (int16 *) (chunkCode + PERSISTENT_HEADER_WORDS);
+	int16 *end = ip + (2 * chunkCode[1]);
+	int16 *callSite;
+	while ((callSite = nextPrimitiveCallSite(&ip, end))) {
+		PrimitiveFunction primFunc = resolvePrimitive(callSite);
+		if (primFunc) addResolvedCall(callSite, primFunc);
+	}
+}
+
+OBJ callPrimitiveAt(int16 *callSite, int argCount, OBJ *args) {
+	// Call the primitive for the given call site. Call sites are resolved when their
+	// chunk is cached, so only an unknown primitive needs a lookup by name here.
+
+	PrimitiveFunction primFunc = resolvedPrimitive(callSite);
+	if (!primFunc) {
+		primFunc = resolvePrimitive(callSite);
+		if (!primFunc) { // report the error
+			char *primName = obj2str((OBJ) (callSite + (*callSite & 0x3FF)));
+			return doPrimitiveCall((*callSite >> 10) & 0x3F, primName, argCount, args);
+		}
+		addResolvedCall(callSite, primFunc);
+	}
+	return callPrimitive(primFunc, argCount, args);
+}
+
+OBJ callPrimitive(PrimitiveFunction primFunc, int argCount, OBJ *args) {
+	// Call the given primitive function, preparing slice arguments and profiling the call
+	// if necessary. Used for all primitive calls made by the interpreter.
+
+	#ifdef BYTE_SLICES
+		if (sliceCount) {
+			prepareSliceArgs(primFunc, argCount, args);
+			if (failure()) return falseObj;
+		}
+	#endif
+	#ifdef PROFILER
+		if (profiling) {
+			OBJ result = profiledPrimitiveCall(primFunc, argCount, args);
+			tempGCRoot = NULL; // clear tempGCRoot in case it was used
+			return result;
+		}
+	#endif
+	OBJ result = primFunc(argCount, args); // call the primitive
+	tempGCRoot = NULL; // clear tempGCRoot in case it was used
+	return result;
+}
+
+#ifdef BENCHMARK
+
+void primCallBenchmark() {
+	// Compare the speed of doPrimitiveCall() with a cached call to the same primitive.
+	// Built only for the benchmark program (see bench/bench.c).
+	// Uses [misc:connectedToIDE] since it is in the middle of its primitive table.
+	// The cache is filled with siteCount call sites, as for a large program, and the
+	// cached calls are spread over all of them.
+
+	const int iterations = 100000;
+	const int siteCount = 1000;
+	static int16 callSites[1000];
+	PrimitiveFunction primFunc = NULL;
+	PrimEntry *entries = primSets[MiscPrims].entries;
+	for (int i = 0; i < primSets[MiscPrims].entryCount; i++) {
+		if (0 == strcmp(entries[i].primName, "connectedToIDE")) primFunc = entries[i].primFunc;
+	}
+	if (!primFunc) return;
+
+	uint32 startT = microsecs();
+	for (int i = 0; i < iterations; i++) {
+		doPrimitiveCall(MiscPrims, "connectedToIDE", 0, NULL);
+	}
+	uint32 uncachedUsecs = microsecs() - startT;
+
+	for (int i = 0; i < siteCount; i++) addResolvedCall(&callSites[i], primFunc);
+	for (int i = 0; i < siteCount; i++) { // all call sites must be cached
+		if (resolvedPrimitive(&callSites[i]) != primFunc) {
+			removeResolvedCalls(callSites, &callSites[siteCount]);
+			printf("primCallBenchmark: not enough memory\n");
+			return;
+		}
+	}
+	startT = microsecs();
+	for (int i = 0; i < iterations; i++) {
+		callPrimitiveAt(&callSites[(i * 7) % siteCount], 0, NULL);
+	}
+	uint32 cachedUsecs = microsecs() - startT;
+	removeResolvedCalls(callSites, &callSites[siteCount]);
+	for (int i = 0; i < siteCount; i++) {
+		if (resolvedPrimitive(&callSites[i])) printf("primCallBenchmark: call site was not removed\n");
+	}
+
+	if (uncachedUsecs == 0) uncachedUsecs = 1;
+	if (cachedUsecs == 0) cachedUsecs = 1;
+	printf("Primitive calls/sec: doPrimitiveCall %d, cached %d\n",
+		(int) ((1000000LL * iterations) / uncachedUsecs),
+		(int) ((1000000LL * iterations) / cachedUsecs));
+}
+
+#endif // BENCHMARK
+
 void primsInit() {
 	// Called at startup to call functions to add named primitive sets.
 
@@ -171,48 +602,68 @@ void primsInit() {
 // Task Ops
 
 void initTasks() {
-	memset(tasks, 0, sizeof(tasks));
+	for (int i = 0; i < taskTableSize; i++) {
+		#ifdef GROWABLE_STACKS
+			freeTaskStack(tasks[i]);
+		#endif
+		memset(tasks[i], 0, sizeof(Task));
+	}
 	taskCount = 0;
 }
 
-void startTaskForChunk(uint8 chunkIndex) {
+void startTaskForChunk(int chunkIndex) {
 	// Start a task for the given chunk, if there is not one already.
 
+	if ((chunkIndex >= chunkTableSize) || !chunks[chunkIndex].code) return; // no such chunk
+
 	int i;
 	for (i = 0; i < taskCount; i++) {
-		if ((chunkIndex == tasks[i].taskChunkIndex) && tasks[i].status) {
+		if ((chunkIndex == tasks[i]->taskChunkIndex) && tasks[i]->status) {
 			return; // already running
 		}
 	}
-	for (i = 0; i < MAX_TASKS; i++) {
-		if (unusedTask == tasks[i].status) break;
+	for (i = 0; i < taskTableSize; i++) {
+		if (unusedTask == tasks[i]->status) break;
 	}
-	if (i >= MAX_TASKS) {
+	if ((i >= taskTableSize) && !growTaskTable()) {
 		outputString("No free task entries");
 		return;
 	}
 
-	memset(&tasks[i], 0, sizeof(Task));
-	tasks[i].status = running;
-	tasks[i].taskChunkIndex = chunkIndex;
-	tasks[i].currentChunkIndex = chunkIndex;
-	tasks[i].code = chunks[chunkIndex].code;
-	tasks[i].ip = 4; // offset is 4 short words (8 bytes) relative to start of the code chunk
-	tasks[i].sp = 0; // relative to start of stack
-	tasks[i].fp = 0; // 0 means "not in a function call"
+	Task *task = tasks[i];
+	#ifdef GROWABLE_STACKS
+		freeTaskStack(task);
+		memset(task, 0, sizeof(Task));
+		if (!growTaskStack(task, INITIAL_STACK_WORDS)) {
+			outputString("Not enough memory for task stack");
+			return;
+		}
+	#else
+		memset(task, 0, sizeof(Task));
+	#endif
+	task->status = running;
+	task->taskChunkIndex = chunkIndex;
+	task->currentChunkIndex = chunkIndex;
+	task->code = RUN_CODE(chunkIndex);
+	task->ip = 4; // offset is 4 short words (8 bytes) relative to start of the code chunk
+	task->sp = 0; // relative to start of stack
+	task->fp = 0; // 0 means "not in a function call"
 	if (i >= taskCount) taskCount = i + 1;
 	sendMessage(taskStartedMsg, chunkIndex, 0, NULL);
 }
 
-static void stopTaskForChunk(uint8 chunkIndex) {
+static void stopTaskForChunk(int chunkIndex) {
 	// Stop the task for the given chunk, if any.
 
 	int i;
-	for (i = 0; i < MAX_TASKS; i++) {
-		if (chunkIndex == tasks[i].taskChunkIndex) break;
+	for (i = 0; i < taskTableSize; i++) {
+		if (chunkIndex == tasks[i]->taskChunkIndex) break;
 	}
-	if (i >= MAX_TASKS) return; // no task for chunkIndex
-	memset(&tasks[i], 0, sizeof(Task)); // clear task
+	if (i >= taskTableSize) return; // no task for chunkIndex
+	#ifdef GROWABLE_STACKS
+		freeTaskStack(tasks[i]);
+	#endif
+	memset(tasks[i], 0, sizeof(Task)); // clear task
 	if (i == (taskCount - 1)) taskCount--;
 	sendMessage(taskDoneMsg, chunkIndex, 0, NULL);
 }
@@ -221,8 +672,8 @@ static void stopAllTasks() {
 	// Stop all tasks.
 
 	for (int t = 0; t < taskCount; t++) {
-		if (tasks[t].status) {
-			sendMessage(taskDoneMsg, tasks[t].taskChunkIndex, 0, NULL);
+		if (tasks[t]->status) {
+			sendMessage(taskDoneMsg, tasks[t]->taskChunkIndex, 0, NULL);
 		}
 	}
 	initTasks();
@@ -236,7 +687,7 @@ void startAll() {
 	softReset(true);
 	resetTimer();
 
-	for (int i = 0; i < MAX_CHUNKS; i++) {
+	for (int i = 0; i < chunkTableSize; i++) {
 		uint8 chunkType = chunks[i].chunkType;
 		if ((startHat == chunkType) || (whenConditionHat == chunkType)) {
 			startTaskForChunk(i);
@@ -247,10 +698,13 @@ void startAll() {
 void stopAllTasksButThis(Task *thisTask) {
 	// Stop all tasks except the given one.
 
-	for (int i = 0; i < MAX_TASKS; i++) {
-		Task *task = &tasks[i];
+	for (int i = 0; i < taskTableSize; i++) {
+		Task *task = tasks[i];
 		if ((task != thisTask) && task->status) {
 			sendMessage(taskDoneMsg, task->taskChunkIndex, 0, NULL);
+			#ifdef GROWABLE_STACKS
+				freeTaskStack(task);
+			#endif
 			memset(task, 0, sizeof(Task)); // clear task
 		}
 		if (task == thisTask) { taskCount = i + 1; }
@@ -263,7 +717,10 @@ void stopAllTasksButThis(Task *thisTask) {
 #define initLocals 9
 #define recvBroadcast 41
 
-int broadcastMatches(uint8 chunkIndex, char *msg, int byteCount) {
+static char * receiverName(int chunkIndex) {
+	// Return the broadcast name that the given chunk receives or NULL if it does not start
+	// with a receive. An empty name means "any message".
+
 	int16 *code = (int16 *) (chunks[chunkIndex].code + PERSISTENT_HEADER_WORDS);
 	// First three instructions of a broadcast hat should be:
 	//	initLocals
@@ -274,10 +731,15 @@ int broadcastMatches(uint8 chunkIndex, char *msg, int byteCount) {
 
 	if ((pushLiteral != CMD(code[1])) ||
 		(recvBroadcast != CMD(code[3]))) {
-			return false;
+			return NULL;
 	}
 	code++; // skip initLocals
-	char *s = obj2str((OBJ) (code + *(code + 1) + 1));
+	return obj2str((OBJ) (code + *(code + 1) + 1));
+}
+
+int broadcastMatches(int chunkIndex, char *msg, int byteCount) {
+	char *s = receiverName(chunkIndex);
+	if (!s) return false;
 	if (strlen(s) == 0) return true; // empty parameter in the receiver means "any message"
 	if (strlen(s) != byteCount) return false;
 	for (int i = 0; i < byteCount; i++) {
@@ -286,13 +748,118 @@ int broadcastMatches(uint8 chunkIndex, char *msg, int byteCount) {
 	return true;
 }
 
+#ifdef BROADCAST_INDEX
+
+// The receivers are grouped by the hash of their broadcast name into BROADCAST_BUCKETS
+// buckets, plus a final bucket for the "any message" receivers. The receivers of bucket i
+// are receivers[bucketStart[i]] through receivers[bucketStart[i + 1] - 1], in chunk order.
+
+#define BROADCAST_BUCKETS 32 // must be a power of 2!
+
+typedef struct {
+	uint32 hash;
+	char *name; // the literal in the receiver's code
+	uint16 chunkIndex;
+} BroadcastReceiver;
+
+static BroadcastReceiver *receivers = NULL;
+static int receiversSize = 0;
+static int bucketStart[BROADCAST_BUCKETS + 2];
+static int broadcastIndexValid = false;
+
+static uint32 broadcastHash(const char *msg, int byteCount) {
+	uint32 hash = 2166136261U; // FNV-1a
+	for (int i = 0; i < byteCount; i++) hash = (hash ^ (uint8) msg[i]) * 16777619U;
+	return hash;
+}
+
+void clearBroadcastIndex() {
+	broadcastIndexValid = false;
+}
+
+static char * indexedReceiverName(int chunkIndex) {
+	int chunkType = chunks[chunkIndex].chunkType;
+	if ((broadcastHat != chunkType) && (functionHat != chunkType)) return NULL;
+	return receiverName(chunkIndex);
+}
+
+static int bucketFor(char *name) {
+	int byteCount = strlen(name);
+	if (!byteCount) return BROADCAST_BUCKETS; // "any message" bucket
+	return broadcastHash(name, byteCount) & (BROADCAST_BUCKETS - 1);
+}
+
+static void buildBroadcastIndex() {
+	// Count the receivers in each bucket, then fill in the receivers of each bucket.
+	// If there is not enough memory, leave the index invalid; broadcasts scan all chunks.
+
+	int counts[BROADCAST_BUCKETS + 1];
+	memset(counts, 0, sizeof(counts));
+	for (int i = 0; i < chunkTableSize; i++) {
+		char *name = indexedReceiverName(i);
+		if (name) counts[bucketFor(name)]++;
+	}
+	int total = 0;
+	for (int b = 0; b <= BROADCAST_BUCKETS; b++) {
+		bucketStart[b] = total;
+		total += counts[b];
+	}
+	bucketStart[BROADCAST_BUCKETS + 1] = total;
+
+	if (total > receiversSize) {
+		BroadcastReceiver *newReceivers = (BroadcastReceiver *) realloc(receivers, total * sizeof(BroadcastReceiver));
+		if (!newReceivers) return;
+		receivers = newReceivers;
+		receiversSize = total;
+	}
+	memset(counts, 0, sizeof(counts));
+	for (int i = 0; i < chunkTableSize; i++) {
+		char *name = indexedReceiverName(i);
+		if (!name) continue;
+		int b = bucketFor(name);
+		BroadcastReceiver *r = &receivers[bucketStart[b] + counts[b]++];
+		r->hash = broadcastHash(name, strlen(name));
+		r->name = name;
+		r->chunkIndex = i;
+	}
+	broadcastIndexValid = true;
+}
+
+static void startIndexedReceivers(char *msg, int byteCount) {
+	uint32 hash = broadcastHash(msg, byteCount);
+	int b = byteCount ? (hash & (BROADCAST_BUCKETS - 1)) : BROADCAST_BUCKETS;
+	for (int i = bucketStart[b]; i < bucketStart[b + 1]; i++) {
+		BroadcastReceiver *r = &receivers[i];
+		if ((r->hash == hash) && (0 == strncmp(r->name, msg, byteCount)) && (0 == r->name[byteCount])) {
+			startTaskForChunk(r->chunkIndex); // only starts a new task if if chunk is not already running
+		}
+	}
+	if (BROADCAST_BUCKETS == b) return; // the message was empty; its receivers have been started
+	for (int i = bucketStart[BROADCAST_BUCKETS]; i < bucketStart[BROADCAST_BUCKETS + 1]; i++) {
+		startTaskForChunk(receivers[i].chunkIndex); // "any message" receivers
+	}
+}
+
+#endif
+
 extern OBJ lastBroadcast;
 
 void startReceiversOfBroadcast(char *msg, int byteCount) {
 	// Start tasks for chunks with hat blocks matching the given broadcast if not already running.
 
-	lastBroadcast = newStringFromBytes(msg, byteCount);
-	for (int i = 0; i < MAX_CHUNKS; i++) {
+	int sameAsLast = IS_TYPE(lastBroadcast, StringType) && objWords(lastBroadcast) &&
+		(0 == strncmp(obj2str(lastBroadcast), msg, byteCount)) && (0 == obj2str(lastBroadcast)[byteCount]);
+	if (!sameAsLast) lastBroadcast = internString(msg, byteCount);
+	signalEvents(EVENT_BROADCAST); // wake tasks waiting on the last broadcast
+
+	#ifdef BROADCAST_INDEX
+		if (!broadcastIndexValid) buildBroadcastIndex();
+		if (broadcastIndexValid) {
+			startIndexedReceivers(msg, byteCount);
+			return;
+		}
+	#endif
+	for (int i = 0; i < chunkTableSize; i++) {
 		int chunkType = chunks[i].chunkType;
 		if (((broadcastHat == chunkType) || (functionHat == chunkType)) && (broadcastMatches(i, msg, byteCount))) {
 			startTaskForChunk(i); // only starts a new task if if chunk is not already running
@@ -312,7 +879,7 @@ static char buttonAHandled = false;
 static char buttonBHandled = false;
 
 static void startButtonHats(int hatType) {
-	for (int i = 0; i < MAX_CHUNKS; i++) {
+	for (int i = 0; i < chunkTableSize; i++) {
 		if (hatType == chunks[i].chunkType) {
 			startTaskForChunk(i); // only starts a new task if if chunk is not already running
 		}
@@ -327,7 +894,7 @@ static int mustPollButtons() {
 		return true;
 	#endif
 
-	for (int i = 0; i < MAX_CHUNKS; i++) {
+	for (int i = 0; i < chunkTableSize; i++) {
 		int hatType = chunks[i].chunkType;
 		if ((buttonAHat <= hatType) && (hatType <= buttonsAandBHat)) {
 			return true;
@@ -338,22 +905,34 @@ static int mustPollButtons() {
 
 void checkButtons() {
 	// If button A, button B, or both are pressed, start tasks for all of the relevant
-	// hat blocks (if they are not already running). This check is done at most once
-	// every BUTTON_CHECK_INTERVAL microseconds.
+	// hat blocks (if they are not already running). Also report the buttons that tasks
+	// read to watchButton(), which wakes the tasks waiting on a button when it changes.
+	// This check is done at most once every BUTTON_CHECK_INTERVAL microseconds.
 
 	uint32 now = microsecs();
 	if (now < lastCheck) lastCheck = 0; // clock wrap
 	if ((now - lastCheck) < BUTTON_CHECK_INTERVAL) return; // not time yet
 	lastCheck = now;
 
-	if (!mustPollButtons()) return; // no need to poll buttons (allows button pins to be used for output)
+	// poll buttons only if needed (allows button pins to be used for output)
+	int mustPoll = mustPollButtons();
+	int watched = 0;
+	#ifdef EVENT_WAKEUPS
+		watched = buttonsWatched();
+	#endif
+	if (!mustPoll && !watched) return;
+
+	int buttonAIsDown = (mustPoll || (watched & WATCH_BUTTON_A)) ? (int) primButtonA(NULL) : false;
+	int buttonBIsDown = (mustPoll || (watched & WATCH_BUTTON_B)) ? (int) primButtonB(NULL) : false;
+	#ifdef EVENT_WAKEUPS
+		if (watched & WATCH_BUTTON_A) watchButton(WATCH_BUTTON_A, buttonAIsDown);
+		if (watched & WATCH_BUTTON_B) watchButton(WATCH_BUTTON_B, buttonBIsDown);
+	#endif
+	if (!mustPoll) return;
 
 	now = millisecs(); // use milliseconds for button timeouts
 	if (!now) now = 1; // the value is reserved to mean button is not down
 
-	int buttonAIsDown = (int) primButtonA(NULL);
-	int buttonBIsDown = (int) primButtonB(NULL);
-
 	if (buttonAIsDown && !buttonADownTime) { // button A up -> down
 		buttonADownTime = now;
 		if (buttonBDownTime) {
@@ -410,13 +989,19 @@ void checkButtons() {
 
 // Store Ops
 
-static void storeCodeChunk(uint8 chunkIndex, int byteCount, uint8 *data) {
-	if (chunkIndex >= MAX_CHUNKS) return;
+static void storeCodeChunk(int chunkIndex, int byteCount, uint8 *data) {
+	if (!growChunkTable(chunkIndex)) return;
 	stopTaskForChunk(chunkIndex);
 	int chunkType = data[0]; // first byte is the chunk type
 	int *persistenChunk = appendPersistentRecord(chunkCode, chunkIndex, chunkType, byteCount - 1, &data[1]);
+	releaseFusedChunk(chunkIndex);
+	forgetPrimitivesInChunk(chunks[chunkIndex].code);
 	chunks[chunkIndex].code = persistenChunk;
 	chunks[chunkIndex].chunkType = chunkType;
+	fuseChunk(chunkIndex);
+	cachePrimitivesInChunk(chunks[chunkIndex].code);
+	clearCalleeCache();
+	clearBroadcastIndex();
 }
 
 static void storeVarName(uint8 varIndex, int byteCount, uint8 *data) {
@@ -425,17 +1010,22 @@ static void storeVarName(uint8 varIndex, int byteCount, uint8 *data) {
 	uint8 *dst = buf;
 	for (int i = 0; i < byteCount; i++) *dst++ = data[i];
 	*dst = 0; // null terminate
-	appendPersistentRecord(varName, varIndex, 0, (byteCount + 1), buf);
+	int *rec = appendPersistentRecord(varName, varIndex, 0, (byteCount + 1), buf);
+	if (rec) addVarNameToIndex(varIndex, rec);
 }
 
 // Delete Ops
 
-static void deleteCodeChunk(uint8 chunkIndex) {
-	if (chunkIndex >= MAX_CHUNKS) return;
+static void deleteCodeChunk(int chunkIndex) {
+	if (chunkIndex >= chunkTableSize) return;
 	stopTaskForChunk(chunkIndex);
+	releaseFusedChunk(chunkIndex);
+	forgetPrimitivesInChunk(chunks[chunkIndex].code);
 	chunks[chunkIndex].code = NULL;
 	chunks[chunkIndex].chunkType = unusedChunk;
 	appendPersistentRecord(chunkDeleted, chunkIndex, 0, 0, NULL);
+	clearCalleeCache();
+	clearBroadcastIndex();
 }
 
 static void deleteAllChunks() {
@@ -446,12 +1036,17 @@ static void deleteAllChunks() {
 	#else
 		appendPersistentRecord(deleteAll, 0, 0, 0, NULL);
 	#endif
-	memset(chunks, 0, sizeof(chunks));
+	clearChunkTable();
+	clearPrimitiveCache();
+	clearCalleeCache();
+	clearBroadcastIndex();
+	updateVarNameIndex();
 }
 
 static void clearAllVariables() {
 	// Clear variable name records (but don't clear the variable values).
 	appendPersistentRecord(varsClearAll, 0, 0, 0, NULL);
+	updateVarNameIndex();
 }
 
 // Extended Messages
@@ -471,6 +1066,22 @@ static void processExtendedMessage(uint8 msgID, int byteCount, uint8 *data) {
 	case 3: // save the entire RAM code store to the code file and resume incremental saving
 		resumeCodeFileUpdates();
 		break;
+#ifdef PROFILER
+	case 4: // profiler control: 0 - stop, 1 - clear and start, 2 - send profile
+		if (byteCount < 1) break;
+		if (0 == *data) stopProfiling();
+		if (1 == *data) startProfiling();
+		if (2 == *data) sendProfile();
+		break;
+#endif
+	case 5: // garbage collector statistics: 0 - clear, 1 - send
+		if (byteCount < 1) break;
+		if (0 == *data) clearGCStats();
+		if (1 == *data) sendGCStats();
+		break;
+	case 6: // heap census
+		sendHeapCensus();
+		break;
 	}
 }
 
@@ -523,6 +1134,15 @@ static int outBufEnd = 0;
 
 #define OUTBUF_BYTES() ((outBufEnd - outBufStart) & OUTBUF_MASK)
 
+// When DUAL_CORE is defined, bytes to and from the IDE go through the I/O core
+#ifdef DUAL_CORE
+	#define IDE_RECV_BYTES dualCoreRecvBytes
+	#define IDE_SEND_BYTES dualCoreSendBytes
+#else
+	#define IDE_RECV_BYTES recvBytes
+	#define IDE_SEND_BYTES sendBytes
+#endif
+
 static void sendData() {
 #ifdef EMSCRIPTEN
 	// xxx can this special case for EMSCRIPTEN be removed? try it and test w/ boardie.
@@ -540,11 +1160,11 @@ static void sendData() {
 	int byteCount = 0;
 
 	if (outBufStart > outBufEnd) {
-		byteCount = sendBytes(outBuf, outBufStart, OUTBUF_SIZE);
+		byteCount = IDE_SEND_BYTES(outBuf, outBufStart, OUTBUF_SIZE);
 		outBufStart = (outBufStart + byteCount) & OUTBUF_MASK;
 	}
 	if (outBufStart < outBufEnd) {
-		byteCount = sendBytes(outBuf, outBufStart, outBufEnd);
+		byteCount = IDE_SEND_BYTES(outBuf, outBufStart, outBufEnd);
 		outBufStart = (outBufStart + byteCount) & OUTBUF_MASK;
 	}
 #endif
@@ -555,26 +1175,41 @@ static inline void queueByte(uint8 aByte) {
 	outBufEnd = (outBufEnd + 1) & OUTBUF_MASK;
 }
 
-static void sendMessage(int msgType, int chunkIndex, int dataSize, char *data) {
-	if (!data) { // short message
+static void queueHeader(int msgType, int chunkIndex, int wide, int dataSize) {
+	// Queue the header of a long message or, if wide is true, of a wide message.
+	// Wide messages have a 16-bit chunk index (low byte first) and may have no data.
+
+	queueByte(wide ? 252 : 251);
+	queueByte(msgType);
+	queueByte(chunkIndex & 0xFF);
+	if (wide) queueByte((chunkIndex >> 8) & 0xFF);
+	queueByte(dataSize & 0xFF); // low byte of size
+	queueByte((dataSize >> 8) & 0xFF); // high byte of size
+}
+
+static void sendMessageWithHeader(int msgType, int chunkIndex, int wide, int dataSize, char *data) {
+	// Send a message using a wide header if wide is true. Chunk indices over 255 need one.
+
+	if (!data && !wide) { // short message
 		if (!hasOutputSpace(3)) return; // no space; drop message
 		queueByte(250);
 		queueByte(msgType);
 		queueByte(chunkIndex);
 	} else {
-		int totalBytes = 5 + dataSize;
+		if (!data) dataSize = 0; // wide message with no data
+		int totalBytes = (wide ? 6 : 5) + dataSize;
 		if (!hasOutputSpace(totalBytes)) return; // no space; drop message
-		queueByte(251);
-		queueByte(msgType);
-		queueByte(chunkIndex);
-		queueByte(dataSize & 0xFF); // low byte of size
-		queueByte((dataSize >> 8) & 0xFF); // high byte of size
+		queueHeader(msgType, chunkIndex, wide, dataSize);
 		for (int i = 0; i < dataSize; i++) {
 			queueByte(data[i]);
 		}
 	}
 }
 
+static void sendMessage(int msgType, int chunkIndex, int dataSize, char *data) {
+	sendMessageWithHeader(msgType, chunkIndex, (chunkIndex > 255), dataSize, data);
+}
+
 int hasOutputSpace(int byteCount) { return ((OUTBUF_MASK - OUTBUF_BYTES()) > byteCount); }
 
 static void waitForOutbufBytes(int bytesNeeded) {
@@ -588,11 +1223,11 @@ static void waitForOutbufBytes(int bytesNeeded) {
 void waitAndSendMessage(int msgType, int chunkIndex, int dataSize, char *data) {
 	// Wait for space, then send the given message.
 
-	waitForOutbufBytes(dataSize + 5);
+	waitForOutbufBytes(dataSize + 6);
 	sendMessage(msgType, chunkIndex, dataSize, data);
 }
 
-static void sendValueMessage(uint8 msgType, uint8 chunkOrVarIndex, OBJ value) {
+static void sendValueMessage(uint8 msgType, int chunkOrVarIndex, OBJ value) {
 	// Send a value message of the given type for the given chunkOrVarIndex.
 	// Data is: <type (1 byte)><...data...>
 	// Types: 1 - integer, 2 - string, 3 - boolean, 4 - list, 5 - bytearray
@@ -666,9 +1301,9 @@ static void sendValueMessage(uint8 msgType, uint8 chunkOrVarIndex, OBJ value) {
 				*dst++ = n & 0xFF;
 				*dst++ = (n >> 8) & 0xFF;
 				*dst++ = 0; // send zero items of sublists
-			} else if (ByteArrayType == type) { // bytearray within a list; send bytecount only
+			} else if ((ByteArrayType == type) || (SliceType == type)) { // bytearray within a list; send bytecount only
 				*dst++ = 5; // item type (5 is bytearray)
-				int n = BYTES(item); // bytecount item
+				int n = (SliceType == type) ? SLICE_COUNT(item) : BYTES(item); // bytecount item
 				*dst++ = n & 0xFF;
 				*dst++ = (n >> 8) & 0xFF;
 				*dst++ = 0; // send zero bytes
@@ -677,14 +1312,15 @@ static void sendValueMessage(uint8 msgType, uint8 chunkOrVarIndex, OBJ value) {
 			}
 		}
 		sendMessage(msgType, chunkOrVarIndex, (dst - data), data);
-	} else if (IS_TYPE(value, ByteArrayType)) {
+	} else if (IS_TYPE(value, ByteArrayType) || IS_TYPE(value, SliceType)) {
 		data[0] = 5; // data type (5 is bytearray)
 		char *dst = &data[1];
 		// total bytecount
-		int byteCount = BYTES(value);
+		int isSlice = IS_TYPE(value, SliceType);
+		int byteCount = isSlice ? SLICE_COUNT(value) : BYTES(value);
 		*dst++ = byteCount & 0xFF;
 		*dst++ = (byteCount >> 8) & 0xFF;
-		uint8 *bytes = (uint8 *) &FIELD(value, 0);
+		uint8 *bytes = isSlice ? SLICE_BYTES(value) : (uint8 *) &FIELD(value, 0);
 		int sendCount = (byteCount < 100) ? byteCount : 100; // send up to 100 bytes
 		*dst++ = sendCount;
 		for (int i = 0; i < sendCount; i++) {
@@ -727,24 +1363,27 @@ void outputString(const char *s) {
 	// while (outBufStart != outBufEnd) sendData(); // wait for string to be sent
 }
 
-void sendTaskDone(uint8 chunkIndex) {
+void sendTaskDone(int chunkIndex) {
 	sendMessage(taskDoneMsg, chunkIndex, 0, NULL);
 }
 
-void sendTaskError(uint8 chunkIndex, uint8 errorCode, int where) {
+void sendTaskError(int chunkIndex, uint8 errorCode, int ipOffset, int whereChunkIndex) {
 	// Send a task error message: one-byte error code + 4-byte location.
-	// Location is
+	// Location is <22 bit ip><8 bit chunkIndex> or, if either chunk index is over 255,
+	// <16 bit ip><16 bit chunkIndex> in a wide message, so the IDE can tell them apart.
 
+	int wide = (chunkIndex > 255) || (whereChunkIndex > 255);
+	int where = wide ? ((ipOffset << 16) | whereChunkIndex) : ((ipOffset << 8) | whereChunkIndex);
 	char data[5];
 	data[0] = (errorCode & 0xFF); // one byte error code
 	data[1] = (where & 0xFF);
 	data[2] = ((where >> 8) & 0xFF);
 	data[3] = ((where >> 16) & 0xFF);
 	data[4] = ((where >> 24) & 0xFF);
-	sendMessage(taskErrorMsg, chunkIndex, sizeof(data), data);
+	sendMessageWithHeader(taskErrorMsg, chunkIndex, wide, sizeof(data), data);
 }
 
-void sendTaskReturnValue(uint8 chunkIndex, OBJ returnValue) {
+void sendTaskReturnValue(int chunkIndex, OBJ returnValue) {
 	// Send the value returned by the task for the given chunk.
 
 	sendValueMessage(taskReturnedValueMsg, chunkIndex, returnValue);
@@ -756,7 +1395,7 @@ static void sendVariableValue(int varID) {
 	}
 }
 
-static void sendValueOfVariableNamed(uint8 chunkIndex, int byteCount, uint8 *data) {
+static void sendValueOfVariableNamed(int chunkIndex, int byteCount, uint8 *data) {
 	char varName[100];
 	if (byteCount > 99) return; // variable name too long; ignore request
 	memcpy(varName, &data[0], byteCount);
@@ -803,7 +1442,7 @@ void sendBroadcastToIDE(char *s, int len) {
 	sendMessage(broadcastMsg, 0, len, s);
 }
 
-void sendSayForChunk(char *s, int len, uint8 chunkIndex) {
+void sendSayForChunk(char *s, int len, int chunkIndex) {
 	// Used by the "say" primitive. The buffer s includes the string value type byte.
 	sendMessage(outputValueMsg, chunkIndex, len, s);
 }
@@ -856,38 +1495,38 @@ uint32_t crc32(uint8_t *buf, int byteCount) {
 static void sendChunkCRC(int chunkID) {
 	// Send the 4-byte CRC-32 for the given chunk. Do nothing if the chunk is not in use.
 
-	if ((chunkID < 0) || (chunkID >= MAX_CHUNKS)) return;
+	if ((chunkID < 0) || (chunkID >= chunkTableSize)) return;
 	OBJ code = chunks[chunkID].code;
 	if (code) {
 		int wordCount = *(code + 1); // size is the second word in the persistent store record
 		uint8_t *chunkData = (uint8_t *) (code + PERSISTENT_HEADER_WORDS);
 		uint32_t crc = crc32(chunkData, (4 * wordCount));
-		waitForOutbufBytes(9);
+		waitForOutbufBytes(10);
 		sendMessage(chunkCRCMsg, chunkID, 4, (char *) &crc);
 		sendData();
 	}
 }
 
 void sendAllCRCs() {
+	// The allCRCs message has one-byte chunk IDs, so the CRCs of chunks over 255
+	// are sent afterwards as separate (wide) chunkCRC messages.
+
 	// count chunks
 	int chunkCount = 0;
-	for (int i = 0; i < MAX_CHUNKS; i++) {
+	int narrowCount = (chunkTableSize < 256) ? chunkTableSize : 256;
+	for (int i = 0; i < narrowCount; i++) {
 		if (chunks[i].code) chunkCount++;
 	}
 
 	// send message header
 	int dataSize = 5 * chunkCount;
 	waitForOutbufBytes(10);
-	queueByte(251);
-	queueByte(allCRCsMsg);
-	queueByte(0);
-	queueByte(dataSize & 0xFF); // low byte of size
-	queueByte((dataSize >> 8) & 0xFF); // high byte of size
+	queueHeader(allCRCsMsg, 0, false, dataSize);
 
 	// send CRC records for chunks in use
 	// each record is 5 bytes: chunkID (one byte) + the CRC for that chunk (four bytes)
 	int delayPerCRC = extraByteDelay / 250;  // msec delay for 4 bytes (extraByteDelay is in usecs)
-	for (int i = 0; i < MAX_CHUNKS; i++) {
+	for (int i = 0; i < narrowCount; i++) {
 		if (chunks[i].code) {
 			OBJ code = chunks[i].code;
 			int wordCount = *(code + 1); // size is the second word in the persistent store record
@@ -903,6 +1542,12 @@ void sendAllCRCs() {
 			delay(delayPerCRC);
 		}
 	}
+	for (int i = narrowCount; i < chunkTableSize; i++) {
+		if (chunks[i].code) {
+			sendChunkCRC(i);
+			delay(delayPerCRC);
+		}
+	}
 	deferIDEDisconnect();
 }
 
@@ -910,12 +1555,8 @@ void sendAllCRCs() {
 
 static void sendCodeChunk(int chunkID, int chunkType, int chunkBytes, char *chunkData) {
 	int msgSize = 1 + chunkBytes;
-	waitForOutbufBytes(5 + msgSize);
-	queueByte(251);
-	queueByte(chunkCode16Msg);
-	queueByte(chunkID);
-	queueByte(msgSize & 0xFF); // low byte of size
-	queueByte((msgSize >> 8) & 0xFF); // high byte of size
+	waitForOutbufBytes(6 + msgSize);
+	queueHeader(chunkCode16Msg, chunkID, (chunkID > 255), msgSize);
 	queueByte(chunkType); // first byte of msg body is the chunk type
 	char *end = chunkData + chunkBytes;
 	for (char *p = chunkData; p < end; p++) {
@@ -927,7 +1568,7 @@ static void sendAllCode() {
 	// Send the code for all chunks to the IDE.
 
 	int delayPerWord = extraByteDelay / 250; // derive from extraByteDelay
-	for (int chunkID = 0; chunkID < MAX_CHUNKS; chunkID++) {
+	for (int chunkID = 0; chunkID < chunkTableSize; chunkID++) {
 		OBJ code = chunks[chunkID].code;
 		if (NULL == code) continue; // skip unused chunk entry
 
@@ -969,7 +1610,7 @@ static int* varsStart() {
 	int *result = p;
 	while (p) {
 		if (varsClearAll == ((*p >> 16) & 0xFF)) result = p;
-		p = recordAfter(p);
+		p = scanNext(p);
 	}
 	return result;
 }
@@ -982,29 +1623,107 @@ static void sendVarNames() {
 		int recType = (*p >> 16) & 0xFF;
 		int varID = (*p >> 8) & 0xFF;
 		if (recType == varName) sendVarNameMessage(varID, p);
-		p = recordAfter(p);
+		p = scanNext(p);
 	}
 	deferIDEDisconnect();
 }
 
-int indexOfVarNamed(const char *s) {
-	// Return the index of the given variable or -1 if not found.
+// Variable Name Index
+//
+// Maps variable names to variable indices without scanning the persistent records. Each
+// variable's current name record is kept in varNameRecs. varNameTable is an open-addressed
+// hash table of variable indices plus one (zero marks an empty slot). When a variable is
+// renamed, its old table entry is left in place; lookups skip it because the name no longer
+// matches, and the table is rebuilt when it fills up. If several variables have the same
+// name, lookups return the one whose name record is the most recent. The index is rebuilt from the records
+// whenever they are restored, compacted, or cleared (see updateChunkTable() in persist.c).
+
+#define VAR_TABLE_SIZE 256 // power of two greater than MAX_VARS
 
-	int result = -1; // default is not found
+static int *varNameRecs[MAX_VARS];
+static uint8 varNameTable[VAR_TABLE_SIZE];
+static int varTableEntries = 0;
+
+#define VAR_NAME(varIndex) ((char *) (varNameRecs[varIndex] + 2))
+
+static uint32 varNameHash(const char *s) {
+	uint32 hash = 2166136261U; // FNV-1a
+	while (*s) hash = (hash ^ (uint8) *s++) * 16777619U;
+	return hash;
+}
+
+static void insertVarName(int varIndex) {
+	// Add the current name of the given variable to varNameTable unless the probe sequence
+	// for that name already includes an entry for this variable.
+
+	char *name = VAR_NAME(varIndex);
+	int i = varNameHash(name) & (VAR_TABLE_SIZE - 1);
+	while (varNameTable[i]) {
+		if ((varNameTable[i] - 1) == varIndex) return;
+		i = (i + 1) & (VAR_TABLE_SIZE - 1);
+	}
+	varNameTable[i] = varIndex + 1;
+	varTableEntries++;
+}
+
+static void rehashVarNames() {
+	memset(varNameTable, 0, sizeof(varNameTable));
+	varTableEntries = 0;
+	for (int i = 0; i < MAX_VARS; i++) {
+		if (varNameRecs[i]) insertVarName(i);
+	}
+}
+
+void updateVarNameIndex() {
+	// Rebuild the variable name index from the persistent records.
+
+	memset(varNameRecs, 0, sizeof(varNameRecs));
 	int *p = varsStart();
 	while (p) {
 		int recType = (*p >> 16) & 0xFF;
 		int id = (*p >> 8) & 0xFF;
 		if (recType == varName) {
-			if (0 == strcmp(s, (char *) (p + 2))) result = id;
+			if (id < MAX_VARS) varNameRecs[id] = p;
 		} else if (recType == varsClearAll) {
-			result = -1;
+			memset(varNameRecs, 0, sizeof(varNameRecs));
 		}
-		p = recordAfter(p);
+		p = scanNext(p);
+	}
+	rehashVarNames();
+}
+
+static void addVarNameToIndex(int varIndex, int *nameRec) {
+	if (varIndex >= MAX_VARS) return;
+	varNameRecs[varIndex] = nameRec;
+	if ((4 * (varTableEntries + 1)) > (3 * VAR_TABLE_SIZE)) {
+		rehashVarNames(); // drop the entries for old names
+	} else {
+		insertVarName(varIndex);
+	}
+}
+
+int indexOfVarNamed(const char *s) {
+	// Return the index of the given variable or -1 if not found.
+
+	int result = -1;
+	int i = varNameHash(s) & (VAR_TABLE_SIZE - 1);
+	while (varNameTable[i]) {
+		int id = varNameTable[i] - 1;
+		if (varNameRecs[id] && (0 == strcmp(s, VAR_NAME(id)))) {
+			if ((result < 0) || (varNameRecs[id] > varNameRecs[result])) result = id;
+		}
+		i = (i + 1) & (VAR_TABLE_SIZE - 1);
 	}
 	return result;
 }
 
+char * varNameAt(int varIndex) {
+	// Return the name of the variable with the given index or NULL if it has no name.
+
+	if ((varIndex < 0) || (varIndex >= MAX_VARS) || !varNameRecs[varIndex]) return NULL;
+	return VAR_NAME(varIndex);
+}
+
 // Receiving Messages from IDE
 
 #define RCVBUF_SIZE 1024
@@ -1017,7 +1736,7 @@ static void skipToStartByteAfter(int startIndex) {
 	int i, nextStart = -1;
 	for (i = startIndex; i < rcvByteCount; i++) {
 		int b = rcvBuf[i];
-		if ((0xFA == b) || (0xFB == b)) {
+		if ((0xFA == b) || (0xFB == b) || (0xFC == b)) {
 			if ((i + 1) < rcvByteCount) {
 				b = rcvBuf[i + 1];
 				if ((b == 0) || ((b > LAST_MSG) && (b < 200))) continue; // illegal msg type; keep scanning
@@ -1070,15 +1789,7 @@ static void sendPingNow(int chunkIndex) {
 	sendData();
 }
 
-static void processShortMessage() {
-	if (rcvByteCount < 3) { // message is not complete
-		if (receiveTimeout()) {
-			skipToStartByteAfter(1);
-		}
-		return; // message incomplete
-	}
-	int cmd = rcvBuf[1];
-	int chunkIndex = rcvBuf[2];
+static void processShortCommand(int cmd, int chunkIndex) {
 	switch (cmd) {
 	case deleteChunkMsg:
 		deleteCodeChunk(chunkIndex);
@@ -1154,59 +1865,100 @@ static void processShortMessage() {
 			sendData();
 		}
 	}
-	skipToStartByteAfter(3);
 }
 
-static void processLongMessage() {
-	int msgLength = (rcvBuf[4] << 8) | rcvBuf[3];
-	if ((rcvByteCount >= 5) && (msgLength > MAX_MSG_SIZE)) { // message too large for buffer
-		skipToStartByteAfter(1);
-		return;
-	}
-	if ((rcvByteCount < 5) || (rcvByteCount < (5 + msgLength))) { // message is not complete
-		if (receiveTimeout()) {
-			skipToStartByteAfter(1);
-		}
-		return; // message incomplete
-	}
-	if (0xFE != rcvBuf[5 + msgLength - 1]) { // chunk does not end with a terminator byte
-		skipToStartByteAfter(1);
-		return;
-	}
-	int cmd = rcvBuf[1];
-	int chunkIndex = rcvBuf[2];
-	int bodyBytes = msgLength - 1; // subtract terminator byte
+static void processLongCommand(int cmd, int chunkIndex, int bodyBytes, uint8 *body) {
 	switch (cmd) {
 	case chunkCode16Msg: // code chunk from 16-bit IDE
 		sendPingNow(chunkIndex); // send a ping to acknowledge receipt
-		storeCodeChunk(chunkIndex, bodyBytes, &rcvBuf[5]);
+		storeCodeChunk(chunkIndex, bodyBytes, body);
 		sendChunkCRC(chunkIndex);
 		break;
 	case setVarMsg:
-		setVariableValue(rcvBuf[2], bodyBytes, &rcvBuf[5]);
+		setVariableValue(chunkIndex, bodyBytes, body);
 		break;
 	case getVarMsg:
-		sendValueOfVariableNamed(chunkIndex, bodyBytes, &rcvBuf[5]);
+		sendValueOfVariableNamed(chunkIndex, bodyBytes, body);
 		break;
 	case broadcastMsg:
-		startReceiversOfBroadcast((char *) &rcvBuf[5], bodyBytes);
+		startReceiversOfBroadcast((char *) body, bodyBytes);
 		break;
 	case varNameMsg:
-		storeVarName(chunkIndex, bodyBytes, &rcvBuf[5]);
+		storeVarName(chunkIndex, bodyBytes, body);
 		sendPingNow(chunkIndex); // send a ping to acknowledge save
 		break;
 	case extendedMsg:
-		processExtendedMessage(chunkIndex, bodyBytes, &rcvBuf[5]);
+		processExtendedMessage(chunkIndex, bodyBytes, body);
 		break;
 	default:
 		if ((200 <= cmd) && (cmd <= 205)) {
-			processFileMessage(cmd, bodyBytes, (char *) &rcvBuf[5]);
+			processFileMessage(cmd, bodyBytes, (char *) body);
 			sendData();
 		}
 	}
+}
+
+static void processShortMessage() {
+	if (rcvByteCount < 3) { // message is not complete
+		if (receiveTimeout()) {
+			skipToStartByteAfter(1);
+		}
+		return; // message incomplete
+	}
+	processShortCommand(rcvBuf[1], rcvBuf[2]);
+	skipToStartByteAfter(3);
+}
+
+static void processLongMessage() {
+	int msgLength = (rcvBuf[4] << 8) | rcvBuf[3];
+	if ((rcvByteCount >= 5) && (msgLength > MAX_MSG_SIZE)) { // message too large for buffer
+		skipToStartByteAfter(1);
+		return;
+	}
+	if ((rcvByteCount < 5) || (rcvByteCount < (5 + msgLength))) { // message is not complete
+		if (receiveTimeout()) {
+			skipToStartByteAfter(1);
+		}
+		return; // message incomplete
+	}
+	if (0xFE != rcvBuf[5 + msgLength - 1]) { // chunk does not end with a terminator byte
+		skipToStartByteAfter(1);
+		return;
+	}
+	int bodyBytes = msgLength - 1; // subtract terminator byte
+	processLongCommand(rcvBuf[1], rcvBuf[2], bodyBytes, &rcvBuf[5]);
 	skipToStartByteAfter(5 + msgLength);
 }
 
+static void processWideMessage() {
+	// A wide message is used for chunk indices over 255. It has the form:
+	//	0xFC, cmd, chunkIndex (low byte), chunkIndex (high byte), size (low byte), size (high byte), body, 0xFE
+	// A wide message with a size of zero has no body or terminator and is handled like a short message.
+
+	int msgLength = (rcvBuf[5] << 8) | rcvBuf[4];
+	if ((rcvByteCount >= 6) && (msgLength > MAX_MSG_SIZE)) { // message too large for buffer
+		skipToStartByteAfter(1);
+		return;
+	}
+	if ((rcvByteCount < 6) || (rcvByteCount < (6 + msgLength))) { // message is not complete
+		if (receiveTimeout()) {
+			skipToStartByteAfter(1);
+		}
+		return; // message incomplete
+	}
+	int cmd = rcvBuf[1];
+	int chunkIndex = (rcvBuf[3] << 8) | rcvBuf[2];
+	if (0 == msgLength) {
+		processShortCommand(cmd, chunkIndex);
+	} else if (0xFE == rcvBuf[6 + msgLength - 1]) {
+		processLongCommand(cmd, chunkIndex, msgLength - 1, &rcvBuf[6]);
+	} else { // message does not end with a terminator byte
+		skipToStartByteAfter(1);
+		return;
+	}
+	skipToStartByteAfter(6 + msgLength);
+}
+
 // Uncomment when building on mbed:
 // static void busyWaitMicrosecs(int usecs) {
 //	uint32 start = microsecs();
@@ -1214,7 +1966,7 @@ static void processLongMessage() {
 // }
 
 void captureIncomingBytes() {
-	int bytesRead = recvBytes(&rcvBuf[rcvByteCount], RCVBUF_SIZE - rcvByteCount);
+	int bytesRead = IDE_RECV_BYTES(&rcvBuf[rcvByteCount], RCVBUF_SIZE - rcvByteCount);
 	rcvByteCount += bytesRead;
 	// uncomment to check for serial buffer overruns:
 	// if (bytesRead > 49) reportNum("bytesRead", bytesRead);
@@ -1224,7 +1976,7 @@ void processMessage() {
 	// Process a message from the client.
 	sendData();
 
-	int bytesRead = recvBytes(&rcvBuf[rcvByteCount], RCVBUF_SIZE - rcvByteCount);
+	int bytesRead = IDE_RECV_BYTES(&rcvBuf[rcvByteCount], RCVBUF_SIZE - rcvByteCount);
 	// uncomment to check for serial buffer overruns:
 	// if (bytesRead > 49) reportNum("bytesRead", bytesRead);
 	rcvByteCount += bytesRead;
@@ -1244,7 +1996,10 @@ void processMessage() {
 		processShortMessage();
 	} else if (0xFB == firstByte) {
 		processLongMessage();
+	} else if (0xFC == firstByte) {
+		processWideMessage();
 	} else {
 		skipToStartByteAfter(1); // bad message, probably due to dropped bytes
 	}
+	signalEvents(EVENT_ALL); // the message may have changed a variable or started a task
 }
@@ -272,6 +272,7 @@ static OBJ primI2cRead(int argCount, OBJ *args) {
 	if (IS_TYPE(obj, ListType)) {
 		count = obj2int(FIELD(obj, 0));
 	} else if (IS_TYPE(obj, ByteArrayType)) {
+		if (!UNSHARE_BYTES(obj)) return zeroObj; // allocation failed
 		count = BYTES(obj);
 		bytes = (uint8 *) &FIELD(obj, 0);
 	} else {
@@ -297,6 +298,7 @@ static OBJ primI2cRead(int argCount, OBJ *args) {
 		if (bytes) {
 			bytes[i] = byte;
 		} else {
+			GC_WRITE_BARRIER(FIELD(obj, i + 1));
 			FIELD(obj, i + 1) = int2obj(byte);
 		}
 	}
@@ -501,6 +503,7 @@ OBJ primSPISetup(int argCount, OBJ *args) {
 
 OBJ primSPIExchange(int argCount, OBJ *args) {
 	if ((argCount < 1) || (objType(args[0]) != ByteArrayType)) return falseObj;
+	if (!UNSHARE_BYTES(args[0])) return falseObj; // allocation failed
 
 	unsigned char *data = (unsigned char *) &FIELD(args[0], 0);
 	int byteCount = BYTES(args[0]);
@@ -317,6 +317,36 @@ static void serialWriteSync(uint8 *buf, int bytesToWrite) {
 	}
 }
 
+// event wakeups (see interp.h)
+
+#ifdef EVENT_WAKEUPS
+
+static int lastAvailable = 0; // byte count last seen by a task or by serialInputArrived()
+
+static void noteSerialInput(int byteCount) {
+	// Called when a task finds too few bytes available; more bytes will wake it.
+	// If the count changed since it was last seen, wake the tasks that saw the old count.
+
+	if (byteCount != lastAvailable) SIGNAL_PENDING_EVENT(EVENT_SERIAL);
+	lastAvailable = byteCount;
+	noteEventSource(EVENT_SERIAL);
+}
+
+int serialInputArrived() {
+	// Return true if the number of available bytes has changed since it was last seen.
+
+	int byteCount = isOpen ? serialAvailable() : 0;
+	if (byteCount == lastAvailable) return false;
+	lastAvailable = byteCount;
+	return true;
+}
+
+#else
+
+#define noteSerialInput(byteCount)
+
+#endif
+
 // primitives
 
 static OBJ primSerialOpen(int argCount, OBJ *args) {
@@ -339,6 +369,7 @@ static OBJ primSerialClose(int argCount, OBJ *args) {
 
 OBJ primSerialAvailable(int argCount, OBJ *args) {
 	int byteCount = serialAvailable();
+	noteSerialInput(byteCount);
 	return int2obj(byteCount);
 }
 
@@ -354,7 +385,10 @@ static OBJ primSerialReadNr(int argCount, OBJ *args) {
 
 	taskSleep(-1);
 	int byteCount = serialAvailable();
-	if (byteCount == 0) return (OBJ) &emptyByteArray;
+	if (byteCount == 0) {
+		noteSerialInput(byteCount);
+		return (OBJ) &emptyByteArray;
+	}
 	if (byteCount < 0) return fail(primitiveNotImplemented);
 	int nrbytes = obj2int(args[0]);
 	byteCount = (nrbytes<=byteCount) ? nrbytes : byteCount;
@@ -373,7 +407,10 @@ static OBJ primSerialRead(int argCount, OBJ *args) {
 
 	taskSleep(-1);
 	int byteCount = serialAvailable();
-	if (byteCount == 0) return (OBJ) &emptyByteArray;
+	if (byteCount == 0) {
+		noteSerialInput(byteCount);
+		return (OBJ) &emptyByteArray;
+	}
 	if (byteCount < 0) return fail(primitiveNotImplemented);
 
 	int wordCount = (byteCount + 3) / 4;
@@ -393,10 +430,14 @@ static OBJ primSerialReadInto(int argCount, OBJ *args) {
 
 	taskSleep(-1);
 	int byteCount = serialAvailable();
-	if (byteCount == 0) return zeroObj;
+	if (byteCount == 0) {
+		noteSerialInput(byteCount);
+		return zeroObj;
+	}
 	if (byteCount < 0) return fail(primitiveNotImplemented);
 
 	if (byteCount > (int) BYTES(buf)) byteCount = BYTES(buf);
+	if (!UNSHARE_BYTES(buf)) return zeroObj; // allocation failed
 	serialReadBytes((uint8 *) &FIELD(buf, 0), byteCount);
 	return int2obj(byteCount);
 }
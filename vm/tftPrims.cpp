@@ -1680,6 +1680,7 @@ OBJ primResumeUpdates(int argCount, OBJ *args) {
 
 static OBJ primMergeBitmap(int argCount, OBJ *args) {
 	if (!hasTFT()) return falseObj;
+	if (IS_TYPE(args[2], ByteArrayType) && !UNSHARE_BYTES(args[2])) return falseObj; // allocation failed
 
 	OBJ bitmap = args[0];
 	int bitmapWidth = obj2int(args[1]);
@@ -22,6 +22,7 @@ static OBJ primVarExists (int argCount, OBJ *args) {
 static OBJ primVarNamed (int argCount, OBJ *args) {
 	int index = indexOfVarNamed(obj2str(args[0]));
 	if (index > -1) {
+		RELEASE_BUILDER(vars[index]);
 		return vars[index];
 	}
 	return int2obj(0);
@@ -42,22 +43,13 @@ OBJ primVarNameForIndex(int argCount, OBJ *args) {
 
 	int varIndex = ((argCount > 0) && isInt(args[0])) ? obj2int(args[0]) - 1 : -1;
 
+	char *name = varNameAt(varIndex);
+	if (name) return internString(name, strlen(name));
+
 	int maxVarIndex = -1;
-	char *varEntry = NULL;
-	int *p = scanStart();
-	while (p) {
-		int recType = (*p >> 16) & 0xFF;
-		int id = (*p >> 8) & 0xFF;
-		if (recType == varName) {
-			if (id > maxVarIndex) maxVarIndex = id;
-			if (varIndex == id) varEntry = (char *) (p + 2);
-		} else if (recType == varsClearAll) {
-			maxVarIndex = -1;
-			varEntry = NULL;
-		}
-		p = recordAfter(p);
+	for (int i = 0; i < MAX_VARS; i++) {
+		if (varNameAt(i)) maxVarIndex = i;
 	}
-	if (varEntry) return newStringFromBytes(varEntry, strlen(varEntry));
 	return int2obj(maxVarIndex + 1);
 }
 
@@ -68,6 +68,9 @@ void setup() {
 	memInit();
 	primsInit();
 	hardwareInit();
+	#if defined(DUAL_CORE)
+		startIOCore();
+	#endif
 	outputString((char *) "Welcome to MicroBlocks!");
 	restoreScripts();
 	if (BLE_isEnabled()) BLE_start();